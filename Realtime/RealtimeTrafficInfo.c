@@ -46,6 +46,7 @@
 #include "../roadmap_navigate.h"
 #include "../editor/editor_points.h"
 #include "../roadmap_ticker.h"
+#include "../roadmap_hash.h"
 #include "Realtime.h"
 #include "RealtimeNet.h"
 #include "RealtimeTrafficInfo.h"
@@ -57,10 +58,14 @@
 
 static RTTrafficInfos gTrafficInfoTable;
 static RTTrafficLines gRTTrafficInfoLinesTable;
+static RoadMapHash *gRTTrafficInfoLinesHash = NULL;
+
+#define RT_TRAFFIC_LINE_KEY(square, line) (((square) << 16) + (line))
 
 
 static BOOL RTTrafficInfo_GenerateAlert(RTTrafficInfo *pTrafficInfo, int iNodeNumber);
 static BOOL RTTrafficInfo_DeleteAlert(int iID);
+static void RTTrafficInfo_IndexLines(void);
 
  /**
  * Initialize the Traffic info structure
@@ -107,7 +112,7 @@ void RTTrafficInfo_Init()
    for (i=0;i <MAX_LINES; i++){
 		gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i] = NULL;
 	}
-
+   RTTrafficInfo_IndexLines();
 
    RealtimeTrafficInfoPluginInit();
 }
@@ -121,6 +126,11 @@ void RTTrafficInfo_Term()
 {
 	RTTrafficInfo_ClearAll();
 	RealtimeTrafficInfoPluginTerm();
+
+	if (gRTTrafficInfoLinesHash) {
+		roadmap_hash_free (gRTTrafficInfoLinesHash);
+		gRTTrafficInfoLinesHash = NULL;
+	}
 }
 
 /**
@@ -161,6 +171,7 @@ void RTTrafficInfo_ClearAll()
    	free (gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]);
    	gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i] = NULL;
    }
+   RTTrafficInfo_IndexLines();
 
 }
 
@@ -256,6 +267,26 @@ static BOOL RTTrafficInfo_DeleteAlert(int iID)
 	return RTAlerts_Remove(iID + ALERT_ID_OFFSET);
 }
 
+/**
+ * Rebuild the (square, line) index of the lines table
+ * @param None
+ * @return None
+ */
+static void RTTrafficInfo_IndexLines(void){
+	int i;
+
+	if (gRTTrafficInfoLinesHash)
+		roadmap_hash_free (gRTTrafficInfoLinesHash);
+
+	gRTTrafficInfoLinesHash = roadmap_hash_new ("RTTrafficLines", MAX_LINES);
+
+	for (i = 0; i < gRTTrafficInfoLinesTable.iCount; i++){
+		RTTrafficInfoLines *pLine = gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i];
+		roadmap_hash_add (gRTTrafficInfoLinesHash,
+								RT_TRAFFIC_LINE_KEY(pLine->pluginLine.square, pLine->pluginLine.line_id), i);
+	}
+}
+
 /**
  * Checks whether 2 GPS points are equal (or very close according to the allowed deciation)
  * @param a - Pointer to first opoint
@@ -317,6 +348,8 @@ static int  extendCallBack (const PluginLine *line, void *context, int extend_fl
    gRTTrafficInfoLinesTable.pRTTrafficInfoLines[iLinesCount]->iLastShape = last_shape;
    gRTTrafficInfoLinesTable.pRTTrafficInfoLines[iLinesCount]->iDirection = pTrafficInfo->iDirection;
    gRTTrafficInfoLinesTable.iCount++;
+
+   roadmap_hash_add (gRTTrafficInfoLinesHash, RT_TRAFFIC_LINE_KEY(line->square, line->line_id), iLinesCount);
    return 0;
 }
 
@@ -494,7 +527,10 @@ static BOOL RTTraficInfo_DeleteSegments(int iTrafficInfoID){
     		i++;
     }
 
-	return found;
+    if (found)
+    	RTTrafficInfo_IndexLines();
+
+    return found;
 }
 
 typedef struct traffic_info_context_st{
@@ -731,6 +767,7 @@ RTTrafficInfoLines *RTTrafficInfo_GetLine(int Record)
  int RTTrafficInfo_Get_Line(int line, int square,  int against_dir){
 	int i;
 	int direction;
+	int found = -1;
 
 	if (gRTTrafficInfoLinesTable.iCount == 0)
 		return -1;
@@ -740,14 +777,17 @@ RTTrafficInfoLines *RTTrafficInfo_GetLine(int Record)
 	else
 		direction = ROUTE_DIRECTION_WITH_LINE;
 
-	for (i = 0; i < gRTTrafficInfoLinesTable.iCount; i++){
+	for (i = roadmap_hash_get_first (gRTTrafficInfoLinesHash, RT_TRAFFIC_LINE_KEY(square, line));
+		  i >= 0;
+		  i = roadmap_hash_get_next (gRTTrafficInfoLinesHash, i)){
 		if ((gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]->pluginLine.line_id == line) &&
 			  (gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]->iDirection == direction) &&
-			  (gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]->pluginLine.square == square))
-			return i;
+			  (gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]->pluginLine.square == square) &&
+			  (found == -1 || i < found))
+			found = i;
 	}
 
-	return -1;
+	return found;
 }
 
 /**
@@ -758,16 +798,21 @@ RTTrafficInfoLines *RTTrafficInfo_GetLine(int Record)
  */
 static int RTTrafficInfo_Get_LineNoDirection(int line, int square){
 	int i;
+	int found = -1;
 
 	if (gRTTrafficInfoLinesTable.iCount == 0)
 		return -1;
 
-	for (i = 0; i < gRTTrafficInfoLinesTable.iCount; i++){
-		if ((gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]->pluginLine.line_id == line) && (gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]->pluginLine.square == square))
-			return i;
+	for (i = roadmap_hash_get_first (gRTTrafficInfoLinesHash, RT_TRAFFIC_LINE_KEY(square, line));
+		  i >= 0;
+		  i = roadmap_hash_get_next (gRTTrafficInfoLinesHash, i)){
+		if ((gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]->pluginLine.line_id == line) &&
+			 (gRTTrafficInfoLinesTable.pRTTrafficInfoLines[i]->pluginLine.square == square) &&
+			 (found == -1 || i < found))
+			found = i;
 	}
 
-	return -1;
+	return found;
 }
 
 /**
@@ -836,6 +881,7 @@ void RTTrafficInfo_RecalculateSegments(){
 	for (i=0;i<gRTTrafficInfoLinesTable.iCount; i++){
 			RTTraficInfo_RemoveSegments(i);
 	}
+	RTTrafficInfo_IndexLines();
 
 	for (i=0;i<gTrafficInfoTable.iCount; i++){
 		RTTrafficInfo_AddSegments(gTrafficInfoTable.pTrafficInfo[i]);
@@ -70,6 +70,13 @@ extern "C" {
 }
 #include "../roadmap_canvas_agg.h"
 
+/* Drawing in bands needs threads */
+#if defined(ANDROID) || defined(IPHONE)
+#define ROADMAP_CANVAS_BANDS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #define MAX_THICKNESS 50
 
 //#define RGB565
@@ -120,6 +127,268 @@ static struct roadmap_canvas_pen *RoadMapPenList = NULL;
 static RoadMapPen CurrentPen;
 static int        RoadMapCanvasFontLoaded = 0;
 
+#ifdef ROADMAP_CANVAS_BANDS
+/* Lines and polygons may be drawn by several threads, each into its own
+ * horizontal band of the canvas. Every band replays the whole call with
+ * its own rasterizers and only its rows are written, so the result is the
+ * same as drawing them in one pass. Paths that cannot reach a band are
+ * skipped by that band.
+ */
+#define CANVAS_MAX_BANDS         8
+#define CANVAS_BAND_MIN_POINTS   256
+
+enum { BAND_LINES, BAND_POLYGONS };
+
+struct canvas_band {
+   pixfmt pixf;
+   renbase_type renb;
+   agg::renderer_outline_aa<renbase_type> reno;
+   agg::rasterizer_outline_aa< agg::renderer_outline_aa<renbase_type> > raso;
+   agg::rasterizer_scanline_aa<> ras;
+   agg::scanline_p8 sl;
+   agg::renderer_scanline_aa_solid<renbase_type> ren_solid;
+   agg::path_storage path;
+
+   int miny;
+   int maxy;
+   unsigned int generation;
+   pthread_t thread;
+
+   canvas_band(): pixf(agg_rbuf), renb(pixf), reno(renb, def_profile),
+                  raso(reno), ren_solid(renb) {}
+};
+
+static struct {
+   int type;
+   int count;
+   int *items;
+   RoadMapGuiPoint *points;
+   int filled;
+   int fast_draw;
+   agg::rgba8 color;
+   agg::line_profile_aa *profile;
+   int margin;
+} CanvasBandJob;
+
+static canvas_band *CanvasBands[CANVAS_MAX_BANDS];
+static int CanvasBandCount = 0;
+
+static pthread_mutex_t CanvasBandLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t CanvasBandStart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t CanvasBandDone = PTHREAD_COND_INITIALIZER;
+static unsigned int CanvasBandGeneration = 0;
+static int CanvasBandsDone = 0;
+
+static RoadMapConfigDescriptor RoadMapConfigCanvasThreads =
+                        ROADMAP_CONFIG_ITEM("Canvas", "Threads");
+
+
+static void roadmap_canvas_band_render (canvas_band *band) {
+
+   int *items = CanvasBandJob.items;
+   RoadMapGuiPoint *points = CanvasBandJob.points;
+   int i;
+   int j;
+
+   band->reno.profile(*CanvasBandJob.profile);
+   band->reno.color(CanvasBandJob.color);
+   band->ren_solid.color(CanvasBandJob.color);
+
+   if (CanvasBandJob.type == BAND_LINES && !CanvasBandJob.fast_draw) {
+      band->raso.round_cap(true);
+      band->raso.line_join(agg::outline_miter_accurate_join);
+   } else {
+      band->raso.round_cap(false);
+      band->raso.line_join(agg::outline_no_join);
+   }
+
+   for (i = 0; i < CanvasBandJob.count; ++i) {
+
+      int count_of_points = items[i];
+      int miny;
+      int maxy;
+
+      /* as drawn in one pass, the remaining lines are dropped */
+      if (CanvasBandJob.type == BAND_LINES && count_of_points < 2) break;
+
+      if (count_of_points <= 0) continue;
+
+      miny = maxy = points->y;
+      for (j = 1; j < count_of_points; j++) {
+         if (points[j].y < miny) miny = points[j].y;
+         if (points[j].y > maxy) maxy = points[j].y;
+      }
+
+      if (maxy + CanvasBandJob.margin < band->miny ||
+          miny - CanvasBandJob.margin > band->maxy) {
+         points += count_of_points;
+         continue;
+      }
+
+      band->path.move_to(points->x, points->y);
+      for (j = 1; j < count_of_points; j++) {
+         band->path.line_to(points[j].x, points[j].y);
+      }
+      points += count_of_points;
+
+      if (CanvasBandJob.type == BAND_LINES) {
+
+         band->raso.add_path(band->path);
+
+      } else {
+
+         band->path.close_polygon();
+
+         if (CanvasBandJob.filled) {
+
+            band->ras.reset();
+            band->ras.add_path(band->path);
+            agg::render_scanlines(band->ras, band->sl, band->ren_solid);
+
+         } else if (CanvasBandJob.fast_draw) {
+            renderer_pr ren_pr(band->renb);
+            agg::rasterizer_outline<renderer_pr> ras_line(ren_pr);
+            ren_pr.line_color(CanvasBandJob.color);
+            ras_line.add_path(band->path);
+
+         } else {
+
+            band->raso.add_path(band->path);
+         }
+      }
+
+      band->path.remove_all ();
+   }
+}
+
+
+static void *roadmap_canvas_band_main (void *arg) {
+
+   canvas_band *band = (canvas_band *)arg;
+
+   for (;;) {
+
+      pthread_mutex_lock (&CanvasBandLock);
+      while (band->generation == CanvasBandGeneration) {
+         pthread_cond_wait (&CanvasBandStart, &CanvasBandLock);
+      }
+      band->generation = CanvasBandGeneration;
+      pthread_mutex_unlock (&CanvasBandLock);
+
+      roadmap_canvas_band_render (band);
+
+      pthread_mutex_lock (&CanvasBandLock);
+      if (++CanvasBandsDone == CanvasBandCount - 1) {
+         pthread_cond_signal (&CanvasBandDone);
+      }
+      pthread_mutex_unlock (&CanvasBandLock);
+   }
+
+   return NULL;
+}
+
+
+static void roadmap_canvas_bands_configure (void) {
+
+   int width = agg_rbuf.width();
+   int height = agg_rbuf.height();
+   int i;
+
+   if (CanvasBandCount == 0) {
+
+      int threads;
+
+      roadmap_config_declare
+          ("preferences", &RoadMapConfigCanvasThreads, "1", NULL);
+
+      threads = roadmap_config_get_integer (&RoadMapConfigCanvasThreads);
+      if (threads <= 0) threads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+      if (threads > CANVAS_MAX_BANDS) threads = CANVAS_MAX_BANDS;
+      if (threads < 1) threads = 1;
+
+      CanvasBands[0] = new canvas_band();
+      roadmap_check_allocated(CanvasBands[0]);
+      CanvasBandCount = 1;
+
+      for (i = 1; i < threads; i++) {
+
+         canvas_band *band = new canvas_band();
+         roadmap_check_allocated(band);
+
+         band->generation = CanvasBandGeneration;
+         if (pthread_create (&band->thread, NULL,
+                             roadmap_canvas_band_main, band) != 0) {
+            roadmap_log (ROADMAP_ERROR,
+                  "Can't start canvas thread, using %d", CanvasBandCount);
+            delete band;
+            break;
+         }
+
+         CanvasBands[CanvasBandCount++] = band;
+      }
+   }
+
+   for (i = 0; i < CanvasBandCount; i++) {
+
+      canvas_band *band = CanvasBands[i];
+
+      band->miny = (height * i) / CanvasBandCount;
+      band->maxy = (height * (i + 1)) / CanvasBandCount - 1;
+
+      band->renb.attach(band->pixf);
+      band->renb.clip_box(0, band->miny, width - 1, band->maxy);
+      band->ras.clip_box(0, 0, width - 1, height - 1);
+   }
+}
+
+
+static int roadmap_canvas_bands_draw (int type, int count, int *items,
+                                      RoadMapGuiPoint *points,
+                                      int filled, int fast_draw) {
+
+   int total = 0;
+   int i;
+
+   if (CanvasBandCount < 2) return 0;
+
+   for (i = 0; i < count; i++) total += items[i];
+   if (total < CANVAS_BAND_MIN_POINTS) return 0;
+
+   CanvasBandJob.type = type;
+   CanvasBandJob.count = count;
+   CanvasBandJob.items = items;
+   CanvasBandJob.points = points;
+   CanvasBandJob.filled = filled;
+   CanvasBandJob.fast_draw = fast_draw;
+   CanvasBandJob.color = CurrentPen->color;
+   CanvasBandJob.profile = CurrentPen->profile;
+
+   /* how far outside of its points a path may draw */
+   if (type == BAND_POLYGONS && filled) {
+      CanvasBandJob.margin = 2;
+   } else {
+      CanvasBandJob.margin = CurrentPen->thickness + 4;
+   }
+
+   pthread_mutex_lock (&CanvasBandLock);
+   CanvasBandsDone = 0;
+   CanvasBandGeneration++;
+   pthread_cond_broadcast (&CanvasBandStart);
+   pthread_mutex_unlock (&CanvasBandLock);
+
+   roadmap_canvas_band_render (CanvasBands[0]);
+
+   pthread_mutex_lock (&CanvasBandLock);
+   while (CanvasBandsDone < CanvasBandCount - 1) {
+      pthread_cond_wait (&CanvasBandDone, &CanvasBandLock);
+   }
+   pthread_mutex_unlock (&CanvasBandLock);
+
+   return 1;
+}
+#endif /* ROADMAP_CANVAS_BANDS */
+
+
 /* The canvas callbacks: all callbacks are initialized to do-nothing
  * functions, so that we don't care checking if one has been setup.
  */
@@ -394,6 +663,13 @@ void roadmap_canvas_draw_multiple_lines (int count, int *lines,
    }
 #endif
 
+#ifdef ROADMAP_CANVAS_BANDS
+   if (roadmap_canvas_bands_draw (BAND_LINES, count, lines, points, 0, fast_draw)) {
+      dbg_time_end(DBG_TIME_DRAW_LINES);
+      return;
+   }
+#endif
+
    if (!fast_draw) {
       raso.round_cap(true);
       raso.line_join(agg::outline_miter_accurate_join);
@@ -471,6 +747,13 @@ void roadmap_canvas_draw_multiple_polygons
 
    static agg::path_storage path;
 
+#ifdef ROADMAP_CANVAS_BANDS
+   if (roadmap_canvas_bands_draw
+         (BAND_POLYGONS, count, polygons, points, filled, fast_draw)) {
+      return;
+   }
+#endif
+
    for (i = 0; i < count; ++i) {
 
       count_of_points = *polygons;
@@ -599,6 +882,109 @@ void roadmap_canvas_save_screenshot (const char* filename) {
 }
 
 
+/* The map of the last full frame, shown moved and scaled while the map is
+ * dragged so that only the uncovered parts are drawn again.
+ */
+static agg::rendering_buffer RetainedRbuf;
+static unsigned char *RetainedBuf = NULL;
+static int RetainedBufSize = 0;
+static int RetainedValid = 0;
+
+void roadmap_canvas_retain_map (void) {
+
+   int stride = agg_rbuf.stride();
+   int size = agg_rbuf.height() * (stride < 0 ? -stride : stride);
+
+   if (size > RetainedBufSize) {
+      free (RetainedBuf);
+      RetainedBuf = (unsigned char *) malloc (size);
+      roadmap_check_allocated(RetainedBuf);
+      RetainedBufSize = size;
+   }
+
+   RetainedRbuf.attach (RetainedBuf, agg_rbuf.width(), agg_rbuf.height(), stride);
+   RetainedRbuf.copy_from (agg_rbuf);
+   RetainedValid = 1;
+}
+
+
+int roadmap_canvas_retained_map_area (int dx, int dy, int scale,
+                                      RoadMapGuiRect *covered) {
+
+   int width = agg_rbuf.width();
+   int height = agg_rbuf.height();
+   int cx = width / 2;
+   int cy = height / 2;
+
+   if (!RetainedValid ||
+       (int)RetainedRbuf.width() != width ||
+       (int)RetainedRbuf.height() != height ||
+       scale <= 0) {
+      return 0;
+   }
+
+   /* the kept map is scaled around the center of the canvas, then moved */
+   covered->minx = cx + dx - (cx * scale) / 1024;
+   covered->miny = cy + dy - (cy * scale) / 1024;
+   covered->maxx = cx + dx + ((width - 1 - cx) * scale) / 1024;
+   covered->maxy = cy + dy + ((height - 1 - cy) * scale) / 1024;
+
+   if (covered->minx < 0) covered->minx = 0;
+   if (covered->miny < 0) covered->miny = 0;
+   if (covered->maxx > width - 1) covered->maxx = width - 1;
+   if (covered->maxy > height - 1) covered->maxy = height - 1;
+
+   return covered->minx <= covered->maxx && covered->miny <= covered->maxy;
+}
+
+
+void roadmap_canvas_draw_retained_map (int dx, int dy, int scale) {
+
+   RoadMapGuiRect covered;
+   int width = agg_rbuf.width();
+   int height = agg_rbuf.height();
+   int cx = width / 2;
+   int cy = height / 2;
+   int x;
+   int y;
+
+   if (!roadmap_canvas_retained_map_area (dx, dy, scale, &covered)) return;
+
+   if (scale == 1024) {
+      agg_renb.copy_from (RetainedRbuf, 0, dx, dy);
+      return;
+   }
+
+   for (y = covered.miny; y <= covered.maxy; y++) {
+
+      int sy = cy + ((y - cy - dy) * 1024) / scale;
+      unsigned char *dst;
+      const unsigned char *src;
+
+      if (sy < 0 || sy >= height) continue;
+
+      dst = agg_rbuf.row_ptr (y);
+      src = RetainedRbuf.row_ptr (sy);
+
+      for (x = covered.minx; x <= covered.maxx; x++) {
+
+         int sx = cx + ((x - cx - dx) * 1024) / scale;
+
+         if (sx < 0 || sx >= width) continue;
+
+         memcpy (dst + x * pixfmt::pix_width,
+                 src + sx * pixfmt::pix_width, pixfmt::pix_width);
+      }
+   }
+}
+
+
+void roadmap_canvas_discard_retained_map (void) {
+
+   RetainedValid = 0;
+}
+
+
 /*
 ** Use FRIBIDI to encode the string.
 ** The return value must be freed by the caller.
@@ -778,6 +1164,10 @@ void roadmap_canvas_agg_configure (unsigned char *buf, int width, int height, in
    agg_renb.reset_clipping(true);
    ras.clip_box(0, 0, agg_renb.width() - 1, agg_renb.height() - 1);
 
+#ifdef ROADMAP_CANVAS_BANDS
+   roadmap_canvas_bands_configure ();
+#endif
+
    agg::glyph_rendering gren = agg::glyph_ren_outline;
    agg::glyph_rendering image_gren = agg::glyph_ren_agg_gray8;
 
@@ -0,0 +1,290 @@
+/* navigate_bench.c - routing performance benchmark
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009, Waze Ltd
+ *
+ *   This file is part of RoadMap.
+ *
+ *   RoadMap is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   RoadMap is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with RoadMap; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * SYNOPSYS:
+ *
+ *   See navigate_bench.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "roadmap.h"
+#include "roadmap_layer.h"
+#include "roadmap_line.h"
+#include "roadmap_line_route.h"
+#include "roadmap_locator.h"
+#include "roadmap_navigate.h"
+#include "roadmap_plugin.h"
+#include "roadmap_square.h"
+#include "roadmap_tile_storage.h"
+#include "roadmap_time.h"
+
+#ifndef J2ME
+#include "editor/editor_plugin.h"
+#endif
+
+#include "navigate_cost.h"
+#include "navigate_graph.h"
+#include "navigate_route.h"
+#include "navigate_bench.h"
+
+#define BENCH_MAX_PAIRS 10000
+#define BENCH_ORIGIN_ACCURACY 200
+#define BENCH_DESTINATION_ACCURACY 50
+
+typedef struct {
+   RoadMapPosition from;
+   RoadMapPosition to;
+} BenchPair;
+
+typedef struct {
+   const char *name;
+   int type;
+   int use_traffic;
+} BenchCost;
+
+static const BenchCost BenchCosts[] = {
+   {"shortest", COST_SHORTEST, 0},
+   {"fastest", COST_FASTEST, 0},
+   {"fastest_traffic", COST_FASTEST, 1}
+};
+
+#define BENCH_NUM_COSTS ((int)(sizeof (BenchCosts) / sizeof (BenchCosts[0])))
+
+
+static int load_pairs (const char *name, BenchPair *pairs, int max) {
+
+   FILE *file = fopen (name, "r");
+   char line[256];
+   int count = 0;
+
+   if (!file) {
+      roadmap_log (ROADMAP_ERROR, "Can't open route benchmark file %s", name);
+      return -1;
+   }
+
+   while (count < max && fgets (line, sizeof (line), file)) {
+
+      BenchPair *pair = pairs + count;
+
+      if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+
+      if (sscanf (line, "%d,%d %d,%d",
+                  &pair->from.longitude, &pair->from.latitude,
+                  &pair->to.longitude, &pair->to.latitude) != 4) {
+         roadmap_log (ROADMAP_WARNING, "Bad route benchmark line: %s", line);
+         continue;
+      }
+      count++;
+   }
+
+   fclose (file);
+   return count;
+}
+
+
+/* Finds the road at position, and its end point in the driving direction:
+ * the exit point for an origin, the entry point for a destination.
+ */
+static int find_end_point (const RoadMapPosition *position, int accuracy, int is_origin,
+                           PluginLine *line, int *point) {
+
+   int distance;
+   int from;
+   int to;
+   int rc;
+
+#ifndef J2ME
+   editor_plugin_set_override (0);
+#endif
+   rc = roadmap_navigate_retrieve_line (position, 0, accuracy, line, &distance,
+                                        LAYER_ALL_ROADS);
+#ifndef J2ME
+   editor_plugin_set_override (1);
+#endif
+
+   if (rc == -1 || roadmap_plugin_get_id (line) != ROADMAP_PLUGIN_ID) return -1;
+
+   roadmap_square_set_current (line->square);
+   roadmap_line_points (line->line_id, &from, &to);
+
+   if (roadmap_plugin_get_direction (line, ROUTE_CAR_ALLOWED) ==
+         ROUTE_DIRECTION_AGAINST_LINE) {
+      *point = is_origin ? from : to;
+   } else {
+      *point = is_origin ? to : from;
+   }
+
+   return 0;
+}
+
+
+static int compare_times (const void *a, const void *b) {
+
+   return *(const int *)a - *(const int *)b;
+}
+
+
+static int percentile (const int *sorted, int count, int percent) {
+
+   if (count == 0) return 0;
+
+   return sorted[(count - 1) * percent / 100];
+}
+
+
+static int run_cost (FILE *report, const BenchCost *cost,
+                     const BenchPair *pairs, int num_pairs, int *times) {
+
+   NavigateRouteStats stats;
+   NavigateGraphStats graph;
+   RoadMapSquareStats squares;
+   RoadMapSquareStats squares_start;
+   int heap_gets = 0;
+   int nodes = 0;
+   int peak_memory = 0;
+   int failed = 0;
+   int missing = 0;
+   int count = 0;
+   int tiles = roadmap_tile_load_count ();
+   int i;
+
+   navigate_cost_override_type (cost->type, cost->use_traffic);
+   roadmap_square_get_stats (ROADMAP_SQUARE_CONSUMER_ROUTE, &squares_start);
+
+   for (i = 0; i < num_pairs; i++) {
+
+      PluginLine from_line;
+      PluginLine to_line;
+      int from_point;
+      int to_point;
+      NavigateSegment *segments;
+      int num_total;
+      int num_new;
+      int flags = NEW_ROUTE;
+      uint32_t start;
+      int rc;
+
+      if (find_end_point (&pairs[i].from, BENCH_ORIGIN_ACCURACY, 1,
+                          &from_line, &from_point) ||
+          find_end_point (&pairs[i].to, BENCH_DESTINATION_ACCURACY, 0,
+                          &to_line, &to_point)) {
+         missing++;
+         continue;
+      }
+
+      navigate_cost_reset ();
+
+      start = roadmap_time_get_millis ();
+      rc = navigate_route_get_segments (&from_line, from_point, &to_line, &to_point,
+                                        &segments, &num_total, &num_new, &flags,
+                                        NULL, 0);
+      times[count++] = (int)(roadmap_time_get_millis () - start);
+
+      if (rc <= 0) failed++;
+
+      navigate_route_get_stats (&stats);
+      heap_gets += stats.heap_gets;
+      nodes += stats.nodes;
+      if (stats.memory > peak_memory) peak_memory = stats.memory;
+   }
+
+   qsort (times, count, sizeof (int), compare_times);
+   navigate_graph_get_stats (&graph);
+   roadmap_square_get_stats (ROADMAP_SQUARE_CONSUMER_ROUTE, &squares);
+
+   fprintf (report,
+            "%-16s routes %d failed %d no-road %d | ms p50 %d p95 %d p99 %d max %d | "
+            "heap gets %d nodes %d (per route) | tiles loaded %d | "
+            "square cache hits %d misses %d load ms %d | "
+            "search memory %d graph cache %d bytes\n",
+            cost->name, count, failed, missing,
+            percentile (times, count, 50),
+            percentile (times, count, 95),
+            percentile (times, count, 99),
+            count ? times[count - 1] : 0,
+            count ? heap_gets / count : 0,
+            count ? nodes / count : 0,
+            roadmap_tile_load_count () - tiles,
+            squares.hits - squares_start.hits,
+            squares.misses - squares_start.misses,
+            squares.load_ms - squares_start.load_ms,
+            peak_memory, graph.mem_used);
+
+   return count;
+}
+
+
+int navigate_bench_run (const char *pairs_file, const char *report_file) {
+
+   BenchPair *pairs;
+   int *times;
+   int num_pairs;
+   FILE *report = stdout;
+   int total = 0;
+   int i;
+
+   if (navigate_route_load_data () < 0) {
+      roadmap_log (ROADMAP_ERROR, "Route benchmark: can't load navigation data");
+      return -1;
+   }
+
+   pairs = malloc (BENCH_MAX_PAIRS * sizeof (BenchPair));
+   times = malloc (BENCH_MAX_PAIRS * sizeof (int));
+   if (!pairs || !times) {
+      free (pairs);
+      free (times);
+      return -1;
+   }
+
+   num_pairs = load_pairs (pairs_file, pairs, BENCH_MAX_PAIRS);
+
+   if (num_pairs > 0 && report_file) {
+      report = fopen (report_file, "w");
+      if (!report) {
+         roadmap_log (ROADMAP_ERROR, "Can't create route benchmark report %s", report_file);
+         num_pairs = -1;
+      }
+   }
+
+   if (num_pairs > 0) {
+
+      navigate_route_set_quiet (1);
+
+      fprintf (report, "Route benchmark: %d pairs from %s\n", num_pairs, pairs_file);
+      for (i = 0; i < BENCH_NUM_COSTS; i++) {
+         total += run_cost (report, BenchCosts + i, pairs, num_pairs, times);
+      }
+
+      navigate_route_set_quiet (0);
+      navigate_cost_reset_type ();
+
+      if (report != stdout) fclose (report);
+   }
+
+   free (pairs);
+   free (times);
+
+   return num_pairs < 0 ? -1 : total;
+}
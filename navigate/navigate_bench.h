@@ -0,0 +1,45 @@
+/* navigate_bench.h - routing performance benchmark
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009, Waze Ltd
+ *
+ *   This file is part of RoadMap.
+ *
+ *   RoadMap is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   RoadMap is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with RoadMap; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * DESCRIPTION:
+ *
+ *   Replays a file of origin / destination pairs through the local route
+ *   calculation, once for each cost type, and reports the latency
+ *   percentiles and the search counters. The tiles must already be in
+ *   the map directory; the benchmark does not wait for downloads.
+ *
+ *   Each line of the file holds one pair, in RoadMap coordinates:
+ *
+ *      FROM_LONGITUDE,FROM_LATITUDE TO_LONGITUDE,TO_LATITUDE
+ *
+ *   Empty lines and lines starting with '#' are ignored.
+ */
+
+#ifndef _NAVIGATE_BENCH_H_
+#define _NAVIGATE_BENCH_H_
+
+/* Writes the report to the given file, or to stdout when NULL.
+ * Returns the number of routes calculated, or -1 on error.
+ */
+int navigate_bench_run (const char *pairs_file, const char *report_file);
+
+#endif /* _NAVIGATE_BENCH_H_ */
@@ -93,9 +93,30 @@ static ssd_cm_item      context_menu_items[] =
 static ssd_contextmenu  context_menu = SSD_CM_INIT_MENU( context_menu_items);
 #endif
 
+static int CostUseTraffic = TRUE;
+
+/* set by navigate_cost_override_type, -1 when the preferences are used */
+static int CostTypeOverride = -1;
+static int CostTrafficOverride = FALSE;
+
 int navigate_cost_use_traffic (void) {
 
-	return TRUE;
+   if (CostTypeOverride != -1) return CostTrafficOverride;
+
+	return CostUseTraffic;
+}
+
+
+void navigate_cost_override_type (int type, int use_traffic) {
+
+   CostTypeOverride = type;
+   CostTrafficOverride = use_traffic;
+}
+
+
+void navigate_cost_reset_type (void) {
+
+   CostTypeOverride = -1;
 }
 
 int navigate_cost_prefer_same_street (void) {
@@ -369,6 +390,31 @@ static int cost_fastest_no_traffic (int line_id, int is_reversed, int cur_cost,
 
 }
 
+static int cost_fastest_static (int line_id, int is_reversed, int cur_cost,
+                                int prev_line_id, int is_prev_reversed,
+                                int node_id) {
+
+   int cross_time = roadmap_line_speed_get_avg_cross_time (line_id, is_reversed);
+   int penalty = PENALTY_NONE;
+
+   if (!cross_time) {
+      return cost_fastest (line_id, is_reversed, cur_cost,
+                           prev_line_id, is_prev_reversed, node_id);
+   }
+
+   if (node_id != -1) penalty = calc_penalty (line_id, roadmap_line_cfcc (line_id), prev_line_id);
+
+   switch (penalty) {
+      case PENALTY_AVOID:
+         return cross_time + 3600;
+      case PENALTY_SMALL:
+         return cross_time + 60;
+      case PENALTY_NONE:
+      default:
+         return cross_time;
+   }
+}
+
 void navigate_cost_reset (void) {
    start_time = time(NULL);
 }
@@ -386,6 +432,23 @@ NavigateCostFn navigate_cost_get (void) {
    }
 }
 
+NavigateCostFn navigate_cost_get_static (void) {
+
+   if (navigate_cost_type () == COST_FASTEST) {
+      return &cost_fastest_static;
+   } else {
+      return &cost_shortest;
+   }
+}
+
+int navigate_cost_profile (void) {
+
+   return navigate_cost_type () |
+          (navigate_cost_avoid_trails () << 2) |
+          (navigate_cost_avoid_primaries () ? 0x10 : 0) |
+          (navigate_cost_prefer_same_street () ? 0x20 : 0);
+}
+
 int navigate_cost_time (int line_id, int is_revesred, int cur_cost,
                         int prev_line_id, int is_prev_reversed) {
 
@@ -428,7 +491,9 @@ void navigate_cost_initialize (void) {
 }
 
 int navigate_cost_type (void) {
-   if (roadmap_config_match(&CostTypeCfg, "Fastest")) {
+   if (CostTypeOverride != -1) {
+      return CostTypeOverride;
+   } else if (roadmap_config_match(&CostTypeCfg, "Fastest")) {
       return COST_FASTEST;
    } else {
       return COST_SHORTEST;
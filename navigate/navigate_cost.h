@@ -51,6 +51,13 @@ typedef int (*NavigateCostFn) (int line_id, int is_reversed, int cur_cost,
 void navigate_cost_reset (void);
 NavigateCostFn navigate_cost_get (void);
 
+/* Costs that do not depend on live traffic or on the time of day,
+ * suitable for precomputed data. The profile identifies the user
+ * preferences that such costs were computed with.
+ */
+NavigateCostFn navigate_cost_get_static (void);
+int navigate_cost_profile (void);
+
 int navigate_cost_time (int line_id, int is_reversed, int cur_cost,
                         int prev_line_id, int is_prev_reversed);
 
@@ -58,6 +65,11 @@ void navigate_cost_initialize (void);
 
 int navigate_cost_type (void);
 int navigate_cost_use_traffic (void);
+/* Routes with this type until navigate_cost_reset_type, without changing
+ * the saved preferences.
+ */
+void navigate_cost_override_type (int type, int use_traffic);
+void navigate_cost_reset_type (void);
 int navigate_cost_prefer_same_street (void);
 int navigate_cost_avoid_primaries (void);
 int navigate_cost_avoid_trails (void);
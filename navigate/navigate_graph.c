@@ -44,113 +44,169 @@
 #include "roadmap_line_route.h"
 #include "roadmap_plugin.h"
 #include "roadmap_navigate.h"
+#include "roadmap_config.h"
 
 #include "navigate_graph.h"
 
 #ifdef J2ME
-#define MAX_GRAPH_CACHE 75
-#define MAX_MEM_CACHE 150000
+#define DEFAULT_MEM_CACHE "150000"
 #else
-#define MAX_GRAPH_CACHE 256
-#define MAX_MEM_CACHE 500000
+#define DEFAULT_MEM_CACHE "1000000"
 #endif
 
+#define GRAPH_HASH_SIZE 256
+
+#define MAX_PREDECESSOR_CANDIDATES 32
+
+/* The edges leaving each node of a square are kept in one contiguous
+ * block (compressed sparse rows): the edges of node n are
+ * edges[node_first[n]] up to edges[node_first[n + 1]].
+ */
+#define GRAPH_EDGE_ALLOWED  0x1  /* the line may be travelled this way */
+#define GRAPH_EDGE_TWO_WAY  0x2  /* the line may be travelled both ways */
+
+typedef struct {
+   int line;                     /* line id, REVERSED if leaving at its to point */
+   int to_point;                 /* node reached at the other end of the line */
+   unsigned char restrictions;   /* turns restricted when arriving on the line */
+   unsigned char flags;
+} SquareGraphEdge;
+
 struct SquareGraphItem {
    int square_id;
-   unsigned short lines_count;
-   unsigned short nodes_count;
-   unsigned short *nodes_index;
-   int *lines;
-   unsigned short *lines_index;
+   int nodes_count;
+   int edges_count;
+   int *node_first;
+   SquareGraphEdge *edges;
    int mem_size;
+
+   struct SquareGraphItem *lru_prev;
+   struct SquareGraphItem *lru_next;
+   struct SquareGraphItem *hash_next;
 };
 
-static struct SquareGraphItem *SquareGraphCache[MAX_GRAPH_CACHE];
-static int SquareCacheSize = 0;
+static RoadMapConfigDescriptor GraphCacheSizeCfg =
+                  ROADMAP_CONFIG_ITEM("Routing", "Graph cache size");
+
+/* The cache is a hash of squares, also linked in a circular LRU list
+ * whose most recently used item follows the sentinel.
+ */
+static struct SquareGraphItem *SquareGraphHash[GRAPH_HASH_SIZE];
+static struct SquareGraphItem SquareGraphLru = {
+   -1, 0, 0, NULL, NULL, 0, &SquareGraphLru, &SquareGraphLru, NULL
+};
 static int cache_total_mem;
+static NavigateGraphStats SquareGraphStats;
+static int SquareGraphGeneration;
+
+static void add_graph_edge (struct SquareGraphItem *cache,
+                            int line,
+                            int point_id,
+                            int to_point_id,
+                            int reversed) {
+
+   SquareGraphEdge *edge;
+   int direction = roadmap_line_route_get_direction (line, ROUTE_CAR_ALLOWED);
+
+   /* node_first holds the end of each node's edges until the block is
+    * filled; filling backwards leaves it at their start.
+    */
+   edge = cache->edges + --cache->node_first[point_id];
+
+   edge->line = line | reversed;
+   edge->to_point = to_point_id;
+
+   /* the restrictions apply when arriving on the line, i.e. travelling
+    * it the other way
+    */
+   edge->restrictions =
+      (unsigned char)roadmap_line_route_get_restrictions (line, !reversed);
+
+   edge->flags = 0;
+   if (direction & (reversed ? ROUTE_DIRECTION_AGAINST_LINE : ROUTE_DIRECTION_WITH_LINE)) {
+      edge->flags |= GRAPH_EDGE_ALLOWED;
+   }
+   if (direction == ROUTE_DIRECTION_ANY) {
+      edge->flags |= GRAPH_EDGE_TWO_WAY;
+   }
+}
 
-static inline void add_graph_node(struct SquareGraphItem *cache,
-                                  int line,
-                                  int point_id,
-                                  int cur_line,
-                                  int reversed) {
-
-   unsigned int l;
-
-   l = cache->nodes_index[point_id];
-	cache->nodes_index[point_id] = cur_line + 1;
-	cache->lines_index[cur_line] = l;
-/*
-   if (l) {
-      l--;
-      while (cache->lines_index[l]) {
-         l=cache->lines_index[l];
-      }
 
-      cache->lines_index[l] = cur_line;
-   } else {
-      cache->nodes_index[point_id] = cur_line + 1;
-   }
-*/
-   cache->lines[cur_line] = line|reversed;
+static inline int graph_hash (int square_id) {
+
+   return (int)(((unsigned int)square_id * 2654435761U) >> 24) & (GRAPH_HASH_SIZE - 1);
+}
+
+
+static void lru_unlink (struct SquareGraphItem *cache) {
+
+   cache->lru_prev->lru_next = cache->lru_next;
+   cache->lru_next->lru_prev = cache->lru_prev;
+}
+
+
+static void lru_push_front (struct SquareGraphItem *cache) {
+
+   cache->lru_prev = &SquareGraphLru;
+   cache->lru_next = SquareGraphLru.lru_next;
+   SquareGraphLru.lru_next->lru_prev = cache;
+   SquareGraphLru.lru_next = cache;
 }
 
 
-static void free_cache_slot (int slot) {
-   free (SquareGraphCache[slot]->nodes_index);
-   free (SquareGraphCache[slot]->lines);
-   free (SquareGraphCache[slot]->lines_index);
-   cache_total_mem -= SquareGraphCache[slot]->mem_size;
+static void free_cache_item (struct SquareGraphItem *cache) {
+
+   struct SquareGraphItem **link = SquareGraphHash + graph_hash (cache->square_id);
+
+   while (*link != cache) link = &(*link)->hash_next;
+   *link = cache->hash_next;
+
+   lru_unlink (cache);
+
+   free (cache->node_first);
+   free (cache->edges);
+   cache_total_mem -= cache->mem_size;
+   SquareGraphStats.squares--;
+   free (cache);
 }
 
 
-//TODO arrange as LRU list
 static struct SquareGraphItem *get_square_graph (int square_id) {
 
    int i;
-   int slot;
    int line;
-   int lines1_count;
-   int lines2_count;
+   int mem_budget;
+   int prev_square;
    struct SquareGraphItem *cache;
-   int cur_line = 0;
-   int found = 0;
-
-   for (slot = 0; slot < SquareCacheSize; slot++) {
-     	if (SquareGraphCache[slot]->square_id == square_id) {
-     		found = 1;
-     		//printf ("get_square_graph: found square %d in slot %d\n", square_id, slot);
-     		break;
+   int hash = graph_hash (square_id);
+
+   for (cache = SquareGraphHash[hash]; cache; cache = cache->hash_next) {
+     	if (cache->square_id == square_id) {
+     		SquareGraphStats.hits++;
+     		if (SquareGraphLru.lru_next != cache) {
+     			lru_unlink (cache);
+     			lru_push_front (cache);
+     		}
+     		return cache;
      	}
    }
 
-	if (!found) {
-		if (SquareCacheSize == MAX_GRAPH_CACHE) {
-			slot--;
-			free_cache_slot (slot);
-			cache = SquareGraphCache[slot];
-		} else {
-			cache = (struct SquareGraphItem *)malloc(sizeof(struct SquareGraphItem));
-			SquareCacheSize++;
-		}
-	} else {
-		cache = SquareGraphCache[slot];
-	}
+	SquareGraphStats.misses++;
 
-	for (i = slot; i > 0; i--) {
-		SquareGraphCache[i] = SquareGraphCache[i - 1];
-	}
-	SquareGraphCache[0] = cache;
+	//printf ("get_square_graph: adding square %d\n", square_id);
 
-	if (found) return cache;
+	prev_square = roadmap_square_active ();
+	roadmap_square_set_current (square_id);
+
+   cache = (struct SquareGraphItem *)malloc(sizeof(struct SquareGraphItem));
+   roadmap_check_allocated (cache);
 
-	//printf ("get_square_graph: adding square %d to slot %d\n", square_id, slot);
-	
    cache->square_id = square_id;
-   lines1_count = 0;
-   lines2_count = 0;
+   cache->nodes_count = roadmap_square_points_count (square_id);
+   cache->node_first = calloc (cache->nodes_count + 1, sizeof(int));
+   roadmap_check_allocated (cache->node_first);
 
-   /* Count total lines */
+   /* Count the edges of each node */
    for (i = ROADMAP_ROAD_FIRST; i <= ROADMAP_ROAD_LAST; ++i) {
 
       int first_line;
@@ -159,35 +215,48 @@ static struct SquareGraphItem *get_square_graph (int square_id) {
       if (roadmap_line_in_square
             (square_id, i, &first_line, &last_line) > 0) {
 
-         lines1_count += (last_line - first_line + 1);
+         for (line = first_line; line <= last_line; line++) {
+
+            int from_point_id;
+            int to_point_id;
+
+            roadmap_line_points (line, &from_point_id, &to_point_id);
+            cache->node_first[from_point_id & 0xffff]++;
+            cache->node_first[to_point_id & 0xffff]++;
+         }
       }
    }
 
-   cache->lines_count = lines1_count * 2 + lines2_count;
-
-   /* assume that the number of nodes equals the number of lines */
-   cache->nodes_count = roadmap_square_points_count (square_id);
+   for (i = 1; i <= cache->nodes_count; i++) {
+      cache->node_first[i] += cache->node_first[i - 1];
+   }
+   cache->edges_count = cache->node_first[cache->nodes_count];
 
-   cache->mem_size = cache->lines_count * sizeof(int) +
-                     cache->lines_count * sizeof(unsigned short) +
-                     cache->nodes_count * sizeof(unsigned short);
+   cache->mem_size = sizeof(struct SquareGraphItem) +
+                     (cache->nodes_count + 1) * sizeof(int) +
+                     cache->edges_count * sizeof(SquareGraphEdge);
 
-   while (cache_total_mem &&
-          ((cache_total_mem + cache->mem_size) > MAX_MEM_CACHE) &&
-          SquareCacheSize > 1) {
+   mem_budget = roadmap_config_get_integer (&GraphCacheSizeCfg);
+   while (SquareGraphLru.lru_prev != &SquareGraphLru &&
+          (cache_total_mem + cache->mem_size) > mem_budget) {
 
-		SquareCacheSize--;
-      free_cache_slot(SquareCacheSize);
-      free (SquareGraphCache[SquareCacheSize]);
-      SquareGraphCache[SquareCacheSize] = NULL;
+      free_cache_item (SquareGraphLru.lru_prev);
+      SquareGraphStats.evictions++;
    }
 
-   cache->lines = malloc(cache->lines_count * sizeof(int));
-   cache->lines_index = calloc(cache->lines_count, sizeof(unsigned short));
-   cache->nodes_index = calloc(cache->nodes_count, sizeof(unsigned short));
+   cache->edges = malloc (cache->edges_count * sizeof(SquareGraphEdge));
+   roadmap_check_allocated (cache->edges);
 
    cache_total_mem += cache->mem_size;
+   SquareGraphStats.squares++;
+
+   cache->hash_next = SquareGraphHash[hash];
+   SquareGraphHash[hash] = cache;
+   lru_push_front (cache);
 
+   /* Fill the edges backwards, so that each node lists its lines in
+    * ascending order (the order turn restriction bits refer to).
+    */
    for (i = ROADMAP_ROAD_LAST; i >= ROADMAP_ROAD_FIRST; --i) {
 
       int first_line;
@@ -202,24 +271,16 @@ static struct SquareGraphItem *get_square_graph (int square_id) {
             int to_point_id;
 
             roadmap_line_points (line, &from_point_id, &to_point_id);
-            from_point_id &= 0xffff;
-
-            add_graph_node(cache, line, from_point_id, cur_line, 0);
-            cur_line++;
-
-            //if (roadmap_point_square(to_point_id) == square_id) {
 
-               to_point_id &= 0xffff;
-
-               add_graph_node(cache, line, to_point_id, cur_line, REVERSED);
-
-               cur_line++;
-            //}
+            add_graph_edge (cache, line, from_point_id & 0xffff, to_point_id, 0);
+            add_graph_edge (cache, line, to_point_id & 0xffff, from_point_id, REVERSED);
          }
       }
    }
 
-   assert(cur_line <= cache->lines_count);
+   assert (cache->node_first[0] == 0);
+
+   roadmap_square_set_current (prev_square);
 
    return cache;
 }
@@ -265,14 +326,11 @@ int get_connected_segments (int square,
                             int node_id, struct successor *successors,
                             int max, int use_restrictions, int use_directions) {
 
-   static int res_bits[8];
    int i;
-
+   int first;
+   int last;
    int count = 0;
-   //int index = 0;
    int res_index = 0;
-   int line;
-   int line_reversed;
    int seg_res_bits = 0;
    struct SquareGraphItem *cache;
 
@@ -282,72 +340,49 @@ int get_connected_segments (int square,
 		return 1;
 	} 
 	
-   /* Init turn restrictions bits */
-   if (!res_bits[0]) for (i=0; i<8; i++) res_bits[i] = 1<<i;
-
-   roadmap_square_set_current (square);
-
    cache = get_square_graph (square);
 
    node_id &= 0xffff;
 
-   i = cache->nodes_index[node_id];
-   if (i <= 0) {
+   first = cache->node_first[node_id];
+   last = cache->node_first[node_id + 1];
+   if (first == last) {
    	roadmap_log (ROADMAP_ERROR, "cannot find data for node %d square %d", node_id, square);
    }
-   assert (i > 0);
+   assert (first < last);
 
    if (use_restrictions) {
-      if (is_seg_reversed) {
-         seg_res_bits = roadmap_line_route_get_restrictions (seg_line_id, 1);
-      } else {
-         seg_res_bits = roadmap_line_route_get_restrictions (seg_line_id, 0);
+      for (i = first; i < last; i++) {
+         if (cache->edges[i].line == (seg_line_id | (is_seg_reversed ? 0 : REVERSED))) {
+            seg_res_bits = cache->edges[i].restrictions;
+            break;
+         }
       }
    }
 
-   while (i && count < max) {
-
-      int to_point_id = -1;
-      int line_direction_allowed;
+   for (i = first; i < last && count < max; i++) {
 
-      line = cache->lines[i - 1];
-      i = cache->lines_index[i - 1];
-      line_reversed = line & REVERSED;
-      if (line_reversed) line = line & ~REVERSED;
+      const SquareGraphEdge *edge = cache->edges + i;
+      int line = edge->line & ~REVERSED;
 
       if (line == seg_line_id) {
          
-         if (roadmap_line_route_get_direction
-               (seg_line_id, ROUTE_CAR_ALLOWED) == ROUTE_DIRECTION_ANY) {
+         if (edge->flags & GRAPH_EDGE_TWO_WAY) {
             res_index++;
          }
          continue;
       }
 
-		if (use_directions) {
-	      if (!line_reversed) {
-	         roadmap_line_to_point (line, &to_point_id);
-	         line_direction_allowed =
-	            roadmap_line_route_get_direction (line, ROUTE_CAR_ALLOWED) &
-	                  ROUTE_DIRECTION_WITH_LINE;
-	      } else {
-	         roadmap_line_from_point (line, &to_point_id);
-	         line_direction_allowed =
-	            roadmap_line_route_get_direction (line, ROUTE_CAR_ALLOWED) &
-	                  ROUTE_DIRECTION_AGAINST_LINE;
-	      }
-	
-	      if (!line_direction_allowed) {
-	         continue;
-	      }
+		if (use_directions && !(edge->flags & GRAPH_EDGE_ALLOWED)) {
+			continue;
 		}
 
       if (!use_restrictions || (res_index >= 8) ||
-          !(seg_res_bits & res_bits[res_index])) {
+          !(seg_res_bits & (1 << res_index))) {
           	  successors[count].square_id = square;
               successors[count].line_id = line;
-              successors[count].reversed = (line_reversed != 0);
-              successors[count].to_point = to_point_id;
+              successors[count].reversed = ((edge->line & REVERSED) != 0);
+              successors[count].to_point = edge->to_point;
               count++;
       }
       res_index++;
@@ -357,61 +392,153 @@ int get_connected_segments (int square,
 }
 
 
+int get_connected_predecessors (int square,
+										  int seg_line_id, int is_seg_reversed,
+										  struct successor *predecessors,
+										  int max, int use_restrictions, int use_directions) {
+
+	struct successor candidates[MAX_PREDECESSOR_CANDIDATES];
+	struct successor successors[MAX_PREDECESSOR_CANDIDATES];
+	struct SquareGraphItem *cache;
+	int num_candidates = 0;
+	int count = 0;
+	int node_id;
+	int i;
+	int j;
+
+	if (max <= 0) return 0;
+
+	/* A line split on a tile border is only entered from its extension.
+	 * Extending the opposite direction finds it, and its to_point is
+	 * where the predecessor starts.
+	 */
+	if (find_segment_extension (square, seg_line_id, !is_seg_reversed, predecessors)) {
+
+		predecessors->reversed = !predecessors->reversed;
+		return 1;
+	}
+
+	roadmap_square_set_current (square);
+
+	if (is_seg_reversed) {
+		roadmap_line_to_point (seg_line_id, &node_id);
+	} else {
+		roadmap_line_from_point (seg_line_id, &node_id);
+	}
+
+	cache = get_square_graph (square);
+
+	/* The graph lists the lines leaving each node; every one of them,
+	 * travelled the other way, may enter the segment.
+	 */
+	for (i = cache->node_first[node_id & 0xffff];
+		  i < cache->node_first[(node_id & 0xffff) + 1] &&
+		  num_candidates < MAX_PREDECESSOR_CANDIDATES; i++) {
+
+		const SquareGraphEdge *edge = cache->edges + i;
+		struct successor *candidate = candidates + num_candidates;
+
+		if ((edge->line & ~REVERSED) == seg_line_id) continue;
+
+		/* entering the node along the line means travelling it the other way */
+		candidate->square_id = square;
+		candidate->line_id = edge->line & ~REVERSED;
+		candidate->reversed = !(edge->line & REVERSED);
+		candidate->to_point = edge->to_point;
+
+		if (use_directions &&
+			 !(roadmap_line_route_get_direction (candidate->line_id, ROUTE_CAR_ALLOWED) &
+			   (candidate->reversed ? ROUTE_DIRECTION_AGAINST_LINE : ROUTE_DIRECTION_WITH_LINE))) {
+			continue;
+		}
+
+		num_candidates++;
+	}
+
+	/* Only keep candidates from which the segment is a legal successor,
+	 * so that restrictions are applied exactly as in the forward search.
+	 */
+	for (i = 0; i < num_candidates && count < max; i++) {
+
+		int num_successors =
+			get_connected_segments (square, candidates[i].line_id, candidates[i].reversed,
+											node_id, successors, MAX_PREDECESSOR_CANDIDATES,
+											use_restrictions, use_directions);
+
+		for (j = 0; j < num_successors; j++) {
+			if (successors[j].square_id == square &&
+				 successors[j].line_id == seg_line_id &&
+				 successors[j].reversed == (is_seg_reversed != 0)) {
+
+				predecessors[count++] = candidates[i];
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
+
 int navigate_graph_get_line (int node, int line_no) {
 
    int square = roadmap_square_active (); //roadmap_point_square (node);
    struct SquareGraphItem *cache = get_square_graph (square);
    int i;
-   int skip;
 
    node &= 0xffff;
 
-   i = cache->nodes_index[node];
-   assert (i > 0);
-   i--;
-
-   skip = line_no;
-   while (skip) {
-      i = cache->lines_index[i];
-	   assert (i > 0);
-	   i--;
-      skip--;
-   }
+   i = cache->node_first[node] + line_no;
+   assert (i < cache->node_first[node + 1]);
 
-   return cache->lines[i];
+   return cache->edges[i].line;
 }
 
 
 static void navigate_graph_clear_all (void) {
-	
-	int slot;
-	for (slot = SquareCacheSize - 1; slot >= 0; slot--) {
-		
-		free_cache_slot (slot);
+
+	while (SquareGraphLru.lru_next != &SquareGraphLru) {
+		free_cache_item (SquareGraphLru.lru_next);
 	}
-	SquareCacheSize = 0;	
 }
 
 void navigate_graph_clear (int square) {
 
-	int slot;
-	
+	struct SquareGraphItem *cache;
+
+	/* the map data changed, results computed from it are stale */
+	SquareGraphGeneration++;
+
 	if (square == -1) {
 		navigate_graph_clear_all ();
 		return;
 	}
-	
-	for (slot = SquareCacheSize - 1; slot >= 0 && SquareGraphCache[slot]->square_id != square; slot--)
-		;
-	
-	if (slot >= 0) {
-		
-		SquareCacheSize--;
-		free_cache_slot (slot);
-		
-		while (slot < SquareCacheSize) {
-			SquareGraphCache[slot] = SquareGraphCache[slot + 1];
-			slot++;	
+
+	for (cache = SquareGraphHash[graph_hash (square)]; cache; cache = cache->hash_next) {
+		if (cache->square_id == square) {
+			free_cache_item (cache);
+			return;
 		}
-	}	
+	}
+}
+
+
+void navigate_graph_get_stats (NavigateGraphStats *stats) {
+
+	*stats = SquareGraphStats;
+	stats->mem_used = cache_total_mem;
+	stats->mem_budget = roadmap_config_get_integer (&GraphCacheSizeCfg);
+}
+
+
+int navigate_graph_generation (void) {
+
+	return SquareGraphGeneration;
+}
+
+
+void navigate_graph_initialize (void) {
+
+	roadmap_config_declare
+		("preferences", &GraphCacheSizeCfg, DEFAULT_MEM_CACHE, NULL);
 }
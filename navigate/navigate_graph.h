@@ -39,8 +39,31 @@ int get_connected_segments (int square,
                             int node_id, struct successor *successors,
                             int max, int use_restrictions, int use_directions);
 
+/* Lists the segments from which the given segment may be entered.
+ * For predecessors, to_point holds the node the predecessor starts from.
+ */
+int get_connected_predecessors (int square,
+										  int seg_line_id, int is_seg_reversed,
+										  struct successor *predecessors,
+										  int max, int use_restrictions, int use_directions);
+
+typedef struct {
+	int hits;
+	int misses;
+	int evictions;
+	int squares;
+	int mem_used;
+	int mem_budget;
+} NavigateGraphStats;
+
 int navigate_graph_get_line (int node, int line_no);
 void navigate_graph_clear (int square);
 
+void navigate_graph_get_stats (NavigateGraphStats *stats);
+
+/* Changes whenever squares are cleared because their map data changed */
+int  navigate_graph_generation (void);
+void navigate_graph_initialize (void);
+
 #endif /* _NAVIGATE_GRAPH_H_ */
 
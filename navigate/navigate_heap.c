@@ -0,0 +1,170 @@
+/* navigate_heap.c - intrusive priority queue for route calculation
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009, Waze Ltd
+ *
+ *   This file is part of RoadMap.
+ *
+ *   RoadMap is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   RoadMap is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with RoadMap; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * SYNOPSYS:
+ *
+ *   See navigate_heap.h
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "roadmap.h"
+
+#include "navigate_heap.h"
+
+#define HEAP_ARITY 4
+#define HEAP_INITIAL_SIZE 1024
+
+#define HEAP_PARENT(i) (((i) - 1) / HEAP_ARITY)
+#define HEAP_FIRST_CHILD(i) ((i) * HEAP_ARITY + 1)
+
+
+static void sift_up (NavigateHeap *heap, int pos) {
+
+   NavigateHeapNode *node = heap->nodes[pos];
+
+   while (pos > 0) {
+      int parent = HEAP_PARENT (pos);
+      NavigateHeapNode *p = heap->nodes[parent];
+
+      if (p->key <= node->key) break;
+
+      heap->nodes[pos] = p;
+      p->index = pos;
+      pos = parent;
+   }
+
+   heap->nodes[pos] = node;
+   node->index = pos;
+}
+
+
+static void sift_down (NavigateHeap *heap, int pos) {
+
+   NavigateHeapNode *node = heap->nodes[pos];
+
+   while (1) {
+      int first = HEAP_FIRST_CHILD (pos);
+      int last;
+      int best;
+      int i;
+
+      if (first >= heap->count) break;
+
+      last = first + HEAP_ARITY;
+      if (last > heap->count) last = heap->count;
+
+      best = first;
+      for (i = first + 1; i < last; i++) {
+         if (heap->nodes[i]->key < heap->nodes[best]->key) best = i;
+      }
+
+      if (heap->nodes[best]->key >= node->key) break;
+
+      heap->nodes[pos] = heap->nodes[best];
+      heap->nodes[pos]->index = pos;
+      pos = best;
+   }
+
+   heap->nodes[pos] = node;
+   node->index = pos;
+}
+
+
+void navigate_heap_init (NavigateHeap *heap) {
+
+   heap->nodes = NULL;
+   heap->count = 0;
+   heap->size = 0;
+}
+
+
+void navigate_heap_reset (NavigateHeap *heap) {
+
+   int i;
+
+   for (i = 0; i < heap->count; i++) {
+      heap->nodes[i]->index = NAVIGATE_HEAP_NONE;
+   }
+   heap->count = 0;
+}
+
+
+void navigate_heap_free (NavigateHeap *heap) {
+
+   navigate_heap_reset (heap);
+   free (heap->nodes);
+   navigate_heap_init (heap);
+}
+
+
+int navigate_heap_insert (NavigateHeap *heap, NavigateHeapNode *node, int key) {
+
+   if (heap->count == heap->size) {
+      int size = heap->size ? heap->size * 2 : HEAP_INITIAL_SIZE;
+      NavigateHeapNode **nodes =
+         (NavigateHeapNode **)realloc (heap->nodes, size * sizeof (NavigateHeapNode *));
+
+      if (!nodes) {
+         roadmap_log (ROADMAP_ERROR, "Can't grow navigate heap to %d entries", size);
+         return -1;
+      }
+
+      heap->nodes = nodes;
+      heap->size = size;
+   }
+
+   node->key = key;
+   heap->nodes[heap->count] = node;
+   sift_up (heap, heap->count++);
+
+   return 0;
+}
+
+
+void navigate_heap_decrease_key (NavigateHeap *heap, NavigateHeapNode *node, int key) {
+
+   assert (navigate_heap_contains (node));
+   assert (key <= node->key);
+
+   node->key = key;
+   sift_up (heap, node->index);
+}
+
+
+NavigateHeapNode *navigate_heap_extract_min (NavigateHeap *heap) {
+
+   NavigateHeapNode *min;
+
+   if (!heap->count) return NULL;
+
+   min = heap->nodes[0];
+   min->index = NAVIGATE_HEAP_NONE;
+
+   if (--heap->count > 0) {
+      heap->nodes[0] = heap->nodes[heap->count];
+      sift_down (heap, 0);
+   }
+
+   return min;
+}
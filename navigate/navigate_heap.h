@@ -0,0 +1,59 @@
+/* navigate_heap.h - intrusive priority queue for route calculation
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009, Waze Ltd
+ *
+ *   This file is part of RoadMap.
+ *
+ *   RoadMap is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   RoadMap is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with RoadMap; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * DESCRIPTION:
+ *
+ *   An array based 4-ary min heap. The heap does not allocate anything per
+ *   element: callers embed a NavigateHeapNode in their own items, and the
+ *   heap keeps the node's position up to date so that the key can later be
+ *   decreased in place. The array itself is kept between queries.
+ */
+
+#ifndef _NAVIGATE_HEAP_H_
+#define _NAVIGATE_HEAP_H_
+
+#define NAVIGATE_HEAP_NONE (-1)
+
+typedef struct {
+   int key;
+   int index; /* position in the heap, NAVIGATE_HEAP_NONE if not queued */
+} NavigateHeapNode;
+
+typedef struct {
+   NavigateHeapNode **nodes;
+   int count;
+   int size;
+} NavigateHeap;
+
+void navigate_heap_init   (NavigateHeap *heap);
+void navigate_heap_reset  (NavigateHeap *heap);
+void navigate_heap_free   (NavigateHeap *heap);
+
+int  navigate_heap_insert (NavigateHeap *heap, NavigateHeapNode *node, int key);
+void navigate_heap_decrease_key (NavigateHeap *heap, NavigateHeapNode *node, int key);
+NavigateHeapNode *navigate_heap_extract_min (NavigateHeap *heap);
+
+#define navigate_heap_is_empty(heap) ((heap)->count == 0)
+#define navigate_heap_min_key(heap)  ((heap)->nodes[0]->key)
+#define navigate_heap_contains(node) ((node)->index != NAVIGATE_HEAP_NONE)
+
+#endif /* _NAVIGATE_HEAP_H_ */
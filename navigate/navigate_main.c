@@ -94,6 +94,7 @@
 #define ROUTE_PEN_WIDTH 5
 //#define TEST_ROUTE_CALC 1
 #define NAVIGATE_PREFETCH_DISTANCE 10000
+#define NAVIGATE_PREFETCH_SECONDS  300
 
 #define MAX_MINUTES_TO_RESUME_NAV   120
 
@@ -1517,19 +1518,30 @@ void navigate_main_stop_navigation_menu(void)
 static void navigate_request_segments (void) {
 
 	int distance = 0;
+	int horizon = NAVIGATE_PREFETCH_DISTANCE;
 	int i;
    int num_segments = navigate_num_segments ();
+   RoadMapGpsPosition pos;
 
 	if (NavigateCurrentRequestSegment >= num_segments) return;
 
+	/* at highway speed, look further than the fixed distance */
+	if (roadmap_navigate_get_current (&pos, NULL, NULL) != -1) {
+		int ahead = roadmap_math_to_current_unit (pos.speed * 1852 / 36 * NAVIGATE_PREFETCH_SECONDS, "cm");
+		if (ahead > horizon) horizon = ahead;
+	}
+
 	for (i = NavigateCurrentSegment; i < num_segments; i++) {
 		NavigateSegment *segment = navigate_segment (i);
 		if (i > NavigateCurrentRequestSegment) {
-   		roadmap_tile_request (segment->square, ROADMAP_TILE_STATUS_PRIORITY_PREFETCH, 1, NULL);
+			if (!roadmap_tile_prefetch (segment->square, ROADMAP_TILE_STATUS_PRIORITY_PREFETCH, 1)) {
+				/* over budget, continue from here on the next update */
+				break;
+			}
 			NavigateCurrentRequestSegment = i;
 		}
 		distance += segment->distance;
-		if (distance > NAVIGATE_PREFETCH_DISTANCE) break;
+		if (distance > horizon) break;
 	}
 }
 
@@ -1952,6 +1964,7 @@ void navigate_main_initialize (void) {
    navigate_main_init_pens ();
 
    navigate_cost_initialize ();
+   navigate_route_initialize ();
 
    NavigatePluginID = navigate_plugin_register ();
    navigate_traffic_initialize ();
@@ -40,6 +40,21 @@
 #define CHANGED_DESTINATION		128 
 #define GRAPH_IGNORE_TURNS 		64
 
+typedef struct {
+	NavigateSegment	*segments;	/* allocated, owned by the caller */
+	int					num_segments;
+	int					cost;
+	int					flags;
+} NavigateRouteAlternative;
+
+/* Counters of the last navigate_route_get_segments call */
+typedef struct {
+	int heap_gets;		/* segments settled by the searches */
+	int nodes;			/* search items in use at the end */
+	int memory;			/* bytes held by the search state */
+} NavigateRouteStats;
+
+void navigate_route_initialize (void);
 int navigate_route_reload_data (void);
 int navigate_route_load_data   (void);
 
@@ -54,5 +69,22 @@ int navigate_route_get_segments (PluginLine *from_line,
                                  const NavigateSegment *prev_segments,
                                  int num_prev_segments);
 
+/* Computes up to max_routes different routes locally, the best first.
+ * Routes after the first are only searched within time_budget (ms).
+ * Returns the number of routes found, or -1 on error.
+ */
+int navigate_route_get_alternatives (PluginLine *from_line,
+                                     int from_point,
+                                     PluginLine *to_line,
+                                     int *to_point,
+                                     NavigateRouteAlternative *routes,
+                                     int max_routes,
+                                     int time_budget);
+
+void navigate_route_get_stats (NavigateRouteStats *stats);
+
+/* When set, route calculations do not update the progress dialog */
+void navigate_route_set_quiet (int quiet);
+
 #endif /* _NAVIGATE_ROUTE_H_ */
 
@@ -44,6 +44,8 @@
 #include "roadmap_line_route.h"
 #include "roadmap_hash.h"
 #include "roadmap_navigate.h"
+#include "roadmap_config.h"
+#include "roadmap_time.h"
 
 #ifdef SSD
 #include "ssd/ssd_dialog.h"
@@ -56,7 +58,8 @@
 #include "navigate_graph.h"
 #include "navigate_cost.h"
 
-#include "fib-1.1/fib.h"
+#include "navigate_heap.h"
+#include "navigate_shortcut.h"
 #include "navigate_route.h"
 
 #define LOCKED_ROUTE (1 << 7)
@@ -72,22 +75,104 @@
 #define COST_FACTOR_UPDATE 0.98
 
 #define HASH_BLOCK_SIZE 4096
-#define HASH_MAX_BLOCKS 40
-#define MAX_ASTAR_LINES (HASH_BLOCK_SIZE * HASH_MAX_BLOCKS)
 static int RouteNumNodes = 0;
+static int RouteMaxNodes = 0;
+
+#ifdef J2ME
+#define DEFAULT_SEARCH_MEMORY "800000"
+#else
+#define DEFAULT_SEARCH_MEMORY "12000000"
+#endif
 
 #define MAX_REROUTE_ATTEMPS	100
 
-static RoadMapHash *RouteGraph;
+/* A reroute joining the kept backward search tree gives up after this
+ * many heap gets, and the tree is not used once it is this old (seconds).
+ */
+#define MAX_TREE_REROUTE_ATTEMPTS	20000
+#define MAX_TREE_AGE					600
+
+#define NO_ROUTE_COST 0x7fffffff
+
+/* Local alternatives (penalty method): every segment of the routes kept
+ * so far costs ALT_PENALTY_PERCENT of its cost in the next search. A
+ * new route is kept if it shares at most ALT_MAX_SHARED_PERCENT of its
+ * length with the kept routes, and costs at most ALT_MAX_STRETCH_PERCENT
+ * of the best one; otherwise the penalty grows by ALT_PENALTY_STEP.
+ */
+#define ALT_PENALTY_PERCENT     140
+#define ALT_PENALTY_STEP        40
+#define ALT_MAX_SHARED_PERCENT  70
+#define ALT_MAX_STRETCH_PERCENT 140
+#define ALT_MAX_ATTEMPTS        6
+
+/* searches check their deadline every ROUTE_DEADLINE_STEP heap gets */
+#define ROUTE_DEADLINE_STEP     256
+
+static RoadMapConfigDescriptor BidirectionalCfg =
+                  ROADMAP_CONFIG_ITEM("Routing", "Bidirectional search");
+
+static RoadMapConfigDescriptor SearchMemoryCfg =
+                  ROADMAP_CONFIG_ITEM("Routing", "Search memory");
+
+static RoadMapHashMap *RouteGraph;
+static RoadMapHashMap *RouteGraphBack;
 static RoadMapPosition GoalPos;
+static RoadMapPosition StartPos;
+
+static NavigateHeap ForwardQueue;
+static NavigateHeap BackwardQueue;
+
+static uint32_t RouteDeadline = 0;
 
+/* The backward search tree of the last full route (distances to its
+ * goal) is kept between queries, so that a reroute only searches
+ * forward until it joins it. It stays in RouteGraphBack and its items
+ * are the first KeptNumNodes of NavNode.
+ */
+static NavigateRouteStats RouteStats;
+static int RouteQuiet = 0;
+
+static int KeptTree = 0;
+static int KeptNumNodes;
+static int KeptGoalSquare;
+static int KeptGoalLine;
+static int KeptProfile;
+static int KeptGeneration;
+static time_t KeptTime;
+static int LastSearchBidirectional;
+
+static int AltPenaltyActive = 0;
+static int AltPenaltyPercent;
+static RoadMapHash *AltPenaltyHash = NULL;
+static int *AltPenaltySquare;
+static int *AltPenaltyLine;
+static int AltPenaltyCount;
+static int AltPenaltySize;
+static NavigateCostFn AltBaseCost;
+
+/* set when the item was reached from prev_* through a tile shortcut */
+#define NAV_ITEM_SHORTCUT 1
+
+/* In the backward search tree the prev_* fields point to the next
+ * segment towards the goal.
+ */
 typedef struct {
+	NavigateHeapNode	heap;
+	int					cost;
 	int					line_square;
 	int					prev_square;
 	unsigned short		line_id;
 	unsigned short		prev_id;
+	int					flags;
 } NavItem;
-static NavItem *NavNode[HASH_MAX_BLOCKS];
+
+/* The search items are allocated from blocks of HASH_BLOCK_SIZE items.
+ * The blocks and the search hashes are kept between queries, which only
+ * reset them; the total is bounded by the "Search memory" budget.
+ */
+static NavItem **NavNode = NULL;
+static int NavNodeBlocks = 0;
 
 typedef struct {
 	int square;
@@ -109,6 +194,81 @@ typedef struct {
 
 static NavigateSegment NavigateSegments[MAX_NAV_SEGEMENTS];
 
+void navigate_route_initialize (void) {
+
+   roadmap_config_declare_enumeration
+      ("preferences", &BidirectionalCfg, NULL, "yes", "no", NULL);
+
+   roadmap_config_declare
+      ("preferences", &SearchMemoryCfg, DEFAULT_SEARCH_MEMORY, NULL);
+
+   navigate_heap_init (&ForwardQueue);
+   navigate_heap_init (&BackwardQueue);
+
+   navigate_graph_initialize ();
+   navigate_shortcut_initialize ();
+}
+
+static int alt_is_penalized (int square, int line) {
+
+	int i;
+
+	for (i = roadmap_hash_get_first (AltPenaltyHash, (square << 16) + line);
+		  i >= 0;
+		  i = roadmap_hash_get_next (AltPenaltyHash, i)) {
+
+		if (AltPenaltySquare[i] == square && AltPenaltyLine[i] == line) return 1;
+	}
+
+	return 0;
+}
+
+
+static void alt_penalize (int square, int line) {
+
+	if (AltPenaltyCount >= AltPenaltySize ||
+		 alt_is_penalized (square, line)) {
+		return;
+	}
+
+	AltPenaltySquare[AltPenaltyCount] = square;
+	AltPenaltyLine[AltPenaltyCount] = line;
+	roadmap_hash_add (AltPenaltyHash, (square << 16) + line, AltPenaltyCount);
+	AltPenaltyCount++;
+}
+
+
+static int cost_alternative (int line_id, int is_reversed, int cur_cost,
+									  int prev_line_id, int is_prev_reversed,
+									  int node_id) {
+
+	int cost = AltBaseCost (line_id, is_reversed, cur_cost,
+									prev_line_id, is_prev_reversed, node_id);
+
+	if (cost > 0 && alt_is_penalized (roadmap_square_active (), line_id)) {
+		cost = cost * AltPenaltyPercent / 100;
+	}
+
+	return cost;
+}
+
+
+static NavigateCostFn route_cost_fn (void) {
+
+	if (AltPenaltyActive) return &cost_alternative;
+
+	return navigate_cost_get ();
+}
+
+
+static int route_deadline_passed (int num_heap_gets) {
+
+	return RouteDeadline &&
+			 !(num_heap_gets % ROUTE_DEADLINE_STEP) &&
+			 roadmap_time_get_millis () > RouteDeadline;
+}
+
+
 int navigate_route_reload_data (void) {
 
    return 0;
@@ -119,28 +279,52 @@ int navigate_route_load_data (void) {
 }
 
 
-static int hash_key (int square, int line, int reversed) {
+/* The items are indexed by their square and this key */
+static int line_key (int line, int reversed) {
+
+	return line * 2 + (reversed != 0);
+}
+
+
+static int add_node_block (void) {
 
-	return (square << 16) + line * 2 + (reversed != 0);
+	NavItem **blocks = (NavItem **)realloc (NavNode, (NavNodeBlocks + 1) * sizeof (NavItem *));
+
+	if (!blocks) return -1;
+	NavNode = blocks;
+
+	NavNode[NavNodeBlocks] = (NavItem *)malloc (HASH_BLOCK_SIZE * sizeof (NavItem));
+	if (!NavNode[NavNodeBlocks]) return -1;
+
+	NavNodeBlocks++;
+	return 0;
 }
 
 
-static NavItem *make_path (int square_id, int line_id, int line_reversed,
+static NavItem *make_path (RoadMapHashMap *graph,
+									int square_id, int line_id, int line_reversed,
 							  		int prev_square, int prev_line, int prev_reversed) {
 
    NavItem *item;
 
-	if (RouteNumNodes >= MAX_ASTAR_LINES) {
-		roadmap_log (ROADMAP_ERROR, "Too many nodes in route calculation");
+	if (RouteNumNodes >= RouteMaxNodes) {
+		roadmap_log (ROADMAP_ERROR, "Route calculation exceeds its memory budget (%d nodes)",
+						 RouteNumNodes);
 		return NULL;
 	}
 
 	if (RouteNumNodes % HASH_BLOCK_SIZE == 0) {
-		if (RouteNumNodes) roadmap_hash_resize (RouteGraph, RouteNumNodes + HASH_BLOCK_SIZE);
-		NavNode[RouteNumNodes / HASH_BLOCK_SIZE] = (NavItem *)malloc (HASH_BLOCK_SIZE * sizeof (NavItem));
+		if (RouteNumNodes / HASH_BLOCK_SIZE >= NavNodeBlocks &&
+			 add_node_block () < 0) {
+			roadmap_log (ROADMAP_ERROR, "No memory for route calculation");
+			return NULL;
+		}
 	}
 
 	item = NavNode[RouteNumNodes / HASH_BLOCK_SIZE] + (RouteNumNodes % HASH_BLOCK_SIZE);
+	item->heap.index = NAVIGATE_HEAP_NONE;
+	item->cost = 0;
+	item->flags = 0;
 	item->prev_square = prev_square | (prev_reversed ? REVERSED : 0);
 	item->prev_id = prev_line;
 	item->line_square = square_id | (line_reversed ? REVERSED : 0);
@@ -150,33 +334,26 @@ static NavItem *make_path (int square_id, int line_id, int line_reversed,
 	//			item->prev_square & ~REVERSED, item->prev_id, item->prev_square & REVERSED ? "'" : "",
 	//			item->line_square & ~REVERSED, item->line_id, item->line_square & REVERSED ? "'" : "");
 
-	roadmap_hash_add (RouteGraph, hash_key (square_id, line_id, line_reversed), RouteNumNodes);
+	roadmap_hash_map_set (graph, square_id, line_key (line_id, line_reversed), RouteNumNodes);
 	RouteNumNodes++;
 
 	return item;
 }
 
 
-static NavItem *find_prev (int square_id, int line_id, int line_reversed) {
+static NavItem *find_item (RoadMapHashMap *graph, int square_id, int line_id, int line_reversed) {
 
-	int key = hash_key (square_id, line_id, line_reversed);
-	int index = roadmap_hash_get_first (RouteGraph, key);
+	int index = roadmap_hash_map_get (graph, square_id, line_key (line_id, line_reversed));
 
-	if (line_reversed) {
-		square_id = square_id | REVERSED;
-	}
+	if (index < 0) return NULL;
 
-	while (index >= 0) {
-		NavItem *item = NavNode[index / HASH_BLOCK_SIZE] + (index % HASH_BLOCK_SIZE);
-		if (item->line_square == square_id &&
-			 item->line_id == line_id) {
+	return NavNode[index / HASH_BLOCK_SIZE] + (index % HASH_BLOCK_SIZE);
+}
 
-			return item;
-		}
-		index = roadmap_hash_get_next (RouteGraph, index);
-	}
 
-	return NULL;
+static NavItem *find_prev (int square_id, int line_id, int line_reversed) {
+
+	return find_item (RouteGraph, square_id, line_id, line_reversed);
 }
 
 
@@ -192,19 +369,38 @@ static void get_to_node (int square, int line_id, int reversed, int *node, RoadM
 }
 
 
+static void get_from_node (int square, int line_id, int reversed, int *node) {
 
-struct fibheap * make_queue (int square, int line_id, int reversed) {
+	roadmap_square_set_current (square);
+	if (reversed) {
+		roadmap_line_to_point (line_id, node);
+	} else {
+		roadmap_line_from_point (line_id, node);
+	}
+}
+
+
+static int estimate_cost (int distance, int navigate_type) {
+
+	if (navigate_type == COST_FASTEST) return distance / HU_SPEED;
+	return distance;
+}
+
+
+static NavItem *make_queue (NavigateHeap *queue, RoadMapHashMap *graph,
+									 int square, int line_id, int reversed) {
 
-   struct fibheap *fh;
-   NavItem *item = make_path (square, line_id, reversed, square, line_id, reversed);
-   fh = fh_makekeyheap();
+   NavItem *item = make_path (graph, square, line_id, reversed, square, line_id, reversed);
 
-   fh_insertkey (fh, 0, item);
+   if (item) navigate_heap_insert (queue, &item->heap, 0);
 
-   return fh;
+   return item;
 }
 
 static void update_progress (int progress) {
+
+   if (RouteQuiet) return;
+
    progress = progress * 9 / 10;
 
 #ifdef SSD
@@ -227,14 +423,30 @@ static int prepare_prev_list (const NavigateSegment *prev_route, int num_prev) {
 
    int i;
 
-   RouteGraph = roadmap_hash_new ("astar", HASH_BLOCK_SIZE);
-   RouteNumNodes = 0;
+   /* each of the two search trees maps the items with a map kept between
+    * 3/8 and 3/4 full, so count two entries per item in each
+    */
+   RouteMaxNodes = roadmap_config_get_integer (&SearchMemoryCfg) /
+   					 (sizeof (NavItem) + 2 * 2 * sizeof (RoadMapHashMapEntry));
+
+   if (!RouteGraph) {
+   	RouteGraph = roadmap_hash_map_new ("astar", HASH_BLOCK_SIZE);
+   	RouteGraphBack = roadmap_hash_map_new ("astar_back", HASH_BLOCK_SIZE);
+   }
+
+   /* with a kept tree, new items follow it in the node blocks */
+   roadmap_hash_map_reset (RouteGraph);
+   if (!KeptTree) {
+   	roadmap_hash_map_reset (RouteGraphBack);
+   	RouteNumNodes = 0;
+   }
 
    for (i = 0; i < num_prev; i++) {
    	if (prev_route[i].context != SEG_ROUNDABOUT &&
    		 (i == 0 || prev_route[i - 1].context != SEG_ROUNDABOUT)) {
    		// making sure roundabout is not split between old and new route segments
-	   	make_path (prev_route[i].square,
+	   	make_path (RouteGraph,
+	   				  prev_route[i].square,
 	   				  prev_route[i].line,
 	   				  prev_route[i].line_direction != ROUTE_DIRECTION_WITH_LINE,
 	   				  -1,
@@ -248,18 +460,509 @@ static int prepare_prev_list (const NavigateSegment *prev_route, int num_prev) {
 
 static void free_prev_list(void) {
 
-   int i;
+   navigate_heap_reset (&ForwardQueue);
+   navigate_heap_reset (&BackwardQueue);
 
-   if (RouteGraph) {
-	   roadmap_hash_free (RouteGraph);
-	   RouteGraph = NULL;
-   }
-   if (RouteNumNodes) {
-   	for (i = (RouteNumNodes - 1) / HASH_BLOCK_SIZE; i >= 0; i--) {
-   		free (NavNode[i]);
-   	}
-   	RouteNumNodes = 0;
-   }
+   /* the items added after the kept tree are reused by the next query */
+   RouteNumNodes = KeptNumNodes;
+}
+
+
+/* Keeps the backward tree of the search that just completed. Called
+ * before free_prev_list, so that its items are not reused.
+ */
+static void keep_search_tree (const PluginLine *goal) {
+
+	KeptTree = 1;
+	KeptNumNodes = RouteNumNodes;
+	KeptGoalSquare = goal->square;
+	KeptGoalLine = goal->line_id;
+	KeptProfile = navigate_cost_profile ();
+	KeptGeneration = navigate_graph_generation ();
+	KeptTime = time (NULL);
+}
+
+
+static void drop_search_tree (void) {
+
+	KeptTree = 0;
+	KeptNumNodes = 0;
+	RouteNumNodes = 0;
+}
+
+
+static int can_use_search_tree (const PluginLine *goal, int flags) {
+
+	return KeptTree &&
+			 (flags & RECALC_ROUTE) &&
+			 !(flags & USE_LAST_RESULTS) &&
+			 !AltPenaltyActive &&
+			 goal->square == KeptGoalSquare &&
+			 goal->line_id == KeptGoalLine &&
+			 navigate_cost_profile () == KeptProfile &&
+			 navigate_graph_generation () == KeptGeneration &&
+			 time (NULL) < KeptTime + MAX_TREE_AGE;
+}
+
+
+typedef struct {
+	NavigateHeap			*queue;
+	RoadMapHashMap		*graph;
+	RoadMapHashMap		*other_graph;
+	const RoadMapPosition *target;
+	int					backward;
+} SearchDirection;
+
+typedef struct {
+	int cost;
+	int square;
+	int line;
+	int reversed;
+} MeetingPoint;
+
+
+/* Settles the cheapest segment of one search direction and relaxes its
+ * neighbours. Returns -1 when running out of memory.
+ */
+static int expand_direction (SearchDirection *dir, NavigateCostFn cost_fn, int navigate_type,
+									  MeetingPoint *meet, int *distance_to_goal) {
+
+	struct successor neighbours[MAX_SUCCESSORS];
+	NavItem *item = (NavItem *)navigate_heap_extract_min (dir->queue);
+	int item_square = item->line_square & ~REVERSED;
+	int item_line = item->line_id;
+	int item_reversed = (item->line_square & REVERSED) != 0;
+	int node;
+	int count;
+	int i;
+	RoadMapPosition position;
+
+	RouteStats.heap_gets++;
+
+	if (dir->backward) {
+		get_from_node (item_square, item_line, item_reversed, &node);
+		count = get_connected_predecessors (item_square, item_line, item_reversed,
+														neighbours, MAX_SUCCESSORS, 1, 1);
+	} else {
+		get_to_node (item_square, item_line, item_reversed, &node, &position);
+		count = get_connected_segments (item_square, item_line, item_reversed, node,
+												  neighbours, MAX_SUCCESSORS, 1, 1);
+	}
+
+	for (i = 0; i < count; i++) {
+
+		int square = neighbours[i].square_id;
+		int segment = neighbours[i].line_id;
+		int is_reversed = neighbours[i].reversed;
+		int junction = (square == item_square) ? node : -1;
+		int segment_cost;
+		int path_cost;
+		int total_cost;
+		int distance;
+		NavItem *next = find_item (dir->graph, square, segment, is_reversed);
+		NavItem *other;
+
+		if (next && !navigate_heap_contains (&next->heap)) continue;
+
+		if (dir->backward) {
+			/* the cost of a transition is charged to the segment entered */
+			roadmap_square_set_current (item_square);
+			segment_cost = cost_fn (item_line, item_reversed, 0,
+											segment, is_reversed, junction);
+		} else {
+			roadmap_square_set_current (square);
+			segment_cost = cost_fn (segment, is_reversed, item->cost,
+											item_line, item_reversed, junction);
+		}
+
+		if (segment_cost < 0) continue;
+
+		path_cost = item->cost + segment_cost;
+		if (next && path_cost >= next->cost) continue;
+
+		roadmap_square_set_current (square);
+		roadmap_point_position (neighbours[i].to_point, &position);
+		distance = roadmap_math_distance (&position, dir->target);
+
+		total_cost = path_cost + estimate_cost (distance, navigate_type) + 1;
+		if (total_cost < item->heap.key) total_cost = item->heap.key;
+
+		if (next) {
+			next->prev_square = item_square | (item_reversed ? REVERSED : 0);
+			next->prev_id = item_line;
+			next->cost = path_cost;
+			if (total_cost < next->heap.key) {
+				navigate_heap_decrease_key (dir->queue, &next->heap, total_cost);
+			}
+		} else {
+			next = make_path (dir->graph, square, segment, is_reversed,
+									item_square, item_line, item_reversed);
+			if (!next) return -1;
+
+			next->cost = path_cost;
+			if (navigate_heap_insert (dir->queue, &next->heap, total_cost) < 0) return -1;
+		}
+
+		if (!dir->backward && distance < *distance_to_goal) {
+			*distance_to_goal = distance;
+		}
+
+		other = find_item (dir->other_graph, square, segment, is_reversed);
+		if (other && path_cost + other->cost < meet->cost) {
+			meet->cost = path_cost + other->cost;
+			meet->square = square;
+			meet->line = segment;
+			meet->reversed = is_reversed;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Appends the backward search path, from the meeting point to the goal,
+ * to the forward search tree so that the route can be read from it.
+ */
+static int join_search_trees (const MeetingPoint *meet, int *last_is_reversed) {
+
+	int square = meet->square;
+	int line = meet->line;
+	int reversed = meet->reversed;
+	int steps;
+
+	for (steps = 0; steps < MAX_NAV_SEGEMENTS; steps++) {
+
+		NavItem *back = find_item (RouteGraphBack, square, line, reversed);
+		NavItem *next;
+		int next_square;
+		int next_line;
+		int next_reversed;
+
+		if (!back) return -1;
+
+		next_square = back->prev_square & ~REVERSED;
+		next_line = back->prev_id;
+		next_reversed = (back->prev_square & REVERSED) != 0;
+
+		if (next_square == square && next_line == line && next_reversed == reversed) {
+			*last_is_reversed = reversed ? REVERSED : 0;
+			return 0;
+		}
+
+		next = find_prev (next_square, next_line, next_reversed);
+		if (next) {
+			next->prev_square = square | (reversed ? REVERSED : 0);
+			next->prev_id = line;
+		} else if (!make_path (RouteGraph, next_square, next_line, next_reversed,
+									  square, line, reversed)) {
+			return -1;
+		}
+
+		square = next_square;
+		line = next_line;
+		reversed = next_reversed;
+	}
+
+	return -1;
+}
+
+
+static int astar_bidirectional (int start_square, int start_node, int start_segment, int start_reversed,
+										  PluginLine *goal, int *goal_node, int *route_total_cost, int flags,
+										  int *last_is_reversed)
+{
+	SearchDirection forward;
+	SearchDirection backward;
+	MeetingPoint meet;
+	NavItem *item;
+	NavigateCostFn cost_fn = route_cost_fn ();
+	int navigate_type = navigate_cost_type ();
+	int recalc = flags & RECALC_ROUTE;
+	int num_heap_gets = 0;
+	int goal_distance;
+	int distance_to_goal;
+	int cur_max_progress = 0;
+	int progress;
+	int i;
+
+	roadmap_square_set_current (goal->square);
+	roadmap_point_position (*goal_node, &GoalPos);
+	roadmap_square_set_current (start_square);
+	roadmap_point_position (start_node, &StartPos);
+	goal_distance = roadmap_math_distance (&StartPos, &GoalPos);
+	distance_to_goal = goal_distance;
+
+	forward.queue = &ForwardQueue;
+	forward.graph = RouteGraph;
+	forward.other_graph = RouteGraphBack;
+	forward.target = &GoalPos;
+	forward.backward = 0;
+
+	backward.queue = &BackwardQueue;
+	backward.graph = RouteGraphBack;
+	backward.other_graph = RouteGraph;
+	backward.target = &StartPos;
+	backward.backward = 1;
+
+	meet.cost = NO_ROUTE_COST;
+
+	navigate_heap_reset (&ForwardQueue);
+	navigate_heap_reset (&BackwardQueue);
+
+	if (!make_queue (&ForwardQueue, RouteGraph, start_square, start_segment, start_reversed)) {
+		return -1;
+	}
+
+	/* the goal line may be reached from either of its ends */
+	for (i = 0; i < 2; i++) {
+		if (!make_queue (&BackwardQueue, RouteGraphBack, goal->square, goal->line_id, i)) {
+			return -1;
+		}
+		if (goal->square == start_square &&
+			 goal->line_id == start_segment &&
+			 i == (start_reversed != 0)) {
+			meet.cost = 0;
+			meet.square = start_square;
+			meet.line = start_segment;
+			meet.reversed = i;
+		}
+	}
+
+	while (!navigate_heap_is_empty (&ForwardQueue) &&
+			 !navigate_heap_is_empty (&BackwardQueue)) {
+
+		int rc;
+
+		/* no unsettled segment on either side can improve on the best meeting */
+		if (navigate_heap_min_key (&ForwardQueue) >= meet.cost ||
+			 navigate_heap_min_key (&BackwardQueue) >= meet.cost) {
+			break;
+		}
+
+		if (route_deadline_passed (++num_heap_gets)) break;
+
+		if (ForwardQueue.count <= BackwardQueue.count) {
+			rc = expand_direction (&forward, cost_fn, navigate_type, &meet, &distance_to_goal);
+		} else {
+			rc = expand_direction (&backward, cost_fn, navigate_type, &meet, &distance_to_goal);
+		}
+
+		if (rc < 0) break;
+
+		if (goal_distance > 0) {
+			progress = (int)(100 * (1 - sqrt ((float)distance_to_goal / goal_distance)));
+			if ((progress >> 2 ) > (cur_max_progress >> 2)) {
+				cur_max_progress = progress;
+				if (!recalc) update_progress (cur_max_progress);
+			}
+		}
+	}
+
+	navigate_heap_reset (&ForwardQueue);
+	navigate_heap_reset (&BackwardQueue);
+
+	if (meet.cost == NO_ROUTE_COST) return -1;
+
+	item = find_prev (meet.square, meet.line, meet.reversed);
+	if (!item || join_search_trees (&meet, last_is_reversed) < 0) {
+		roadmap_log (ROADMAP_ERROR, "Inconsistency in bidirectional route calculation");
+		return -1;
+	}
+
+	*route_total_cost = meet.cost;
+	return 0;
+}
+
+
+/* Searches forward from the start until joining the backward tree kept
+ * from the last route to the same goal. The costs in that tree were not
+ * all final when it was kept, so the result may be slightly off the best
+ * route; a reroute trades that for not searching the whole way again.
+ */
+static int astar_reroute (int start_square, int start_node, int start_segment, int start_reversed,
+								  PluginLine *goal, int *goal_node, int *route_total_cost,
+								  int *last_is_reversed)
+{
+	SearchDirection forward;
+	MeetingPoint meet;
+	NavItem *kept;
+	NavigateCostFn cost_fn = route_cost_fn ();
+	int navigate_type = navigate_cost_type ();
+	int num_heap_gets = 0;
+	int distance_to_goal = 0x7FFFFFFF;
+
+	roadmap_square_set_current (goal->square);
+	roadmap_point_position (*goal_node, &GoalPos);
+
+	forward.queue = &ForwardQueue;
+	forward.graph = RouteGraph;
+	forward.other_graph = RouteGraphBack;
+	forward.target = &GoalPos;
+	forward.backward = 0;
+
+	meet.cost = NO_ROUTE_COST;
+
+	navigate_heap_reset (&ForwardQueue);
+
+	if (!make_queue (&ForwardQueue, RouteGraph, start_square, start_segment, start_reversed)) {
+		return -1;
+	}
+
+	kept = find_item (RouteGraphBack, start_square, start_segment, start_reversed);
+	if (kept) {
+		meet.cost = kept->cost;
+		meet.square = start_square;
+		meet.line = start_segment;
+		meet.reversed = start_reversed != 0;
+	}
+
+	while (!navigate_heap_is_empty (&ForwardQueue) &&
+			 navigate_heap_min_key (&ForwardQueue) < meet.cost) {
+
+		if (++num_heap_gets > MAX_TREE_REROUTE_ATTEMPTS ||
+			 route_deadline_passed (num_heap_gets)) {
+			break;
+		}
+
+		if (expand_direction (&forward, cost_fn, navigate_type, &meet, &distance_to_goal) < 0) {
+			break;
+		}
+	}
+
+	navigate_heap_reset (&ForwardQueue);
+
+	if (meet.cost == NO_ROUTE_COST) return -1;
+
+	if (!find_prev (meet.square, meet.line, meet.reversed) ||
+		 join_search_trees (&meet, last_is_reversed) < 0) {
+		return -1;
+	}
+
+	roadmap_log (ROADMAP_DEBUG, "Rerouted through the kept search tree: %d heap gets",
+					 num_heap_gets);
+
+	*route_total_cost = meet.cost;
+	return 0;
+}
+
+
+/* Relaxes the exits of a tile shortcut starting at the given entry segment.
+ * Returns the number of shortcuts used, 0 when none exist, or -1 when
+ * running out of memory.
+ */
+static int relax_shortcuts (NavigateHeap *q, NavItem *item, int profile, int navigate_type) {
+
+	const NavigateShortcut *shortcuts;
+	const int *via;
+	int square = item->line_square & ~REVERSED;
+	int line = item->line_id;
+	int reversed = (item->line_square & REVERSED) != 0;
+	int count = navigate_shortcut_find (square, line, reversed, profile, &shortcuts, &via);
+	int i;
+
+	for (i = 0; i < count; i++) {
+
+		const NavigateShortcut *shortcut = shortcuts + i;
+		NavItem *next = find_prev (square, shortcut->exit_line, shortcut->exit_reversed);
+		int path_cost = item->cost + shortcut->cost;
+		int total_cost;
+		int to_point;
+		RoadMapPosition to_pos;
+
+		if (next && (!navigate_heap_contains (&next->heap) || path_cost >= next->cost)) continue;
+
+		get_to_node (square, shortcut->exit_line, shortcut->exit_reversed, &to_point, &to_pos);
+		total_cost = path_cost +
+						 estimate_cost (roadmap_math_distance (&to_pos, &GoalPos), navigate_type) + 1;
+		if (total_cost < item->heap.key) total_cost = item->heap.key;
+
+		if (next) {
+			next->prev_square = item->line_square;
+			next->prev_id = line;
+			if (total_cost < next->heap.key) {
+				navigate_heap_decrease_key (q, &next->heap, total_cost);
+			}
+		} else {
+			next = make_path (RouteGraph, square, shortcut->exit_line, shortcut->exit_reversed,
+									square, line, reversed);
+			if (!next || navigate_heap_insert (q, &next->heap, total_cost) < 0) return -1;
+		}
+
+		next->cost = path_cost;
+		next->flags |= NAV_ITEM_SHORTCUT;
+	}
+
+	return count > 0 ? count : 0;
+}
+
+
+/* Replaces the shortcuts along the path ending at the given segment with
+ * the segments they stand for, so that the route can be read segment by
+ * segment from the search tree.
+ */
+static int unpack_shortcuts (int square, int line, int reversed, int profile) {
+
+	NavItem *item = find_prev (square, line, reversed);
+	int steps = 0;
+
+	while (item && steps++ < RouteNumNodes) {
+
+		int prev_square = item->prev_square & ~REVERSED;
+		int prev_line = item->prev_id;
+		int prev_reversed = (item->prev_square & REVERSED) != 0;
+
+		if (item->prev_square == -1 ||
+			 (item->prev_square == item->line_square && item->prev_id == item->line_id)) {
+			break;
+		}
+
+		if (item->flags & NAV_ITEM_SHORTCUT) {
+
+			const NavigateShortcut *shortcuts;
+			const int *via;
+			int count = navigate_shortcut_find (prev_square, prev_line, prev_reversed, profile,
+															&shortcuts, &via);
+			int from_line = prev_line;
+			int from_reversed = prev_reversed;
+			int via_count;
+			int i;
+
+			for (i = 0; i < count; i++) {
+				if (shortcuts[i].exit_line == item->line_id &&
+					 shortcuts[i].exit_reversed == ((item->line_square & REVERSED) != 0)) break;
+			}
+			if (i >= count) return -1;
+
+			via += shortcuts[i].via_first;
+			via_count = shortcuts[i].via_count;
+			for (i = 0; i < via_count; i++) {
+
+				int via_line = NAVIGATE_SHORTCUT_VIA_LINE (via[i]);
+				int via_reversed = NAVIGATE_SHORTCUT_VIA_REVERSED (via[i]);
+				NavItem *via_item = find_prev (prev_square, via_line, via_reversed);
+
+				if (via_item) {
+					via_item->prev_square = prev_square | (from_reversed ? REVERSED : 0);
+					via_item->prev_id = from_line;
+					via_item->flags = 0;
+				} else if (!make_path (RouteGraph, prev_square, via_line, via_reversed,
+											  prev_square, from_line, from_reversed)) {
+					return -1;
+				}
+
+				from_line = via_line;
+				from_reversed = via_reversed;
+			}
+
+			item->prev_square = prev_square | (from_reversed ? REVERSED : 0);
+			item->prev_id = from_line;
+			item->flags = 0;
+		}
+
+		item = find_prev (prev_square, prev_line, prev_reversed);
+	}
+
+	return 0;
 }
 
 
@@ -301,11 +1004,43 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
    RoadMapPosition start_position;
    int out_of_memory;
 
-   struct fibheap *q;
-   NavigateCostFn cost_fn = navigate_cost_get ();
+   NavigateHeap *q = &ForwardQueue;
+   NavigateCostFn cost_fn = route_cost_fn ();
    int navigate_type = navigate_cost_type ();
+   int profile = navigate_cost_profile ();
+   int use_shortcuts = !((*flags) & USE_LAST_RESULTS) && !AltPenaltyActive &&
+                       navigate_shortcut_enabled (profile);
+   int origin_square;
 
 	*first_prev_segment = -1;
+	LastSearchBidirectional = 0;
+
+	if (KeptTree) {
+		/* the caller retries with a full search when this fails */
+		return astar_reroute (*start_square, start_node, *start_segment, *start_reversed,
+									 goal, goal_node, route_total_cost, last_is_reversed);
+	}
+
+	/* shortcuts already skip the inner segments of the tiles along the way */
+	if (!((*flags) & USE_LAST_RESULTS) && !use_shortcuts &&
+		 roadmap_config_match (&BidirectionalCfg, "yes")) {
+
+		if (astar_bidirectional (*start_square, start_node, *start_segment, *start_reversed,
+										 goal, goal_node, route_total_cost, *flags,
+										 last_is_reversed) == 0) {
+			LastSearchBidirectional = 1;
+			return 0;
+		}
+
+		if (!((*flags) & (ALLOW_DESTINATION_CHANGE | ALLOW_ALTERNATE_SOURCE))) {
+			return -1;
+		}
+
+		/* retry with the one sided search, which can relax the end points */
+		free_prev_list ();
+		prepare_prev_list (NULL, 0);
+	}
+
 	roadmap_square_set_current (goal_square);
    roadmap_point_position (*goal_node, &GoalPos);
    roadmap_square_set_current (*start_square);
@@ -361,12 +1096,16 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
 	   last_square = *start_square;
 	   last_line = *start_segment;
 	   last_line_reversed = *start_reversed;
+	   origin_square = last_square;
 
-	   q = make_queue (last_square, last_line, last_line_reversed);
+	   navigate_heap_reset (q);
+	   if (!make_queue (q, RouteGraph, last_square, last_line, last_line_reversed)) {
+	      break;
+	   }
 		num_heap_gets = 0;
 
 		out_of_memory = 0;
-	   while (fh_min(q) != NULL && !out_of_memory) {
+	   while (!navigate_heap_is_empty (q) && !out_of_memory) {
 
 			if (((*flags) & USE_LAST_RESULTS) &&
 				 num_heap_gets >= MAX_REROUTE_ATTEMPS) {
@@ -374,29 +1113,30 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
 				break;
 			}
 	      num_heap_gets++;
+	      if (route_deadline_passed (num_heap_gets)) break;
 
-	      cur_cost = fh_minkey(q);
-	      item = (NavItem *)fh_extractmin(q);
+	      item = (NavItem *)navigate_heap_extract_min (q);
+	      RouteStats.heap_gets++;
+	      prev_cost = item->heap.key;
+	      cur_cost = item->cost;
 	      last_square = item->line_square & ~REVERSED;
 	      last_line = item->line_id;
 	      last_line_reversed = item->line_square & REVERSED;
 
 	      get_to_node (last_square, last_line, last_line_reversed, &node, &position);
 
-	      prev_cost = cur_cost;
-	      if (cur_cost) {
-	         int dis = roadmap_math_distance (&position, &GoalPos);
-	         if (navigate_type == COST_FASTEST) dis = (dis / HU_SPEED);
-	         cur_cost -= dis;
-	      }
-
 	      if (last_square == goal_square &&
 	      	 last_line == goal_line) {
 	         *route_total_cost = cur_cost;
-	         fh_deleteheap(q);
+	         navigate_heap_reset (q);
 	         //printf("Total no. of heap gets in this search: %d\n", num_heap_gets);
 	         //printf ("Final cost for track is %d\n", cur_cost);
 	         *last_is_reversed = last_line_reversed;
+	         if (use_shortcuts &&
+	             unpack_shortcuts (last_square, last_line, last_line_reversed, profile) < 0) {
+	            roadmap_log (ROADMAP_ERROR, "Cannot expand routing shortcuts");
+	            return -1;
+	         }
 	         return 0;
 	      }
 
@@ -414,6 +1154,19 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
 				}
 			}
 
+	      if (use_shortcuts &&
+	          last_square != origin_square &&
+	          last_square != goal_square) {
+
+	         int used = relax_shortcuts (q, item, profile, navigate_type);
+
+	         if (used < 0) {
+	            out_of_memory = 1;
+	            break;
+	         }
+	         if (used > 0) continue;
+	      }
+
 	      no_successors = get_connected_segments (last_square, last_line, last_line_reversed, node,
 	                                    			 successors, MAX_SUCCESSORS, 1, 1);
 	      if (!no_successors) {
@@ -442,10 +1195,10 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
 						*first_prev_segment = prev_ptr->prev_id;
 						prev_ptr->prev_square = last_square | (last_line_reversed ? REVERSED : 0);
 						prev_ptr->prev_id = last_line;
-						fh_deleteheap(q);
+						navigate_heap_reset (q);
 						return 0;
 					}
-					continue;
+					if (!navigate_heap_contains (&prev_ptr->heap)) continue;
 				}
 
 				roadmap_square_set_current (square);
@@ -473,18 +1226,29 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
 	         //		  square, segment, successors[i].to_point,
 	         //		  to_pos.longitude, to_pos.latitude, distance_to_goal);
 
-	         if (navigate_type == COST_FASTEST) {
-	            cost_to_goal = (distance_to_goal / HU_SPEED);
-	         } else {
-	            cost_to_goal = distance_to_goal;
-	         }
+	         cost_to_goal = estimate_cost (distance_to_goal, navigate_type);
 
 	         total_cost = path_cost + cost_to_goal + 1;
 	         if (total_cost < prev_cost) {
 	            total_cost = prev_cost;
 	         }
 
-	         prev_ptr = make_path (square, segment, is_reversed,
+				if (prev_ptr != NULL) {
+
+					/* already queued - keep it only if this path is cheaper */
+					if (path_cost >= prev_ptr->cost) continue;
+
+					prev_ptr->prev_square = last_square | (last_line_reversed ? REVERSED : 0);
+					prev_ptr->prev_id = last_line;
+					prev_ptr->cost = path_cost;
+					prev_ptr->flags = 0;
+					if (total_cost < prev_ptr->heap.key) {
+						navigate_heap_decrease_key (q, &prev_ptr->heap, total_cost);
+					}
+					continue;
+				}
+
+	         prev_ptr = make_path (RouteGraph, square, segment, is_reversed,
 	         				  	   	 last_square, last_line, last_line_reversed);
 
 				if (!prev_ptr) {
@@ -493,7 +1257,12 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
 					break;
 				}
 
-	         fh_insertkey(q, total_cost, prev_ptr);
+				prev_ptr->cost = path_cost;
+	         if (navigate_heap_insert (q, &prev_ptr->heap, total_cost) < 0) {
+
+					out_of_memory = 1;
+					break;
+				}
 
 				progress = (int)(100 * (1 - sqrt ((float)distance_to_goal / goal_distance)));
 	         if ((progress >> 2 ) > (cur_max_progress >> 2)) {
@@ -503,7 +1272,7 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
 
 	      }
 	   }
-	   fh_deleteheap(q);
+	   navigate_heap_reset (q);
 	}
 
 	if (((*flags) & ALLOW_DESTINATION_CHANGE) &&
@@ -514,6 +1283,10 @@ static int astar(int *start_square, int start_node, int *start_segment, int *sta
 		*flags |= CHANGED_DESTINATION;
 		*goal_node = best_node;
 		*last_is_reversed = best_reversed;
+		if (use_shortcuts &&
+		    unpack_shortcuts (best_square, best_line, best_reversed, profile) < 0) {
+			return -1;
+		}
 		return 0;
 	}
 
@@ -692,8 +1465,15 @@ int navigate_route_get_segments (PluginLine *from_line,
 
    static int inside_route = 0;
    int reuse = (*flags & USE_LAST_RESULTS);
+   int use_tree;
+   PluginLine goal = *to_line;
+   int goal_point = *to_point;
+   int from_square = from_line->square;
    int rc;
    int prev_scale = roadmap_square_get_screen_scale ();
+   int square_consumer;
+   int pinned_from;
+   int pinned_goal;
 
    if (inside_route) {
       roadmap_log (ROADMAP_ERROR, "re-entering navigate_route_get_segments");
@@ -701,23 +1481,234 @@ int navigate_route_get_segments (PluginLine *from_line,
    }
    inside_route = 1;
 
+   RouteStats.heap_gets = 0;
+
+   use_tree = can_use_search_tree (to_line, *flags);
+   if (!use_tree) drop_search_tree ();
+
    if (prepare_prev_list (prev_segments, reuse ? num_prev_segments : 0)) {
       inside_route = 0;
       return -1;
    }
 
+   /* the search starts and ends on these squares, keep them loaded */
+   square_consumer = roadmap_square_set_consumer (ROADMAP_SQUARE_CONSUMER_ROUTE);
+   pinned_from = roadmap_square_pin (from_square);
+   pinned_goal = roadmap_square_pin (goal.square);
+
 	roadmap_square_set_screen_scale (0);
    rc = navigate_route_calc_segments(from_line, from_point, to_line, to_point, segments,
    											 num_total, num_new, flags,
    											 prev_segments, num_prev_segments);
+
+   if (use_tree && rc <= 0) {
+   	/* the kept tree did not lead to the goal, search all the way */
+   	free_prev_list ();
+   	drop_search_tree ();
+   	*to_line = goal;
+   	*to_point = goal_point;
+   	if (prepare_prev_list (NULL, 0) == 0) {
+   		rc = navigate_route_calc_segments(from_line, from_point, to_line, to_point, segments,
+   													 num_total, num_new, flags,
+   													 prev_segments, num_prev_segments);
+   	}
+   }
+
+   if (rc > 0 && !use_tree && LastSearchBidirectional && !AltPenaltyActive) {
+   	keep_search_tree (&goal);
+   }
+
    if (rc > 0)
    	roadmap_log (ROADMAP_INFO, "Found route: %d segments (%d new)", *num_total, *num_new);
 
+   {
+      NavigateGraphStats stats;
+
+      navigate_graph_get_stats (&stats);
+      roadmap_log (ROADMAP_DEBUG,
+                   "Graph cache: %d hits, %d misses, %d evictions, %d squares, %d/%d bytes",
+                   stats.hits, stats.misses, stats.evictions, stats.squares,
+                   stats.mem_used, stats.mem_budget);
+   }
+
+   {
+      RoadMapSquareStats stats;
+
+      roadmap_square_get_stats (ROADMAP_SQUARE_CONSUMER_ROUTE, &stats);
+      roadmap_log (ROADMAP_DEBUG,
+                   "Square cache: %d hits, %d misses (%d ms), %d evictions, %d/%d bytes",
+                   stats.hits, stats.misses, stats.load_ms, stats.evictions,
+                   stats.mem_used, stats.mem_budget);
+   }
+
+   if (pinned_from) roadmap_square_unpin (from_square);
+   if (pinned_goal) roadmap_square_unpin (goal.square);
+   roadmap_square_set_consumer (square_consumer);
+
    roadmap_square_set_screen_scale (prev_scale);
 
+   RouteStats.nodes = RouteNumNodes;
+   RouteStats.memory = NavNodeBlocks * HASH_BLOCK_SIZE * sizeof (NavItem) +
+   						  roadmap_hash_map_memory (RouteGraph) +
+   						  roadmap_hash_map_memory (RouteGraphBack) +
+   						  (ForwardQueue.size + BackwardQueue.size) * sizeof (NavigateHeapNode *);
+
    free_prev_list();
 
    inside_route = 0;
    return rc;
 }
 
+
+void navigate_route_get_stats (NavigateRouteStats *stats) {
+
+	*stats = RouteStats;
+}
+
+
+void navigate_route_set_quiet (int quiet) {
+
+	RouteQuiet = quiet;
+}
+
+
+static int alternative_cost (const NavigateSegment *segments, int count,
+									  int *length, int *shared) {
+
+	int cost = 0;
+	int i;
+
+	*length = 0;
+	*shared = 0;
+
+	for (i = 0; i < count; i++) {
+
+		const NavigateSegment *segment = segments + i;
+		int line_length;
+
+		roadmap_square_set_current (segment->square);
+
+		if (i > 0) {
+			const NavigateSegment *prev = segment - 1;
+			int reversed = segment->line_direction != ROUTE_DIRECTION_WITH_LINE;
+			int junction = -1;
+			int segment_cost;
+
+			/* the node the search charged the turn at */
+			if (prev->square == segment->square) {
+				get_from_node (segment->square, segment->line, reversed, &junction);
+			}
+
+			segment_cost =
+				AltBaseCost (segment->line,
+								 reversed,
+								 cost,
+								 prev->line,
+								 prev->line_direction != ROUTE_DIRECTION_WITH_LINE,
+								 junction);
+
+			if (segment_cost > 0) cost += segment_cost;
+		}
+
+		line_length = roadmap_line_length (segment->line);
+		*length += line_length;
+		if (alt_is_penalized (segment->square, segment->line)) {
+			*shared += line_length;
+		}
+	}
+
+	return cost;
+}
+
+
+int navigate_route_get_alternatives (PluginLine *from_line,
+												 int from_point,
+												 PluginLine *to_line,
+												 int *to_point,
+												 NavigateRouteAlternative *routes,
+												 int max_routes,
+												 int time_budget) {
+
+	uint32_t end_time = roadmap_time_get_millis () + time_budget;
+	int best_cost = 0;
+	int count = 0;
+	int attempt;
+	int i;
+
+	AltBaseCost = navigate_cost_get ();
+	AltPenaltyPercent = ALT_PENALTY_PERCENT;
+	AltPenaltyCount = 0;
+	AltPenaltySize = MAX_NAV_SEGEMENTS * max_routes;
+	AltPenaltySquare = malloc (AltPenaltySize * sizeof (int));
+	AltPenaltyLine = malloc (AltPenaltySize * sizeof (int));
+	if (!AltPenaltySquare || !AltPenaltyLine) {
+		roadmap_log (ROADMAP_ERROR, "No memory for alternative routes");
+		free (AltPenaltySquare);
+		free (AltPenaltyLine);
+		return -1;
+	}
+	AltPenaltyHash = roadmap_hash_new ("alternatives", AltPenaltySize);
+
+	for (attempt = 0; attempt < ALT_MAX_ATTEMPTS && count < max_routes; attempt++) {
+
+		NavigateSegment *segments;
+		int num_total;
+		int num_new;
+		int flags;
+		int dest_point = *to_point;
+		int cost;
+		int length;
+		int shared;
+		int rc;
+
+		/* the best route is always computed; the others share the budget */
+		if (attempt > 0) {
+			if (roadmap_time_get_millis () >= end_time) break;
+			RouteDeadline = end_time;
+			AltPenaltyActive = 1;
+			flags = RECALC_ROUTE;
+		} else {
+			flags = NEW_ROUTE;
+		}
+
+		rc = navigate_route_get_segments (from_line, from_point, to_line, &dest_point,
+													 &segments, &num_total, &num_new, &flags,
+													 NULL, 0);
+		RouteDeadline = 0;
+
+		if (rc <= 0) break;
+
+		cost = alternative_cost (segments, num_total, &length, &shared);
+		if (count == 0) {
+			best_cost = cost;
+			*to_point = dest_point;
+		} else if (shared * 100 > length * ALT_MAX_SHARED_PERCENT ||
+					  cost * 100 > best_cost * ALT_MAX_STRETCH_PERCENT) {
+
+			AltPenaltyPercent += ALT_PENALTY_STEP;
+			continue;
+		}
+
+		routes[count].segments = malloc (num_total * sizeof (NavigateSegment));
+		if (!routes[count].segments) break;
+		memcpy (routes[count].segments, segments, num_total * sizeof (NavigateSegment));
+		routes[count].num_segments = num_total;
+		routes[count].cost = cost;
+		routes[count].flags = flags;
+		count++;
+
+		for (i = 0; i < num_total; i++) {
+			alt_penalize (segments[i].square, segments[i].line);
+		}
+	}
+
+	roadmap_log (ROADMAP_DEBUG, "Found %d alternative routes in %d attempts", count, attempt);
+
+	AltPenaltyActive = 0;
+	roadmap_hash_free (AltPenaltyHash);
+	AltPenaltyHash = NULL;
+	free (AltPenaltySquare);
+	free (AltPenaltyLine);
+
+	return count;
+}
@@ -32,10 +32,21 @@
 #include "roadmap_tile_manager.h"
 #include "roadmap_tile_status.h"
 #include "roadmap_messagebox.h"
+#include "roadmap_navigate.h"
+#include "roadmap_layer.h"
+#include "roadmap_main.h"
 #include "Realtime/Realtime.h"
 
 #define	MAX_RESULTS		10
 
+/* routes computed on the device when the server is not available, or
+ * has not answered after LOCAL_ROUTES_SERVER_WAIT ms
+ */
+#define	MAX_LOCAL_RESULTS			3
+#define	LOCAL_ROUTES_TIME_BUDGET	3000
+#define	LOCAL_ROUTES_SERVER_WAIT	10000
+#define	LOCAL_ROUTE_MAX_DISTANCE	300
+
 typedef struct {
 
 	int									route_id;
@@ -54,10 +65,22 @@ typedef struct {
 	NavigateOnRouteResults			on_results;
 	NavigateOnRouteSegments			on_segments;
 	NavigateOnRouteInstrumented	on_instrumented;
+	int									is_local;
+	NavigateRouteAlternative		local[MAX_LOCAL_RESULTS];
+	
+	/* the request, for local routes if the server is slow */
+	PluginLine							local_from;
+	int									local_from_point;
+	BOOL									local_has_from;
+	PluginLine							local_to;
+	BOOL									local_has_to;
+	int									local_max_routes;
 } NavigateRoutingContext;
 
 
 static NavigateRoutingContext		RoutingContext;
+static int								RoutingLastId = 0;
+static BOOL								RoutingServerWait = FALSE;
 
 static int 								TileCbRegistered = 0;
 static RoadMapTileCallback 		TileCbNext = NULL;
@@ -113,18 +136,31 @@ static void navigate_route_free_context (void)
 	for (i = 0; i < MAX_RESULTS; i++) {
 		free_result (i);
 	}
+	for (i = 0; i < MAX_LOCAL_RESULTS; i++) {
+		if (RoutingContext.local[i].segments) free (RoutingContext.local[i].segments);
+	}
+}
+
+static void navigate_route_server_timeout (void);
+
+static void navigate_route_stop_server_wait (void)
+{
+	if (RoutingServerWait) {
+		roadmap_main_remove_periodic (navigate_route_server_timeout);
+		RoutingServerWait = FALSE;
+	}
 }
 
 static void navigate_route_init_context (void)
 {
-	static int last_route_id = 0;
+	navigate_route_stop_server_wait ();
 
-	if (last_route_id > 0) {
+	if (RoutingLastId > 0) {
 		navigate_route_free_context ();
 	}
 	
 	memset (&RoutingContext, 0, sizeof (RoutingContext));	
-	RoutingContext.route_id = ++last_route_id;
+	RoutingContext.route_id = ++RoutingLastId;
 	roadmap_log(ROADMAP_DEBUG, "Increasing route id to:%d", RoutingContext.route_id );
 }
 
@@ -132,6 +168,8 @@ static void navigate_route_clear_context (void)
 {
 	int last_route_id = RoutingContext.route_id;
 
+	navigate_route_stop_server_wait ();
+
 	if (last_route_id > 0) {
 		navigate_route_free_context ();
 	}
@@ -567,6 +605,7 @@ const char *on_routing_response_code (/* IN  */   const char*       data,
    // route_id
    if (!verify_route_id (&data, rc)) return data;
  
+ 	navigate_route_stop_server_wait ();
  	roadmap_log (ROADMAP_DEBUG, "RoutingResonseCode: %s", data);
 
  	// num_responses
@@ -1271,6 +1310,162 @@ const char *on_route_segments (/* IN  */   const char*       data,
    return data;
 }
 
+static NavigateSegment *LocalSegments;
+
+static NavigateSegment *local_segment (int i)
+{
+	return LocalSegments + i;
+}
+
+static BOOL local_route_line (const PluginLine *line, const RoadMapPosition *pos, PluginLine *found)
+{
+	RoadMapNeighbour neighbour;
+	
+	if (line && line->plugin_id == ROADMAP_PLUGIN_ID) {
+		*found = *line;
+		return TRUE;
+	}
+	
+	if (roadmap_navigate_get_neighbours (pos, 0, LOCAL_ROUTE_MAX_DISTANCE, 1,
+													 &neighbour, 1, LAYER_ALL_ROADS) < 1 ||
+		 neighbour.line.plugin_id != ROADMAP_PLUGIN_ID) {
+		return FALSE;
+	}
+	
+	*found = neighbour.line;
+	return TRUE;
+}
+
+/* The end of the line the route leaves from (origin) or arrives by,
+ * following its allowed driving direction.
+ */
+static int local_route_end_point (PluginLine *line, int is_origin)
+{
+	int from;
+	int to;
+	
+	roadmap_square_set_current (line->square);
+	roadmap_line_points (line->line_id, &from, &to);
+	
+	if (roadmap_plugin_get_direction (line, ROUTE_CAR_ALLOWED) ==
+			ROUTE_DIRECTION_AGAINST_LINE) {
+		return is_origin ? from : to;
+	}
+	
+	return is_origin ? to : from;
+}
+
+/* Computes the routes on the device and passes them on as the results of
+ * the request; returns the reason when there is none.
+ */
+static const char *navigate_route_request_local (const PluginLine *from_line,
+																 int from_point,
+																 const PluginLine *to_line,
+																 int max_routes)
+{
+	PluginLine from;
+	PluginLine to;
+	int to_point;
+	int count;
+	int i;
+	int j;
+	
+	if (!local_route_line (from_line, &RoutingContext.pos_src, &from)) {
+		return "Can't find a road near departure point.";
+	}
+	
+	if (!local_route_line (to_line, &RoutingContext.pos_dst, &to)) {
+		return "Can't find a road near destination point.";
+	}
+	
+	if (!from_line) {
+		from_point = local_route_end_point (&from, 1);
+	}
+	to_point = local_route_end_point (&to, 0);
+	
+	if (max_routes > MAX_LOCAL_RESULTS) {
+		max_routes = MAX_LOCAL_RESULTS;
+	}
+	
+	count = navigate_route_get_alternatives (&from, from_point, &to, &to_point,
+														  RoutingContext.local, max_routes,
+														  LOCAL_ROUTES_TIME_BUDGET);
+	if (count <= 0) {
+		return "Can't find a route.";
+	}
+	
+	/* a late answer of the server is for another route */
+	RoutingContext.route_id = ++RoutingLastId;
+	RoutingContext.is_local = 1;
+	RoutingContext.rc = 200;
+	RoutingContext.route_rc = route_succeeded;
+	RoutingContext.num_results = count;
+	RoutingContext.num_received = count;
+	RoutingContext.num_geometries = count;
+	
+	for (i = 0; i < count; i++) {
+		
+		NavigateRouteAlternative *alt = RoutingContext.local + i;
+		NavigateRouteResult *result = RoutingContext.result + i;
+		
+		LocalSegments = alt->segments;
+		navigate_instr_prepare_segments (local_segment, alt->num_segments, alt->num_segments,
+													&RoutingContext.pos_src, &RoutingContext.pos_dst);
+		
+		result->route_status = ROUTE_ORIGINAL;
+		result->flags = RoutingContext.flags | alt->flags;
+		result->alt_id = i + 1;
+		result->description = strdup ("");
+		result->num_segments = alt->num_segments;
+		result->total_length = 0;
+		result->total_time = 0;
+		
+		result->geometry.points = malloc ((alt->num_segments + 1) * sizeof (RoadMapPosition));
+		roadmap_check_allocated (result->geometry.points);
+		result->geometry.num_points = alt->num_segments + 1;
+		result->geometry.valid_points = result->geometry.num_points;
+		
+		for (j = 0; j < alt->num_segments; j++) {
+			NavigateSegment *segment = alt->segments + j;
+			
+			result->total_length += segment->distance;
+			result->total_time += segment->cross_time;
+			if (segment->line_direction == ROUTE_DIRECTION_WITH_LINE) {
+				result->geometry.points[j] = segment->from_pos;
+				result->geometry.points[j + 1] = segment->to_pos;
+			} else {
+				result->geometry.points[j] = segment->to_pos;
+				result->geometry.points[j + 1] = segment->from_pos;
+			}
+		}
+	}
+	
+	RoutingContext.on_results (RoutingContext.route_rc, RoutingContext.num_results, RoutingContext.result);
+	return NULL;
+}
+
+static void navigate_route_server_timeout (void)
+{
+	const char *error;
+	
+	navigate_route_stop_server_wait ();
+	
+	if (RoutingContext.rc != 0 || !RoutingContext.on_results) {
+		return;
+	}
+	
+	roadmap_log (ROADMAP_WARNING, "No answer from the routing server for route %d, routing locally",
+					 RoutingContext.route_id);
+	
+	error = navigate_route_request_local (RoutingContext.local_has_from ? &RoutingContext.local_from : NULL,
+													  RoutingContext.local_from_point,
+													  RoutingContext.local_has_to ? &RoutingContext.local_to : NULL,
+													  RoutingContext.local_max_routes);
+	if (error) {
+		roadmap_log (ROADMAP_WARNING, "No local route (%s), still waiting for the server", error);
+	}
+}
+
 void navigate_route_request (const PluginLine *from_line,
                              int from_point,
                              const PluginLine *to_line,
@@ -1414,6 +1609,17 @@ void navigate_route_request (const PluginLine *from_line,
    }
    
    RoutingContext.flags = flags;
+   
+   if (cb_results && !RealTimeLoginState ()) {
+   	const char *error = navigate_route_request_local (from_line, from_point, to_line, max_routes);
+   	
+   	if (error) {
+			RoutingContext.rc = 404;
+			routing_error (error);
+   	}
+   	return;
+   }
+   
    bRes = Realtime_RequestRoute (RoutingContext.route_id,		//iRoute
 								  route_type,						//iType
 								  trip_id,							//iTripId
@@ -1442,6 +1648,20 @@ void navigate_route_request (const PluginLine *from_line,
 	if (!bRes) {
 		RoutingContext.rc = 500;
 		routing_error ("Failed to Communicate with Routing Server");
+		return;
+	}
+	
+	if (cb_results) {
+		
+		if (from_line) RoutingContext.local_from = *from_line;
+		RoutingContext.local_has_from = from_line != NULL;
+		RoutingContext.local_from_point = from_point;
+		if (to_line) RoutingContext.local_to = *to_line;
+		RoutingContext.local_has_to = to_line != NULL;
+		RoutingContext.local_max_routes = max_routes;
+		
+		roadmap_main_set_periodic (LOCAL_ROUTES_SERVER_WAIT, navigate_route_server_timeout);
+		RoutingServerWait = TRUE;
 	}
 }
 
@@ -1467,6 +1687,23 @@ void navigate_route_select (int alt_id)
 		RoutingContext.result[0] = RoutingContext.result[iresult];		
 	}	
 	
+	if (RoutingContext.is_local) {
+		
+		// hand the selected route over as if the server sent it
+		RoutingContext.route.segments = RoutingContext.local[iresult].segments;
+		RoutingContext.route.num_segments = RoutingContext.local[iresult].num_segments;
+		RoutingContext.route.num_received = RoutingContext.route.num_segments;
+		RoutingContext.route.num_valid = RoutingContext.route.num_segments;
+		RoutingContext.route.num_instrumented = RoutingContext.route.num_segments;
+		RoutingContext.route.next_to_instrument = RoutingContext.route.num_segments;
+		RoutingContext.local[iresult].segments = NULL;
+		
+		if (RoutingContext.on_segments) {
+			RoutingContext.on_segments (route_succeeded, RoutingContext.result, &RoutingContext.route);
+		}
+		return;
+	}
+	
 	// send selection to server
 	Realtime_SelectRoute (RoutingContext.route_id, alt_id);
 }
@@ -0,0 +1,551 @@
+/* navigate_shortcut.c - precomputed routing shortcuts across tiles
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009, Waze Ltd
+ *
+ *   This file is part of RoadMap.
+ *
+ *   RoadMap is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   RoadMap is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with RoadMap; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * SYNOPSYS:
+ *
+ *   See navigate_shortcut.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "roadmap.h"
+#include "roadmap_config.h"
+#include "roadmap_file.h"
+#include "roadmap_dbread.h"
+#include "roadmap_hash.h"
+#include "roadmap_line.h"
+#include "roadmap_line_route.h"
+#include "roadmap_math.h"
+#include "roadmap_square.h"
+#include "roadmap_start.h"
+#include "roadmap_tile.h"
+
+#include "Realtime/Realtime.h"
+
+#include "navigate_cost.h"
+#include "navigate_graph.h"
+#include "navigate_heap.h"
+#include "navigate_shortcut.h"
+
+#define SHORTCUT_FILE "routing_shortcuts"
+#define SHORTCUT_MAGIC 0x31435352 /* "RSC1" */
+#define SHORTCUT_MAX_SUCCESSORS 100
+
+typedef struct {
+   int tile;
+   int version;
+   int profile;
+   int num_shortcuts;
+   int num_via;
+} ShortcutTileHeader;
+
+typedef struct {
+   ShortcutTileHeader header;
+   NavigateShortcut   *shortcuts;
+   int                *via;
+} ShortcutTile;
+
+typedef struct {
+   NavigateHeapNode heap;
+   int cost;
+   int prev;
+   int stamp;
+} ShortcutNode;
+
+static RoadMapConfigDescriptor ShortcutsCfg =
+                  ROADMAP_CONFIG_ITEM("Routing", "Shortcuts");
+
+static ShortcutTile *ShortcutTiles;
+static int ShortcutTilesCount;
+static int ShortcutTilesSize;
+static RoadMapHash *ShortcutHash;
+static int ShortcutLoaded;
+
+
+static int shortcut_key (int line, int reversed) {
+
+   return line * 2 + (reversed != 0);
+}
+
+
+static ShortcutTile *shortcut_tile (int square, int profile) {
+
+   int index = roadmap_hash_get_first (ShortcutHash, square);
+
+   while (index >= 0) {
+      ShortcutTile *tile = ShortcutTiles + index;
+      if (tile->header.tile == square && tile->header.profile == profile) return tile;
+      index = roadmap_hash_get_next (ShortcutHash, index);
+   }
+
+   return NULL;
+}
+
+
+static ShortcutTile *shortcut_add_tile (int square, int profile) {
+
+   ShortcutTile *tile = shortcut_tile (square, profile);
+
+   if (tile) {
+      free (tile->shortcuts);
+      free (tile->via);
+   } else {
+
+      if (ShortcutTilesCount == ShortcutTilesSize) {
+         ShortcutTilesSize = ShortcutTilesSize ? ShortcutTilesSize * 2 : 256;
+         ShortcutTiles = realloc (ShortcutTiles, ShortcutTilesSize * sizeof (ShortcutTile));
+         roadmap_check_allocated (ShortcutTiles);
+         roadmap_hash_resize (ShortcutHash, ShortcutTilesSize);
+      }
+
+      tile = ShortcutTiles + ShortcutTilesCount;
+      roadmap_hash_add (ShortcutHash, square, ShortcutTilesCount);
+      ShortcutTilesCount++;
+   }
+
+   memset (tile, 0, sizeof (ShortcutTile));
+   tile->header.tile = square;
+   tile->header.profile = profile;
+
+   return tile;
+}
+
+
+static void shortcut_load (void) {
+
+   FILE *file;
+   int header[2];
+   long remaining;
+
+   if (ShortcutLoaded) return;
+   ShortcutLoaded = 1;
+
+   ShortcutHash = roadmap_hash_new ("shortcuts", 256);
+
+   file = roadmap_file_fopen (roadmap_db_map_path (), SHORTCUT_FILE, "r");
+   if (!file) return;
+
+   /* the counts read from the file are checked against what is left of it */
+   remaining = (long)roadmap_file_length (roadmap_db_map_path (), SHORTCUT_FILE) -
+                  (long)sizeof (header);
+
+   if (fread (header, sizeof (header), 1, file) != 1 ||
+       header[0] != SHORTCUT_MAGIC ||
+       header[1] < 0 ||
+       header[1] > remaining / (long)sizeof (ShortcutTileHeader)) {
+      roadmap_log (ROADMAP_ERROR, "Invalid routing shortcuts file");
+      fclose (file);
+      return;
+   }
+
+   while (header[1]-- > 0) {
+
+      ShortcutTileHeader tile_header;
+      NavigateShortcut *shortcuts;
+      int *via;
+      long size;
+      int i;
+      ShortcutTile *tile;
+
+      if (fread (&tile_header, sizeof (tile_header), 1, file) != 1) break;
+      remaining -= sizeof (tile_header);
+
+      if (tile_header.num_shortcuts < 0 ||
+          tile_header.num_via < 0 ||
+          tile_header.num_shortcuts > remaining / (long)sizeof (NavigateShortcut) ||
+          tile_header.num_via > remaining / (long)sizeof (int)) {
+         roadmap_log (ROADMAP_ERROR, "Invalid routing shortcuts for tile %d", tile_header.tile);
+         break;
+      }
+
+      size = tile_header.num_shortcuts * (long)sizeof (NavigateShortcut) +
+             tile_header.num_via * (long)sizeof (int);
+      if (size > remaining) {
+         roadmap_log (ROADMAP_ERROR, "Truncated routing shortcuts file");
+         break;
+      }
+      remaining -= size;
+
+      shortcuts = malloc (tile_header.num_shortcuts * sizeof (NavigateShortcut) + 1);
+      via = malloc (tile_header.num_via * sizeof (int) + 1);
+      roadmap_check_allocated (shortcuts);
+      roadmap_check_allocated (via);
+
+      if (fread (shortcuts, sizeof (NavigateShortcut), tile_header.num_shortcuts, file) !=
+             (size_t)tile_header.num_shortcuts ||
+          fread (via, sizeof (int), tile_header.num_via, file) !=
+             (size_t)tile_header.num_via) {
+
+         roadmap_log (ROADMAP_ERROR, "Truncated routing shortcuts file");
+         free (shortcuts);
+         free (via);
+         break;
+      }
+
+      for (i = 0; i < tile_header.num_shortcuts; i++) {
+         if (shortcuts[i].via_first < 0 ||
+             shortcuts[i].via_first + shortcuts[i].via_count > tile_header.num_via) break;
+      }
+
+      if (i < tile_header.num_shortcuts) {
+         roadmap_log (ROADMAP_ERROR, "Invalid routing shortcuts for tile %d", tile_header.tile);
+         free (shortcuts);
+         free (via);
+         break;
+      }
+
+      tile = shortcut_add_tile (tile_header.tile, tile_header.profile);
+      tile->header = tile_header;
+      tile->shortcuts = shortcuts;
+      tile->via = via;
+   }
+
+   fclose (file);
+   roadmap_log (ROADMAP_INFO, "Loaded routing shortcuts for %d tiles", ShortcutTilesCount);
+}
+
+
+int navigate_shortcut_save (void) {
+
+   FILE *file;
+   int header[2];
+   int i;
+
+   shortcut_load ();
+
+   file = roadmap_file_fopen (roadmap_db_map_path (), SHORTCUT_FILE, "w");
+   if (!file) return -1;
+
+   header[0] = SHORTCUT_MAGIC;
+   header[1] = ShortcutTilesCount;
+   fwrite (header, sizeof (header), 1, file);
+
+   for (i = 0; i < ShortcutTilesCount; i++) {
+      ShortcutTile *tile = ShortcutTiles + i;
+
+      fwrite (&tile->header, sizeof (tile->header), 1, file);
+      fwrite (tile->shortcuts, sizeof (NavigateShortcut), tile->header.num_shortcuts, file);
+      fwrite (tile->via, sizeof (int), tile->header.num_via, file);
+   }
+
+   fclose (file);
+   return 0;
+}
+
+
+int navigate_shortcut_enabled (int profile) {
+
+   int i;
+
+   if (!roadmap_config_match (&ShortcutsCfg, "yes")) return 0;
+
+   /* shortcut costs do not include live traffic */
+   if (RealTimeLoginState ()) return 0;
+
+   shortcut_load ();
+
+   for (i = 0; i < ShortcutTilesCount; i++) {
+      if (ShortcutTiles[i].header.profile == profile) return 1;
+   }
+
+   return 0;
+}
+
+
+int navigate_shortcut_find (int square, int line, int reversed, int profile,
+                            const NavigateShortcut **shortcuts, const int **via) {
+
+   ShortcutTile *tile = shortcut_tile (square, profile);
+   int key = shortcut_key (line, reversed);
+   int low;
+   int high;
+   int first;
+
+   if (!tile || tile->header.version != roadmap_square_version (square)) return -1;
+
+   low = 0;
+   high = tile->header.num_shortcuts;
+   while (low < high) {
+      int mid = (low + high) / 2;
+      const NavigateShortcut *s = tile->shortcuts + mid;
+
+      if (shortcut_key (s->entry_line, s->entry_reversed) < key) low = mid + 1;
+      else high = mid;
+   }
+
+   first = low;
+   while (high < tile->header.num_shortcuts &&
+          shortcut_key (tile->shortcuts[high].entry_line,
+                        tile->shortcuts[high].entry_reversed) == key) {
+      high++;
+   }
+
+   *shortcuts = tile->shortcuts + first;
+   *via = tile->via;
+
+   return high - first;
+}
+
+
+static int is_border_end (int line, int reversed) {
+
+   return reversed ? roadmap_line_from_is_fake (line) : roadmap_line_to_is_fake (line);
+}
+
+
+static int is_border_start (int line, int reversed) {
+
+   return reversed ? roadmap_line_to_is_fake (line) : roadmap_line_from_is_fake (line);
+}
+
+
+static int compare_ints (const void *a, const void *b) {
+
+   return *(const int *)a - *(const int *)b;
+}
+
+
+int navigate_shortcut_build_tile (int square) {
+
+   NavigateCostFn cost_fn = navigate_cost_get_static ();
+   int profile = navigate_cost_profile ();
+   struct successor successors[SHORTCUT_MAX_SUCCESSORS];
+   NavigateHeap heap;
+   ShortcutNode *nodes;
+   ShortcutTile *tile;
+   int *entries;
+   int num_entries = 0;
+   int num_lines;
+   int max_shortcuts = 0;
+   int max_via = 0;
+   int cfcc;
+   int e;
+
+   shortcut_load ();
+
+   if (!roadmap_square_set_current (square)) return -1;
+
+   num_lines = roadmap_line_count ();
+   if (num_lines <= 0 || num_lines > 0xffff) return -1;
+
+   nodes = calloc (num_lines * 2, sizeof (ShortcutNode));
+   entries = malloc (num_lines * 2 * sizeof (int));
+   roadmap_check_allocated (nodes);
+   roadmap_check_allocated (entries);
+
+   for (cfcc = ROADMAP_ROAD_FIRST; cfcc <= ROADMAP_ROAD_LAST; cfcc++) {
+
+      int first_line;
+      int last_line;
+      int line;
+
+      if (roadmap_line_in_square (square, cfcc, &first_line, &last_line) <= 0) continue;
+
+      for (line = first_line; line <= last_line; line++) {
+
+         int direction = roadmap_line_route_get_direction (line, ROUTE_CAR_ALLOWED);
+
+         if ((direction & ROUTE_DIRECTION_WITH_LINE) && is_border_start (line, 0)) {
+            entries[num_entries++] = shortcut_key (line, 0);
+         }
+         if ((direction & ROUTE_DIRECTION_AGAINST_LINE) && is_border_start (line, 1)) {
+            entries[num_entries++] = shortcut_key (line, 1);
+         }
+      }
+   }
+
+   qsort (entries, num_entries, sizeof (int), compare_ints);
+
+   tile = shortcut_add_tile (square, profile);
+   tile->header.version = roadmap_square_version (square);
+
+   navigate_heap_init (&heap);
+
+   for (e = 0; e < num_entries; e++) {
+
+      int stamp = e + 1;
+      ShortcutNode *node = nodes + entries[e];
+
+      node->stamp = stamp;
+      node->cost = 0;
+      node->prev = -1;
+      node->heap.index = NAVIGATE_HEAP_NONE;
+      navigate_heap_insert (&heap, &node->heap, 0);
+
+      while (!navigate_heap_is_empty (&heap)) {
+
+         int index;
+         int line;
+         int reversed;
+         int to_point;
+         int count;
+         int i;
+
+         node = (ShortcutNode *)navigate_heap_extract_min (&heap);
+         index = node - nodes;
+         line = index >> 1;
+         reversed = index & 1;
+
+         roadmap_square_set_current (square);
+
+         if (index != entries[e] && is_border_end (line, reversed)) {
+
+            NavigateShortcut *shortcut;
+            int via_count = 0;
+            int v;
+
+            for (v = node->prev; v != entries[e]; v = nodes[v].prev) via_count++;
+
+            if (tile->header.num_shortcuts == max_shortcuts) {
+               max_shortcuts = max_shortcuts ? max_shortcuts * 2 : 64;
+               tile->shortcuts = realloc (tile->shortcuts, max_shortcuts * sizeof (NavigateShortcut));
+               roadmap_check_allocated (tile->shortcuts);
+            }
+            while (tile->header.num_via + via_count > max_via) {
+               max_via = max_via ? max_via * 2 : 256;
+               tile->via = realloc (tile->via, max_via * sizeof (int));
+               roadmap_check_allocated (tile->via);
+            }
+
+            shortcut = tile->shortcuts + tile->header.num_shortcuts++;
+            shortcut->entry_line = entries[e] >> 1;
+            shortcut->entry_reversed = entries[e] & 1;
+            shortcut->exit_line = line;
+            shortcut->exit_reversed = reversed;
+            shortcut->cost = node->cost;
+            shortcut->via_first = tile->header.num_via;
+            shortcut->via_count = via_count;
+
+            /* the via segments are stored in driving order */
+            for (v = node->prev; v != entries[e]; v = nodes[v].prev) {
+               tile->via[tile->header.num_via + --via_count] = v;
+            }
+            tile->header.num_via += shortcut->via_count;
+            continue;
+         }
+
+         if (reversed) {
+            roadmap_line_from_point (line, &to_point);
+         } else {
+            roadmap_line_to_point (line, &to_point);
+         }
+
+         count = get_connected_segments (square, line, reversed, to_point,
+                                         successors, SHORTCUT_MAX_SUCCESSORS, 1, 1);
+
+         roadmap_square_set_current (square);
+
+         for (i = 0; i < count; i++) {
+
+            int next_index;
+            int segment_cost;
+            int path_cost;
+            ShortcutNode *next;
+
+            if (successors[i].square_id != square) continue;
+
+            segment_cost = cost_fn (successors[i].line_id, successors[i].reversed, node->cost,
+                                    line, reversed, to_point);
+            if (segment_cost < 0) continue;
+
+            path_cost = node->cost + segment_cost;
+            next_index = shortcut_key (successors[i].line_id, successors[i].reversed);
+            next = nodes + next_index;
+
+            if (next->stamp != stamp) {
+               next->stamp = stamp;
+               next->cost = path_cost;
+               next->prev = index;
+               next->heap.index = NAVIGATE_HEAP_NONE;
+               navigate_heap_insert (&heap, &next->heap, path_cost);
+            } else if (navigate_heap_contains (&next->heap) && path_cost < next->cost) {
+               next->cost = path_cost;
+               next->prev = index;
+               navigate_heap_decrease_key (&heap, &next->heap, path_cost);
+            }
+         }
+      }
+   }
+
+   navigate_heap_free (&heap);
+   free (entries);
+   free (nodes);
+
+   return tile->header.num_shortcuts;
+}
+
+
+int navigate_shortcut_build_area (const RoadMapArea *area) {
+
+   RoadMapPosition corner;
+   RoadMapPosition origin;
+   RoadMapPosition position;
+   int step = roadmap_tile_get_size (0);
+   int tiles = 0;
+
+   corner.longitude = area->west;
+   corner.latitude = area->south;
+   roadmap_tile_get_origin (0, &corner, &origin);
+
+   for (position.longitude = origin.longitude;
+        position.longitude <= area->east;
+        position.longitude += step) {
+
+      for (position.latitude = origin.latitude;
+           position.latitude <= area->north;
+           position.latitude += step) {
+
+         if (navigate_shortcut_build_tile
+               (roadmap_tile_get_id_from_position (0, &position)) >= 0) {
+            tiles++;
+         }
+      }
+   }
+
+   roadmap_log (ROADMAP_INFO, "Built routing shortcuts for %d tiles", tiles);
+
+   if (tiles) navigate_shortcut_save ();
+
+   return tiles;
+}
+
+
+static void navigate_shortcut_build_screen (void) {
+
+   RoadMapArea area;
+
+   roadmap_math_screen_edges (&area);
+   navigate_shortcut_build_area (&area);
+}
+
+
+void navigate_shortcut_initialize (void) {
+
+   roadmap_config_declare_enumeration
+      ("preferences", &ShortcutsCfg, NULL, "yes", "no", NULL);
+
+   roadmap_start_add_action ("buildshortcuts", "Build routing shortcuts", NULL, NULL,
+      "Precompute offline routing shortcuts for the displayed area",
+      navigate_shortcut_build_screen);
+}
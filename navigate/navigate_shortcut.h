@@ -0,0 +1,66 @@
+/* navigate_shortcut.h - precomputed routing shortcuts across tiles
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009, Waze Ltd
+ *
+ *   This file is part of RoadMap.
+ *
+ *   RoadMap is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   RoadMap is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with RoadMap; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * DESCRIPTION:
+ *
+ *   For every tile, the cheapest paths from each segment entering the tile
+ *   to each segment leaving it are computed in advance. A route search can
+ *   then cross a tile in one step instead of expanding its inner segments.
+ *   The shortcuts are computed with the static cost of a given routing
+ *   profile (see navigate_cost_profile) and kept in the map directory.
+ */
+
+#ifndef _NAVIGATE_SHORTCUT_H_
+#define _NAVIGATE_SHORTCUT_H_
+
+#include "roadmap_types.h"
+
+typedef struct {
+   unsigned short entry_line;
+   unsigned short exit_line;
+   unsigned char  entry_reversed;
+   unsigned char  exit_reversed;
+   unsigned short via_count;
+   int            via_first;
+   int            cost;
+} NavigateShortcut;
+
+/* via segments are encoded as (line << 1) | reversed */
+#define NAVIGATE_SHORTCUT_VIA_LINE(v)     ((v) >> 1)
+#define NAVIGATE_SHORTCUT_VIA_REVERSED(v) ((v) & 1)
+
+void navigate_shortcut_initialize (void);
+
+int  navigate_shortcut_enabled (int profile);
+
+/* Returns the shortcuts leaving the given entry segment, or -1 if no
+ * shortcut data was computed for its tile.
+ */
+int  navigate_shortcut_find (int square, int line, int reversed, int profile,
+                             const NavigateShortcut **shortcuts, const int **via);
+
+int  navigate_shortcut_build_tile (int square);
+int  navigate_shortcut_build_area (const RoadMapArea *area);
+
+int  navigate_shortcut_save (void);
+
+#endif /* _NAVIGATE_SHORTCUT_H_ */
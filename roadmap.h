@@ -29,6 +29,7 @@
 #define WAZE_ALPHA
 
 #include <assert.h>
+#include <stdarg.h>
 
 #ifdef __SYMBIAN32__
 typedef   unsigned int      uint32_t;
@@ -168,6 +169,13 @@ static inline void do_assert(char *text) {
 
 typedef void (*roadmap_log_msgbox_handler) (const char *title, const char *msg);
 
+/* Takes the messages of a thread which must not log itself, so that they
+ * are logged later by the main thread; returns 0 to let roadmap_log do it.
+ * The message is not formatted unless the handler takes it.
+ */
+typedef int (*roadmap_log_redirect_handler)
+               (int level, const char *source, int line, const char *format, va_list ap);
+
 #ifndef J2ME
 void roadmap_log_push        (const char *description);
 void roadmap_log_pop         (void);
@@ -188,6 +196,7 @@ void roadmap_log_purge     (void);
 int  roadmap_log_enabled (int level, char *source, int line);
 
 void roadmap_log_register_msgbox (roadmap_log_msgbox_handler handler);
+void roadmap_log_register_redirect (roadmap_log_redirect_handler handler);
 
 const char *roadmap_log_path     (void);
 const char *roadmap_log_filename (void);
@@ -212,6 +221,7 @@ int   roadmap_is_visible (int category);
 void roadmap_option_set_verbosity( int verbosity_level );
 
 char *roadmap_gps_source (void);
+const char *roadmap_route_bench_source (void);
 
 int roadmap_option_cache  (void);
 int roadmap_option_width  (const char *name);
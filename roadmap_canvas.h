@@ -185,6 +185,26 @@ RoadMapImage roadmap_canvas_image_from_buf( unsigned char* buf, int width, int h
 
 void roadmap_canvas_free_image (RoadMapImage image);
 
+/* The AGG canvas can keep the map it drew, to show it again while the map
+ * is dragged or zoomed instead of drawing it all.
+ */
+#if defined(IPHONE) || defined(ANDROID)
+#define ROADMAP_CANVAS_RETAIN
+#endif
+
+#ifdef ROADMAP_CANVAS_RETAIN
+void roadmap_canvas_retain_map (void);
+
+/* The kept map is scaled by scale / 1024 around the center of the canvas
+ * and moved by dx, dy. The area returns 0 if there is no map to draw.
+ */
+int  roadmap_canvas_retained_map_area (int dx, int dy, int scale,
+                                       RoadMapGuiRect *covered);
+void roadmap_canvas_draw_retained_map (int dx, int dy, int scale);
+
+void roadmap_canvas_discard_retained_map (void);
+#endif
+
 #ifdef IPHONE
 void roadmap_canvas_get_cording_pt (RoadMapGuiPoint points[MAX_CORDING_POINTS]);
 int roadmap_canvas_is_cording();
@@ -67,6 +67,46 @@ typedef struct {
 	unsigned int					compressed_data_size;
 	unsigned int					raw_data_size;
 } roadmap_tile_file_header;
+
+/* A tile stored uncompressed has a compressed_data_size of 0, and its raw
+ * data starts at this offset so that it can be used in place when mapped.
+ */
+#define ROADMAP_TILE_RAW_DATA_OFFSET	64
+
+/* Tile archive: one data file holding a record per tile, and a sorted
+ * index of the records. Records appended after the index was written
+ * are found by scanning the data file from index data_end. The tile
+ * starts ROADMAP_ARCHIVE_DATA_OFFSET bytes into its record, which keeps
+ * it aligned when the record is mapped.
+ */
+#define ROADMAP_ARCHIVE_TYPE				".wta"
+#define ROADMAP_ARCHIVE_INDEX_TYPE		".wti"
+#define ROADMAP_ARCHIVE_SIGNATURE		"WZTA"
+#define ROADMAP_ARCHIVE_INDEX_SIGNATURE	"WZTI"
+#define ROADMAP_ARCHIVE_CURRENT_VERSION	0x00020000
+#define ROADMAP_ARCHIVE_DATA_OFFSET		16
+
+typedef struct {
+
+	int				tile_id;		/* -1 for a free record */
+	unsigned int	size;
+	unsigned int	capacity;	/* bytes reserved after the data offset */
+} roadmap_archive_record;
+
+typedef struct {
+
+	roadmap_data_file_header	general_header;
+	unsigned int					data_end;
+	int								num_tiles;
+} roadmap_archive_index_header;
+
+typedef struct {
+
+	int				tile_id;
+	unsigned int	offset;		/* of the record header */
+	unsigned int	capacity;
+	unsigned int	size;
+} roadmap_archive_entry;
 		
 typedef struct {
 	unsigned int	num_sections;
@@ -66,6 +66,10 @@
 #include "roadmap_path.h"
 #include "roadmap_data_format.h"
 #include "roadmap_tile_storage.h"
+#include "roadmap_tile_worker.h"
+#ifdef ROADMAP_TILE_ARCHIVE
+#include "roadmap_tile_archive.h"
+#endif
 #include "roadmap_dbread.h"
 
 
@@ -87,14 +91,40 @@ typedef struct roadmap_db_database_s {
 
    struct roadmap_db_database_s *next;
    struct roadmap_db_database_s *previous;
+   struct roadmap_db_database_s *next_hash;
 
    roadmap_db_model 		*model;
    roadmap_db_context	*context;
 
+#ifdef ROADMAP_TILE_MAPPING
+   RoadMapFileContext	file;	/* set when the mapped data is used in place */
+   void					*buffer;	/* set when the loaded data is used in place */
+#endif
+
 } roadmap_db_database;
 
 static roadmap_db_database *RoadmapDatabaseFirst  = NULL;
 
+/* The open databases are also chained by their tile, so that finding one
+ * does not depend on how many are open. The square cache bounds that.
+ */
+#ifdef J2ME
+#define ROADMAP_DB_HASH_SIZE 64
+#else
+#define ROADMAP_DB_HASH_SIZE 4096
+#endif
+
+static roadmap_db_database *RoadmapDatabaseHash[ROADMAP_DB_HASH_SIZE];
+
+static roadmap_db_evict_hook RoadmapDatabaseEvictHook = NULL;
+
+/* Only the storage of mapping builds holds uncompressed tiles */
+#ifdef ROADMAP_TILE_MAPPING
+#define ROADMAP_DB_IN_PLACE 1
+#else
+#define ROADMAP_DB_IN_PLACE 0
+#endif
+
 
 static unsigned int roadmap_db_aligned_offset (const roadmap_db_data_file *data, unsigned int unaligned_offset) {
 
@@ -208,16 +238,49 @@ static void roadmap_db_call_unmap (roadmap_db_database *database) {
 }
 
 
-static void roadmap_db_close_database (roadmap_db_database *database) {
-
-   roadmap_db_call_unmap (database);
+static void roadmap_db_free_data (roadmap_db_database *database) {
 
 #ifdef NO_MAP_COMPRESSION
 	unsigned char *ptr = (unsigned char *)(database->data.header) - sizeof(roadmap_data_file_header);
 	free (ptr);
+#elif defined (ROADMAP_TILE_MAPPING)
+	if (database->file) {
+		roadmap_file_unmap (&database->file);
+	} else if (database->buffer) {
+		free (database->buffer);
+	} else {
+		free (database->data.header);
+	}
 #else
 	free (database->data.header);
 #endif
+}
+
+
+static unsigned int roadmap_db_hash (int fips, int tile_index) {
+
+   unsigned int key = ((unsigned int)tile_index * 2654435761U) ^ (unsigned int)fips;
+
+   return (key ^ (key >> 16)) & (ROADMAP_DB_HASH_SIZE - 1);
+}
+
+
+static void roadmap_db_close_database (roadmap_db_database *database) {
+
+   roadmap_db_database **link =
+      RoadmapDatabaseHash + roadmap_db_hash (database->fips, database->tile_index);
+
+   if (database->tile_index != -1 && RoadmapDatabaseEvictHook != NULL) {
+      RoadmapDatabaseEvictHook (database->fips, database->tile_index);
+   }
+
+   roadmap_db_call_unmap (database);
+   roadmap_db_free_data (database);
+
+   while (*link != database) {
+      link = &(*link)->next_hash;
+   }
+   *link = database->next_hash;
 
    if (database->next != NULL) {
       database->next->previous = database->previous;
@@ -253,13 +316,22 @@ roadmap_db_model *roadmap_db_register
 
 
 
+roadmap_db_evict_hook roadmap_db_set_evict_hook (roadmap_db_evict_hook hook) {
+
+   roadmap_db_evict_hook previous = RoadmapDatabaseEvictHook;
+
+   RoadmapDatabaseEvictHook = hook;
+   return previous;
+}
+
+
 roadmap_db_database *roadmap_db_find (int fips, int tile_index) {
 
    roadmap_db_database *database;
 
-   for (database = RoadmapDatabaseFirst;
+   for (database = RoadmapDatabaseHash[roadmap_db_hash (fips, tile_index)];
          database != NULL;
-         database = database->next) {
+         database = database->next_hash) {
 
       if ((tile_index == database->tile_index) &&
             (fips == database->fips)) {
@@ -271,7 +343,9 @@ roadmap_db_database *roadmap_db_find (int fips, int tile_index) {
 }
 
 
-static int roadmap_db_fill_data (roadmap_db_database *database, void *base, unsigned int size) {
+/* Uncompressed tiles are used in place, and only accepted if in_place is set */
+static int roadmap_db_fill_data (roadmap_db_database *database, void *base, unsigned int size,
+										   int in_place) {
 
 	roadmap_tile_file_header *tile_header = (roadmap_tile_file_header *) base;
 	roadmap_data_file_header *file_header = (roadmap_data_file_header *) tile_header;
@@ -302,40 +376,51 @@ static int roadmap_db_fill_data (roadmap_db_database *database, void *base, unsi
 	   roadmap_log (ROADMAP_ERROR, "data file open: invalid version 0x%x != 0x%x", file_header->version, ROADMAP_DATA_CURRENT_VERSION);
 	   return 0;
 	}
-	if (tile_header->compressed_data_size != size - sizeof (roadmap_tile_file_header)) {
+	if (tile_header->compressed_data_size == 0 && in_place) {
+
+		if (size < ROADMAP_TILE_RAW_DATA_OFFSET + tile_header->raw_data_size) {
+		   roadmap_log (ROADMAP_ERROR, "data file size mismatch: expecting %d found %d",
+		   				 ROADMAP_TILE_RAW_DATA_OFFSET + tile_header->raw_data_size, size);
+		   return 0;
+		}
+		raw_data_size = tile_header->raw_data_size;
+		raw_data = (unsigned char *)base + ROADMAP_TILE_RAW_DATA_OFFSET;
+
+	} else if (tile_header->compressed_data_size != size - sizeof (roadmap_tile_file_header)) {
 	   roadmap_log (ROADMAP_ERROR, "data file size mismatch: expecting %d found %d",
 	   				 sizeof (roadmap_tile_file_header) + tile_header->compressed_data_size,
 	   				 size);
 	   return 0;
 
-	}
+	} else {
 
-	raw_data_size = tile_header->raw_data_size;
+		raw_data_size = tile_header->raw_data_size;
 
 #ifdef NO_MAP_COMPRESSION
-	// No compression
-	raw_data = (unsigned char *) compressed_data;
+		// No compression
+		raw_data = (unsigned char *) compressed_data;
 #else
-	raw_data = malloc (raw_data_size);
+		raw_data = malloc (raw_data_size);
 
 #ifdef RIMAPI
-	status = RIMAPI_ZLib_uncompress (raw_data, &raw_data_size, compressed_data, tile_header->compressed_data_size);
+		status = RIMAPI_ZLib_uncompress (raw_data, &raw_data_size, compressed_data, tile_header->compressed_data_size);
 #else
-	status = uncompress (raw_data, &raw_data_size, compressed_data, tile_header->compressed_data_size) == Z_OK;
+		status = uncompress (raw_data, &raw_data_size, compressed_data, tile_header->compressed_data_size) == Z_OK;
 #endif
 
-	if (!status) {
-	   roadmap_log (ROADMAP_ERROR, "data file open: uncompress failed");
-		free (raw_data);
-		return 0;
-	}
-	if (raw_data_size != tile_header->raw_data_size) {
-	   roadmap_log (ROADMAP_ERROR, "uncompressed data size mismatch: expecting %d found %d",
-	   				 tile_header->raw_data_size, raw_data_size);
-		free (raw_data);
-		return 0;
-	}
+		if (!status) {
+		   roadmap_log (ROADMAP_ERROR, "data file open: uncompress failed");
+			free (raw_data);
+			return 0;
+		}
+		if (raw_data_size != tile_header->raw_data_size) {
+		   roadmap_log (ROADMAP_ERROR, "uncompressed data size mismatch: expecting %d found %d",
+		   				 tile_header->raw_data_size, raw_data_size);
+			free (raw_data);
+			return 0;
+		}
 #endif
+	}
 
 	database->data.header = (roadmap_data_header *) raw_data;
 
@@ -365,6 +450,8 @@ static int roadmap_db_fill_data (roadmap_db_database *database, void *base, unsi
 
 static int add_db_and_map (roadmap_db_database *database) {
 
+   unsigned int bucket = roadmap_db_hash (database->fips, database->tile_index);
+
    if (RoadmapDatabaseFirst != NULL) {
       RoadmapDatabaseFirst->previous = database;
    }
@@ -372,6 +459,9 @@ static int add_db_and_map (roadmap_db_database *database) {
    database->previous   = NULL;
    RoadmapDatabaseFirst = database;
 
+   database->next_hash  = RoadmapDatabaseHash[bucket];
+   RoadmapDatabaseHash[bucket] = database;
+
    if (! roadmap_db_call_map  (database)) {
       roadmap_db_close_database (database);
       return 0;
@@ -383,49 +473,130 @@ static int add_db_and_map (roadmap_db_database *database) {
 }
 
 
-int roadmap_db_open (int fips, int tile_index, roadmap_db_model *model,
-                     const char* mode) {
+/* Reads the tile from the storage; returns 0 if it is missing or invalid */
+static int roadmap_db_read_tile (roadmap_db_database *database) {
 
+   int fips = database->fips;
+   int tile_index = database->tile_index;
    void *base = NULL;
    size_t size = 0;
+#ifdef ROADMAP_TILE_MAPPING
+   RoadMapFileContext file;
+#endif
 
-   roadmap_db_database *database = roadmap_db_find (fips, tile_index);
-
-   if (database) {
-
-      roadmap_db_call_activate (database);
-      return 1; /* Already open. */
+#ifdef ROADMAP_TILE_MAPPING
+   /* stored tiles are mapped, and read where they can't be */
+   if (roadmap_tile_map(fips, tile_index, &base, &size, &file) != 0) {
+      file = NULL;
+      if (roadmap_tile_load(fips, tile_index, &base, &size) != 0) {
+         return 0;
+      }
    }
-
+#else
    if (roadmap_tile_load(fips, tile_index, &base, &size) != 0) {
-
       return 0;
    }
+#endif
 
    roadmap_log (ROADMAP_INFO, "Opening database file fips:%d, index:%d", fips, tile_index);
-   database = malloc(sizeof(*database));
-   roadmap_check_allocated(database);
-
-   database->fips = fips;
-   database->tile_index = tile_index;
 
-	if (!roadmap_db_fill_data (database, base, (unsigned int) size)) {
+	if (!roadmap_db_fill_data (database, base, (unsigned int) size, ROADMAP_DB_IN_PLACE)) {
 
 	   roadmap_log (ROADMAP_INFO, "tile %d (fips %d) has invalid format", tile_index, fips);
+#ifdef ROADMAP_TILE_MAPPING
+	   if (file) roadmap_file_unmap (&file);
+	   else free (base);
+#else
 	   free (base);
-      free (database);
+#endif
       roadmap_tile_remove (fips, tile_index);
       return 0;
 	}
 
-#ifndef NO_MAP_COMPRESSION
+#ifdef ROADMAP_TILE_MAPPING
+   /* uncompressed tiles are used in place and stay mapped or allocated */
+   if ((unsigned char *)database->data.header == (unsigned char *)base + ROADMAP_TILE_RAW_DATA_OFFSET) {
+      database->file = file;
+      database->buffer = file ? NULL : base;
+   } else {
+      database->file = NULL;
+      database->buffer = NULL;
+      if (file) roadmap_file_unmap (&file);
+      else free (base);
+   }
+#elif !defined (NO_MAP_COMPRESSION)
    // we use the base pointer as there's no compression.
    free(base);
 #endif
 
-   database->model = model;
+   return 1;
+}
+
+
+/* Reads the tile from a memory copy, which the caller keeps */
+static int roadmap_db_read_mem (roadmap_db_database *database, void *data, size_t size) {
+
+#ifdef NO_MAP_COMPRESSION
+   {
+      void *orig = data;
+      data = malloc(size);
+      memcpy(data, orig, size);
+   }
+#endif
+
+#ifdef ROADMAP_TILE_MAPPING
+   database->file = NULL;
+   database->buffer = NULL;
+#endif
+
+	if (!roadmap_db_fill_data (database, data, (unsigned int) size, 0)) {
+
+	   roadmap_log (ROADMAP_INFO, "tile mem for index:%d (fips %d) has invalid format",
+	   				 database->tile_index, database->fips);
+#ifdef NO_MAP_COMPRESSION
+      free(data);
+#endif
+      return 0;
+	}
+
+   return 1;
+}
+
+
+static roadmap_db_database *roadmap_db_new (int fips, int tile_index) {
+
+   roadmap_db_database *database = malloc(sizeof(*database));
+   roadmap_check_allocated(database);
+
+   database->fips = fips;
+   database->tile_index = tile_index;
+   database->model = NULL;
    database->context = NULL;
 
+   return database;
+}
+
+
+int roadmap_db_open (int fips, int tile_index, roadmap_db_model *model,
+                     const char* mode) {
+
+   roadmap_db_database *database = roadmap_db_find (fips, tile_index);
+
+   if (database) {
+
+      roadmap_db_call_activate (database);
+      return 1; /* Already open. */
+   }
+
+   database = roadmap_db_new (fips, tile_index);
+
+   if (!roadmap_db_read_tile (database)) {
+      free (database);
+      return 0;
+   }
+
+   database->model = model;
+
    return add_db_and_map(database);
 }
 
@@ -440,32 +611,121 @@ int roadmap_db_open_mem (int fips, int tile_index, roadmap_db_model *model,
       roadmap_db_close_database (database);
    }
 
-   database = malloc(sizeof(*database));
-   roadmap_check_allocated(database);
-
-   database->fips = fips;
-   database->tile_index = tile_index;
+   database = roadmap_db_new (fips, tile_index);
 
-#ifdef NO_MAP_COMPRESSION
-   {
-      void *orig = data;
-      data = malloc(size);
-      memcpy(data, orig, size);
+   if (!roadmap_db_read_mem (database, data, size)) {
+      free (database);
+      return 0;
    }
-#endif
 
-	if (!roadmap_db_fill_data (database, data, (unsigned int) size)) {
+   database->model = model;
 
-	   roadmap_log (ROADMAP_INFO, "tile mem for index:%d (fips %d) has invalid format", tile_index, fips);
-#ifdef NO_MAP_COMPRESSION
-      free(data);
+   return add_db_and_map(database);
+}
+
+
+typedef struct {
+
+   roadmap_db_prepared_cb callback;
+   void                   *context;
+} roadmap_db_prepare_request;
+
+
+/* Runs on the tile worker, so it only reads and checks the tile */
+static void roadmap_db_prepare_work (RoadMapTileJob *job) {
+
+   roadmap_db_database *database = roadmap_db_new (job->fips, job->tile_index);
+   int ok;
+
+   if (job->data) {
+
+      roadmap_tile_store (job->fips, job->tile_index, job->data, job->size);
+#ifdef ROADMAP_TILE_MAPPING
+      /* the storage keeps it uncompressed, so read it back rather than inflate it again */
+      ok = roadmap_db_read_tile (database) ||
+           roadmap_db_read_mem (database, job->data, job->size);
+#else
+      ok = roadmap_db_read_mem (database, job->data, job->size);
 #endif
+      free (job->data);
+      job->data = NULL;
+
+   } else {
+      ok = roadmap_db_read_tile (database);
+   }
+
+   if (!ok) {
       free (database);
-      return 0;
-	}
+      database = NULL;
+   }
+
+   job->result = database;
+}
+
+
+static void roadmap_db_prepare_done (RoadMapTileJob *job) {
+
+   roadmap_db_prepare_request *request = (roadmap_db_prepare_request *)job->context;
+
+   request->callback (job->fips, job->tile_index, job->result, request->context);
+   free (request);
+}
+
+
+void roadmap_db_prepare (int fips, int tile_index, void *data, size_t size,
+                         roadmap_db_prepared_cb callback, void *context) {
+
+   RoadMapTileJob job;
+   roadmap_db_prepare_request *request = malloc (sizeof (*request));
+   roadmap_check_allocated(request);
+
+   request->callback = callback;
+   request->context = context;
+
+   job.fips = fips;
+   job.tile_index = tile_index;
+   job.data = data;
+   job.size = size;
+   job.work = roadmap_db_prepare_work;
+   job.done = roadmap_db_prepare_done;
+   job.context = request;
+   job.result = NULL;
+   job.log_level = 0;
+
+   /* the map path is found on first use, which must not be on the worker */
+   roadmap_db_map_path ();
+
+   if (roadmap_tile_worker_post (&job) != 0) {
+      roadmap_db_prepare_work (&job);
+      roadmap_db_prepare_done (&job);
+   }
+}
+
+
+int roadmap_db_pending (int fips, int tile_index) {
+
+   return roadmap_tile_worker_pending (fips, tile_index);
+}
+
+
+void roadmap_db_discard_prepared (void *prepared) {
+
+   roadmap_db_free_data ((roadmap_db_database *)prepared);
+   free (prepared);
+}
+
+
+int roadmap_db_open_prepared (void *prepared, roadmap_db_model *model) {
+
+   roadmap_db_database *database = (roadmap_db_database *)prepared;
+
+   if (roadmap_db_find (database->fips, database->tile_index)) {
+      /* opened while it was prepared */
+      roadmap_db_discard_prepared (database);
+      return 1;
+   }
 
    database->model = model;
-   database->context = NULL;
 
    return add_db_and_map(database);
 }
@@ -520,6 +780,14 @@ int	roadmap_db_get_data (const roadmap_db_data_file *file,
 }
 
 
+unsigned int roadmap_db_data_size (const roadmap_db_data_file *file) {
+
+	if (file->header->num_sections == 0) return 0;
+
+	return file->index[file->header->num_sections - 1].end_offset;
+}
+
+
 int roadmap_db_close (int fips, int tile_index) {
 
    roadmap_db_database *database = roadmap_db_find (fips, tile_index);
@@ -544,12 +812,18 @@ void roadmap_db_end (void) {
    roadmap_db_database *database;
    roadmap_db_database *next;
 
+   roadmap_tile_worker_shutdown ();
+
    for (database = RoadmapDatabaseFirst; database != NULL; ) {
 
       next = database->next;
       roadmap_db_close_database (database);
       database = next;
    }
+
+#ifdef ROADMAP_TILE_ARCHIVE
+   roadmap_tile_archive_close ();
+#endif
 }
 
 const char *roadmap_db_map_path (void) {
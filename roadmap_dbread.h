@@ -74,6 +74,20 @@ int  roadmap_db_open (int fips, int tile_index, roadmap_db_model *model,
 int  roadmap_db_open_mem (int fips, int tile_index, roadmap_db_model *model,
                          void *data, size_t size);
 
+/* Reads and checks a tile in the background. The callback is called on the
+ * main thread with the prepared tile, or NULL if it could not be read, and
+ * must open or discard it. When data is given, it is a downloaded tile which
+ * is stored first; it is freed when done.
+ */
+typedef void (*roadmap_db_prepared_cb) (int fips, int tile_index, void *prepared, void *context);
+
+void roadmap_db_prepare (int fips, int tile_index, void *data, size_t size,
+                         roadmap_db_prepared_cb callback, void *context);
+int  roadmap_db_pending (int fips, int tile_index);
+
+int  roadmap_db_open_prepared (void *prepared, roadmap_db_model *model);
+void roadmap_db_discard_prepared (void *prepared);
+
 void roadmap_db_activate (int fips, int tile_index);
 
 int	roadmap_db_exists (const roadmap_db_data_file *file, const roadmap_db_sector *sector);
@@ -84,6 +98,16 @@ int	roadmap_db_get_data (const roadmap_db_data_file *file,
 									void 			 **data, 
 									int 			 *num_items);
 
+/* The size of the data of all sections, as used in memory */
+unsigned int roadmap_db_data_size (const roadmap_db_data_file *file);
+
+/* Called before a tile database is closed, whoever closes it; the caches
+ * which refer to the tile can drop it first.
+ */
+typedef void (*roadmap_db_evict_hook) (int fips, int tile_index);
+
+roadmap_db_evict_hook roadmap_db_set_evict_hook (roadmap_db_evict_hook hook);
+
 int  roadmap_db_close (int fips, int tile_index);
 void roadmap_db_remove (int fips, int tile_index);
 void roadmap_db_end   (void);
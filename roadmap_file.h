@@ -78,6 +78,7 @@ RoadMapFile roadmap_file_open  (const char *name, const char *mode);
 int   roadmap_file_read  (RoadMapFile file, void *data, int size);
 int   roadmap_file_write (RoadMapFile file, const void *data, int length);
 int   roadmap_file_seek  (RoadMapFile file, int offset, RoadMapSeekWhence whence); 
+int   roadmap_file_read_at (RoadMapFile file, int offset, void *data, int size);
 void  roadmap_file_close (RoadMapFile file);
 
 void  roadmap_file_remove (const char *path, const char *name);
@@ -98,7 +99,10 @@ int roadmap_file_truncate (const char *path, const char *name,
 FILE *roadmap_file_fopen (const char *path, const char *name, const char *mode);
 
 
-/* The following file operations hide the OS file mapping primitives. */
+/* The following file operations hide the OS file mapping primitives.
+ * The mode is "r" (read only), "w" (shared writes), or, on unix, "c"
+ * (private copy on write: writes are not saved to the file).
+ */
 
 struct RoadMapFileContextStructure;
 typedef struct RoadMapFileContextStructure *RoadMapFileContext;
@@ -109,6 +113,12 @@ const char *roadmap_file_map (const char *set,
                               const char *mode,
                               RoadMapFileContext *file);
 
+/* Maps size bytes of an open file from any offset; the mapping stays
+ * valid after the file is closed. Unix only.
+ */
+RoadMapFileContext roadmap_file_map_range (RoadMapFile file, int offset, int size,
+                                           const char *mode);
+
 void *roadmap_file_base (RoadMapFileContext file);
 int   roadmap_file_size (RoadMapFileContext file);
 
@@ -30,10 +30,18 @@
  *   void roadmap_hash_resize    (RoadMapHash *hash, int size);
  *
  *   void  roadmap_hash_summary (void);
- *   void  roadmap_hash_reset   (void);
  *
  * These functions are used to build a hash index. The idea is to
  * accelerate scanning a BuildMap table.
+ *
+ *   RoadMapHashMap *roadmap_hash_map_new (const char *name, int size);
+ *
+ *   int  roadmap_hash_map_get    (RoadMapHashMap *map, int key, int key2);
+ *   void roadmap_hash_map_set    (RoadMapHashMap *map, int key, int key2, int value);
+ *   int  roadmap_hash_map_remove (RoadMapHashMap *map, int key, int key2);
+ *
+ * These functions maintain a map with unique keys, for the lookups which
+ * run all the time (tiles, route search).
  */
 
 #include <stdio.h>
@@ -46,6 +54,7 @@
 
 
 static RoadMapHash *HashLast = NULL;
+static RoadMapHashMap *HashMapLast = NULL;
 
 
 RoadMapHash *roadmap_hash_new (const char *name, int size) {
@@ -222,10 +231,207 @@ void *roadmap_hash_get_value (RoadMapHash *hash, int index) {
 }
 
 
+static unsigned int roadmap_hash_map_home (const RoadMapHashMap *map, int key, int key2) {
+
+   unsigned int code = ((unsigned int)key * 2654435761U) ^
+                       ((unsigned int)key2 * 2246822519U);
+
+   return (code ^ (code >> 15)) & map->mask;
+}
+
+
+static void roadmap_hash_map_allocate (RoadMapHashMap *map, int size) {
+
+   map->entries = calloc (size, sizeof(RoadMapHashMapEntry));
+   roadmap_check_allocated(map->entries);
+
+   map->mask = size - 1;
+   map->count = 0;
+}
+
+
+RoadMapHashMap *roadmap_hash_map_new (const char *name, int size) {
+
+   int capacity = 16;
+   RoadMapHashMap *map = calloc (1, sizeof(RoadMapHashMap));
+
+   roadmap_check_allocated(map);
+
+   map->name = name;
+
+   while (capacity * 3 < size * 4) capacity *= 2;
+   roadmap_hash_map_allocate (map, capacity);
+
+	if (HashMapLast) {
+		HashMapLast->prev_map = map;
+	}
+   map->next_map = HashMapLast;
+   map->prev_map = NULL;
+   HashMapLast = map;
+
+   return map;
+}
+
+
+int roadmap_hash_map_get (RoadMapHashMap *map, int key, int key2) {
+
+   unsigned int i = roadmap_hash_map_home (map, key, key2);
+   int distance = 1;
+
+   map->count_get += 1;
+
+   for (;;) {
+
+      const RoadMapHashMapEntry *entry = map->entries + i;
+
+      /* Robin Hood: the key would have displaced a closer entry */
+      if (entry->distance < distance) return -1;
+
+      if (entry->key == key && entry->key2 == key2) return entry->value;
+
+      map->count_probe += 1;
+      i = (i + 1) & map->mask;
+      distance++;
+   }
+}
+
+
+static void roadmap_hash_map_insert (RoadMapHashMap *map, int key, int key2, int value) {
+
+   RoadMapHashMapEntry item;
+   unsigned int i = roadmap_hash_map_home (map, key, key2);
+
+   item.key = key;
+   item.key2 = key2;
+   item.value = value;
+   item.distance = 1;
+
+   for (;;) {
+
+      RoadMapHashMapEntry *entry = map->entries + i;
+
+      if (entry->distance == 0) {
+         *entry = item;
+         map->count++;
+         break;
+      }
+
+      if (entry->key == item.key && entry->key2 == item.key2) {
+         entry->value = item.value;
+         break;
+      }
+
+      if (entry->distance < item.distance) {
+         /* take the place of the entry which is closer to its home */
+         RoadMapHashMapEntry displaced = *entry;
+         *entry = item;
+         item = displaced;
+      }
+
+      i = (i + 1) & map->mask;
+      item.distance++;
+      if (item.distance > map->max_distance) map->max_distance = item.distance;
+   }
+}
+
+
+void roadmap_hash_map_set (RoadMapHashMap *map, int key, int key2, int value) {
+
+   if ((unsigned int)(map->count + 1) * 4 > (map->mask + 1) * 3) {
+
+      RoadMapHashMapEntry *old = map->entries;
+      unsigned int old_size = map->mask + 1;
+      unsigned int i;
+
+      roadmap_hash_map_allocate (map, old_size * 2);
+      map->count_grow += 1;
+
+      for (i = 0; i < old_size; i++) {
+         if (old[i].distance) {
+            roadmap_hash_map_insert (map, old[i].key, old[i].key2, old[i].value);
+         }
+      }
+      free (old);
+   }
+
+   roadmap_hash_map_insert (map, key, key2, value);
+}
+
+
+int roadmap_hash_map_remove (RoadMapHashMap *map, int key, int key2) {
+
+   unsigned int i = roadmap_hash_map_home (map, key, key2);
+   unsigned int next;
+   int distance = 1;
+
+   for (;;) {
+
+      RoadMapHashMapEntry *entry = map->entries + i;
+
+      if (entry->distance < distance) return 0;
+      if (entry->key == key && entry->key2 == key2) break;
+
+      i = (i + 1) & map->mask;
+      distance++;
+   }
+
+   /* shift the following entries back, so no tombstone is needed */
+   for (next = (i + 1) & map->mask;
+        map->entries[next].distance > 1;
+        i = next, next = (next + 1) & map->mask) {
+
+      map->entries[i] = map->entries[next];
+      map->entries[i].distance--;
+   }
+
+   map->entries[i].distance = 0;
+   map->count--;
+
+   return 1;
+}
+
+
+/* Empties the map, keeping its memory for the next use. */
+void roadmap_hash_map_reset (RoadMapHashMap *map) {
+
+   if (map->count == 0) return;
+
+   memset (map->entries, 0, (map->mask + 1) * sizeof(RoadMapHashMapEntry));
+   map->count = 0;
+}
+
+
+int roadmap_hash_map_memory (const RoadMapHashMap *map) {
+
+   return (int)((map->mask + 1) * sizeof(RoadMapHashMapEntry));
+}
+
+
+void roadmap_hash_map_free (RoadMapHashMap *map) {
+
+	RoadMapHashMap *prev = map->prev_map;
+	RoadMapHashMap *next = map->next_map;
+
+	if (map == HashMapLast) {
+		HashMapLast = map->next_map;
+	}
+	if (prev) {
+		prev->next_map = next;
+	}
+	if (next) {
+		next->prev_map = prev;
+	}
+
+   free (map->entries);
+   free (map);
+}
+
+
 #ifndef J2ME
 void  roadmap_hash_summary (void) {
 
    RoadMapHash *hash;
+   RoadMapHashMap *map;
 
    for (hash = HashLast; hash != NULL; hash = hash->next_hash) {
 
@@ -254,6 +460,26 @@ void  roadmap_hash_summary (void) {
       }
       fprintf (stderr, "\n");
    }
+
+   for (map = HashMapLast; map != NULL; map = map->next_map) {
+
+      fprintf (stderr, "-- hash map %s:", map->name);
+
+      fprintf (stderr,
+               "\n--      %d items, %u entries, %d grown, %d max distance",
+               map->count, map->mask + 1, map->count_grow, map->max_distance);
+
+      fprintf (stderr,
+               "\n--      %d get, %d probes",
+               map->count_get, map->count_probe);
+      if (map->count_get > 0) {
+         fprintf (stderr,
+                  " (%d.%02d probes/search)",
+                  map->count_probe / map->count_get,
+                  (map->count_probe % map->count_get) * 100 / map->count_get);
+      }
+      fprintf (stderr, "\n");
+   }
 }
 
 #endif
@@ -67,6 +67,52 @@ void roadmap_hash_free (RoadMapHash *hash);
 void  roadmap_hash_set_value (RoadMapHash *hash, int index, void *value);
 void *roadmap_hash_get_value (RoadMapHash *hash, int index);
 
+
+/* An open addressing map (Robin Hood hashing) from a pair of ints to an
+ * int, with the keys and values stored inline: a lookup reads one or two
+ * cache lines. Its size is a power of 2, doubled when it is 3/4 full.
+ */
+typedef struct {
+
+   int key;
+   int key2;
+   int value;
+   int distance;   /* 0 for an empty entry, else 1 + distance from home */
+} RoadMapHashMapEntry;
+
+struct roadmap_hash_map_struct {
+
+   const char *name;
+
+   struct roadmap_hash_map_struct *next_map;
+   struct roadmap_hash_map_struct *prev_map;
+
+   RoadMapHashMapEntry *entries;
+   unsigned int         mask;
+   int                  count;
+
+   /* Statistics: */
+   int count_get;
+   int count_probe;
+   int count_grow;
+   int max_distance;
+};
+
+typedef struct roadmap_hash_map_struct RoadMapHashMap;
+
+
+RoadMapHashMap *roadmap_hash_map_new (const char *name, int size);
+
+/* Returns -1 when the key is not in the map */
+int  roadmap_hash_map_get    (RoadMapHashMap *map, int key, int key2);
+/* Replaces the value if the key is already in the map */
+void roadmap_hash_map_set    (RoadMapHashMap *map, int key, int key2, int value);
+int  roadmap_hash_map_remove (RoadMapHashMap *map, int key, int key2);
+void roadmap_hash_map_reset  (RoadMapHashMap *map);
+int  roadmap_hash_map_memory (const RoadMapHashMap *map);
+
+void roadmap_hash_map_free (RoadMapHashMap *map);
+
 void  roadmap_hash_summary (void);
 
 int roadmap_hash_string (const char *str);
@@ -34,7 +34,10 @@
 #include "roadmap_net.h"
 #include "roadmap_file.h"
 #include "roadmap_main.h"
+#include "roadmap_start.h"
 
+#include "websvc_trans/websvc_address.h"
+#include "websvc_trans/web_date_format.h"
 #include "editor/editor_main.h"
 #include "roadmap_httpcopy_async.h"
 
@@ -45,6 +48,15 @@
 #define ROADMAP_HTTP_MAX_CHUNK 4096
 #endif
 
+/* Requests made with roadmap_http_async_get share a few kept alive
+ * connections, each carrying up to HTTP_POOL_PIPELINE requests that were
+ * sent before the previous responses arrived.
+ */
+#define HTTP_POOL_SIZE        2
+#define HTTP_POOL_PIPELINE    4
+
+struct HttpPoolConnection_st;
+
 struct HttpAsyncContext_st {
 	RoadMapHttpAsyncCallbacks *callbacks;
 	void *cb_context;
@@ -54,8 +66,72 @@ struct HttpAsyncContext_st {
 	int is_parsing_headers;
 	char header_buffer[256];
 	RoadMapIO io;
+
+	/* pooled requests only */
+	struct HttpPoolConnection_st *connection;
+	HttpAsyncContext *next;
+	char server[WSA_SERVER_URL_MAXSIZE + 1];
+	int port;
+	char *request;
+	int sent;
+	int retried;
+};
+
+enum {
+   pool_Idle,
+   pool_Connecting,
+   pool_Connected
+};
+
+/* where a chunked body is */
+enum {
+   chunk_Size,
+   chunk_Data,
+   chunk_DataEnd,
+   chunk_Trailer
 };
 
+typedef struct HttpPoolConnection_st {
+
+   int               state;
+   unsigned int      serial;     /* changes whenever the connection is closed */
+   char              server[WSA_SERVER_URL_MAXSIZE + 1];
+   int               port;
+   RoadMapIO         io;
+
+   HttpAsyncContext  *requests;  /* sent and not answered yet, in order */
+   int               count;
+   int               responses;  /* received on this connection */
+   int               closing;    /* the server will close it, send nothing more */
+
+   /* the response being received */
+   HttpAsyncContext  *current;
+   int               is_parsing_headers;
+   int               status;
+   int               content_length;
+   int               received;
+   int               keep_alive;
+   int               line_size;
+   char              line[256];
+
+   /* a chunked body is kept until its end, as its size is not known before */
+   int               chunked;
+   int               chunk_state;
+   int               chunk_left;
+   char              *body;
+   int               body_size;
+   int               body_alloc;
+} HttpPoolConnection;
+
+static HttpPoolConnection HttpPool[HTTP_POOL_SIZE];
+
+/* The request being made by roadmap_http_async_get; cleared if it fails,
+ * and is freed, before roadmap_http_async_get returns.
+ */
+static HttpAsyncContext *PoolStarting;
+
+static int pool_dispatch (HttpAsyncContext *request);
+
 static int roadmap_http_async_decode_header (HttpAsyncContext *context,
 															char *buffer,
                               		         int  sizeof_buffer) {
@@ -259,6 +335,7 @@ HttpAsyncContext * roadmap_http_async_copy (RoadMapHttpAsyncCallbacks *callbacks
 	hcontext->callbacks = callbacks;
 	hcontext->cb_context = context;
 	hcontext->io.os.socket = ROADMAP_INVALID_SOCKET;
+	hcontext->connection = NULL;
 
    if (roadmap_net_connect_async("http_get", source, update_time, 80,
             roadmap_http_async_connect_cb, hcontext) == -1) {
@@ -271,8 +348,710 @@ HttpAsyncContext * roadmap_http_async_copy (RoadMapHttpAsyncCallbacks *callbacks
 }
 
 
+static void pool_free_request (HttpAsyncContext *request) {
+
+   if (request == PoolStarting) PoolStarting = NULL;
+
+   free (request->request);
+   free (request);
+}
+
+
+static void pool_fail (HttpAsyncContext *request, const char *message) {
+
+   request->callbacks->error (request->cb_context, 1, message);
+   pool_free_request (request);
+}
+
+
+static void pool_response_reset (HttpPoolConnection *conn) {
+
+   conn->current = NULL;
+   conn->is_parsing_headers = 1;
+   conn->status = 0;
+   conn->content_length = -1;
+   conn->received = 0;
+   conn->keep_alive = 1;
+   conn->line_size = 0;
+   conn->chunked = 0;
+   conn->chunk_state = chunk_Size;
+   conn->chunk_left = 0;
+
+   if (conn->body) {
+      free (conn->body);
+      conn->body = NULL;
+   }
+   conn->body_size = 0;
+   conn->body_alloc = 0;
+}
+
+
+/* Closes the connection and moves its requests to other connections. When
+ * the connection was lost, requests that were sent on a reused connection
+ * are tried once more (the server may have closed it while they were on
+ * the way); a response which was partly received always fails.
+ */
+static void pool_release (HttpPoolConnection *conn, int lost) {
+
+   HttpAsyncContext *pending = conn->requests;
+   HttpAsyncContext *current = conn->current;
+   int reused = conn->responses > 0;
+
+   if (conn->state == pool_Connected) {
+      roadmap_main_remove_input (&conn->io);
+      roadmap_io_close (&conn->io);
+   }
+
+   conn->state = pool_Idle;
+   conn->serial++;
+   conn->requests = NULL;
+   conn->count = 0;
+   conn->responses = 0;
+   conn->closing = 0;
+   pool_response_reset (conn);
+
+   if (current) {
+      current->connection = NULL;
+      pool_fail (current, "Connection to server lost.");
+   }
+
+   while (pending) {
+
+      HttpAsyncContext *request = pending;
+      pending = request->next;
+
+      request->next = NULL;
+      request->connection = NULL;
+
+      if (lost && request->sent) {
+         if (!reused || request->retried) {
+            pool_fail (request, "Connection to server lost.");
+            continue;
+         }
+         request->retried = 1;
+      }
+
+      if (pool_dispatch (request) == -1) {
+         pool_fail (request, "Can't create http connection.");
+      }
+   }
+}
+
+
+static int pool_send (HttpPoolConnection *conn, HttpAsyncContext *request) {
+
+   if (roadmap_io_write (&conn->io, request->request,
+                         (int)strlen (request->request), 1) == -1) {
+      return -1;
+   }
+
+   request->sent = 1;
+   request->callbacks->progress (request->cb_context, NULL, 0);
+
+   return 0;
+}
+
+
+static void pool_response_done (HttpPoolConnection *conn) {
+
+   HttpAsyncContext *request = conn->current;
+
+   conn->responses++;
+   if (!conn->keep_alive) conn->closing = 1;
+   pool_response_reset (conn);
+
+   if (conn->closing) {
+      /* the requests which are left are sent again elsewhere */
+      pool_release (conn, 0);
+   }
+
+   if (request) {
+      request->connection = NULL;
+      if (request->download_size_current > request->content_length) {
+         roadmap_log (ROADMAP_ERROR, "Too many bytes for http download (%d/%d)",
+                      request->download_size_current, request->content_length);
+      }
+      request->callbacks->done (request->cb_context);
+      pool_free_request (request);
+   }
+}
+
+
+static void pool_status_line (HttpPoolConnection *conn, const char *line) {
+
+   HttpAsyncContext *request = conn->requests;
+   const char *p = strchr (line, ' ');
+
+   if (strncmp (line, "HTTP/", 5) || p == NULL || request == NULL) {
+      roadmap_log (ROADMAP_ERROR, "Unexpected http response: %s", line);
+      pool_release (conn, 1);
+      return;
+   }
+
+   conn->requests = request->next;
+   conn->count--;
+   request->next = NULL;
+
+   conn->status = atoi (p + 1);
+   if (strncmp (line, "HTTP/1.0", 8) == 0) conn->keep_alive = 0;
+
+   if (conn->status == 200) {
+      conn->current = request;
+   } else {
+      /* the body, if any, is skipped */
+      request->connection = NULL;
+      request->callbacks->error (request->cb_context, 0, "received bad status: %s", line);
+      pool_free_request (request);
+   }
+}
+
+
+static void pool_headers_done (HttpPoolConnection *conn) {
+
+   HttpAsyncContext *request = conn->current;
+   unsigned int serial = conn->serial;
+
+   if (conn->chunked && conn->status != 304 && conn->status != 204) {
+      /* the size is known at the end of the body, see pool_chunked_done */
+      conn->is_parsing_headers = 0;
+      conn->chunk_state = chunk_Size;
+      return;
+   }
+
+   if (conn->content_length < 0) {
+
+      if (conn->status == 304 || conn->status == 204) {
+         conn->content_length = 0;
+      } else if (request) {
+         /* the body ends when the connection is closed, which we don't use */
+         conn->current = NULL;
+         request->connection = NULL;
+         request->callbacks->error (request->cb_context, 0, "bad formed header: no length");
+         pool_free_request (request);
+         pool_release (conn, 0);
+         return;
+      } else {
+         pool_release (conn, 0);
+         return;
+      }
+   }
+
+   conn->is_parsing_headers = 0;
+
+   if (request) {
+      request->content_length = conn->content_length;
+      request->download_size_current = 0;
+
+      if (conn->content_length <= 0) {
+         conn->current = NULL;
+         request->connection = NULL;
+         request->callbacks->error (request->cb_context, 0, "bad formed header: empty content");
+         pool_free_request (request);
+      } else if (!request->callbacks->size (request->cb_context, conn->content_length)) {
+         /* not wanted any more, the body is skipped */
+         conn->current = NULL;
+         request->connection = NULL;
+         pool_free_request (request);
+      }
+   }
+
+   if (conn->content_length == 0 && conn->serial == serial) {
+      pool_response_done (conn);
+   }
+}
+
+
+static void pool_header_line (HttpPoolConnection *conn, char *line) {
+
+   char *p;
+
+   if (!conn->status) {
+      if (*line) pool_status_line (conn, line);
+      return;
+   }
+
+   if (!*line) {
+      pool_headers_done (conn);
+      return;
+   }
+
+   p = strchr (line, ':');
+   if (p == NULL) return;
+
+   while (*(++p) == ' ') ;
+
+   if (strncasecmp (line, "Content-Length", sizeof("Content-Length")-1) == 0) {
+      conn->content_length = atoi (p);
+   } else if (strncasecmp (line, "Transfer-Encoding", sizeof("Transfer-Encoding")-1) == 0) {
+      /* chunked is the last coding, we ask for no other */
+      if (strstr (p, "chunked") != NULL) conn->chunked = 1;
+   } else if (strncasecmp (line, "Connection", sizeof("Connection")-1) == 0) {
+      if (strncasecmp (p, "close", 5) == 0) {
+         conn->keep_alive = 0;
+      } else if (strncasecmp (p, "keep-alive", 10) == 0) {
+         conn->keep_alive = 1;
+      }
+   }
+}
+
+
+/* Adds the start of the data to the line being received; returns how much
+ * was used, and sets complete when the line ended.
+ */
+static int pool_read_line (HttpPoolConnection *conn, char *data, int size, int *complete) {
+
+   char *end = memchr (data, '\n', size);
+   int used = end ? (int)(end - data) + 1 : size;
+   int copy = used;
+
+   if (copy > (int)sizeof (conn->line) - 1 - conn->line_size) {
+      /* only the start of long lines matters */
+      copy = (int)sizeof (conn->line) - 1 - conn->line_size;
+   }
+   memcpy (conn->line + conn->line_size, data, copy);
+   conn->line_size += copy;
+
+   *complete = end != NULL;
+
+   if (end) {
+      while (conn->line_size > 0 &&
+             (conn->line[conn->line_size - 1] == '\n' ||
+              conn->line[conn->line_size - 1] == '\r')) {
+         conn->line_size--;
+      }
+      conn->line[conn->line_size] = '\0';
+      conn->line_size = 0;
+   }
+
+   return used;
+}
+
+
+/* The whole chunked body was received: it is passed on as one piece */
+static void pool_chunked_done (HttpPoolConnection *conn) {
+
+   HttpAsyncContext *request = conn->current;
+   unsigned int serial = conn->serial;
+   char *body = conn->body;
+   int size = conn->body_size;
+
+   conn->body = NULL;
+   conn->body_size = 0;
+   conn->body_alloc = 0;
+
+   if (request) {
+      request->content_length = size;
+      request->download_size_current = 0;
+
+      if (size <= 0) {
+         conn->current = NULL;
+         request->connection = NULL;
+         request->callbacks->error (request->cb_context, 0, "bad formed header: empty content");
+         pool_free_request (request);
+      } else if (!request->callbacks->size (request->cb_context, size)) {
+         conn->current = NULL;
+         request->connection = NULL;
+         pool_free_request (request);
+      } else {
+         request->download_size_current = size;
+         request->callbacks->progress (request->cb_context, body, size);
+      }
+   }
+
+   free (body);
+
+   if (conn->serial == serial) {
+      pool_response_done (conn);
+   }
+}
+
+
+/* Consumes the start of a chunked body */
+static int pool_receive_chunked (HttpPoolConnection *conn, char *data, int size) {
+
+   int used;
+   int complete;
+   char *end;
+   long chunk_size;
+   unsigned int serial;
+
+   switch (conn->chunk_state) {
+
+   case chunk_Size:
+
+      used = pool_read_line (conn, data, size, &complete);
+      if (!complete) return used;
+
+      /* chunk extensions after the size are ignored */
+      chunk_size = strtol (conn->line, &end, 16);
+      if (end == conn->line || chunk_size < 0 || chunk_size > 0x7fffffff - conn->body_size) {
+         roadmap_log (ROADMAP_ERROR, "Bad http chunk size: %s", conn->line);
+         pool_release (conn, 1);
+         return used;
+      }
+
+      if (chunk_size == 0) {
+         conn->chunk_state = chunk_Trailer;
+      } else {
+         conn->chunk_left = (int)chunk_size;
+         conn->chunk_state = chunk_Data;
+      }
+      return used;
+
+   case chunk_Data:
+
+      used = conn->chunk_left;
+      if (used > size) used = size;
+
+      if (conn->current) {
+         if (conn->body_size + used > conn->body_alloc) {
+            conn->body_alloc = conn->body_size + used + ROADMAP_HTTP_MAX_CHUNK;
+            conn->body = realloc (conn->body, conn->body_alloc);
+            roadmap_check_allocated (conn->body);
+         }
+         memcpy (conn->body + conn->body_size, data, used);
+         conn->body_size += used;
+
+         /* nothing to pass on yet, but the request is alive */
+         serial = conn->serial;
+         conn->current->callbacks->progress (conn->current->cb_context, NULL, 0);
+         if (conn->serial != serial) return used;
+      }
+
+      conn->chunk_left -= used;
+      if (conn->chunk_left == 0) conn->chunk_state = chunk_DataEnd;
+      return used;
+
+   case chunk_DataEnd:
+
+      used = pool_read_line (conn, data, size, &complete);
+      if (complete) conn->chunk_state = chunk_Size;
+      return used;
+
+   default:
+
+      /* the trailer headers end with an empty line */
+      used = pool_read_line (conn, data, size, &complete);
+      if (complete && !conn->line[0]) pool_chunked_done (conn);
+      return used;
+   }
+}
+
+
+/* Consumes the start of the data: one header line, or body bytes */
+static int pool_receive (HttpPoolConnection *conn, char *data, int size) {
+
+   int used;
+
+   if (conn->is_parsing_headers) {
+
+      int complete;
+
+      used = pool_read_line (conn, data, size, &complete);
+      if (complete) pool_header_line (conn, conn->line);
+
+      return used;
+   }
+
+   if (conn->chunked) {
+      return pool_receive_chunked (conn, data, size);
+   }
+
+   used = conn->content_length - conn->received;
+   if (used > size) used = size;
+   conn->received += used;
+
+   if (conn->current) {
+      unsigned int serial = conn->serial;
+
+      conn->current->download_size_current += used;
+      conn->current->callbacks->progress (conn->current->cb_context, data, used);
+      if (conn->serial != serial) return used;
+   }
+
+   if (conn->received >= conn->content_length) {
+      pool_response_done (conn);
+   }
+
+   return used;
+}
+
+
+static void pool_has_data_cb (RoadMapIO *io) {
+
+   HttpPoolConnection *conn = (HttpPoolConnection *)io->context;
+   unsigned int serial = conn->serial;
+   char buffer[ROADMAP_HTTP_MAX_CHUNK];
+   char *data = buffer;
+   int size;
+
+   size = roadmap_io_read (io, buffer, sizeof (buffer));
+
+   if (size <= 0) {
+      /* closed by the server; quietly so when it was idle */
+      pool_release (conn, 1);
+      return;
+   }
+
+   while (size > 0) {
+
+      int used;
+
+      if (conn->requests == NULL && conn->current == NULL &&
+          conn->is_parsing_headers && !conn->status) {
+         roadmap_log (ROADMAP_ERROR, "Unexpected http data on an idle connection");
+         pool_release (conn, 1);
+         return;
+      }
+
+      used = pool_receive (conn, data, size);
+
+      /* the callbacks may have closed the connection */
+      if (conn->serial != serial) return;
+
+      data += used;
+      size -= used;
+   }
+}
+
+
+static void pool_connect_cb (RoadMapSocket socket, void *context, roadmap_result err) {
+
+   HttpPoolConnection *conn = (HttpPoolConnection *)context;
+   HttpAsyncContext *request;
+   unsigned int serial;
+
+   if (!ROADMAP_NET_IS_VALID(socket)) {
+
+      HttpAsyncContext *pending = conn->requests;
+
+      conn->state = pool_Idle;
+      conn->serial++;
+      conn->requests = NULL;
+      conn->count = 0;
+
+      while (pending) {
+         request = pending;
+         pending = request->next;
+         request->connection = NULL;
+         pool_fail (request, "Can't connect to server.");
+      }
+      return;
+   }
+
+   conn->io.subsystem = ROADMAP_IO_NET;
+   conn->io.context = conn;
+   conn->io.os.socket = socket;
+   conn->state = pool_Connected;
+   pool_response_reset (conn);
+
+   roadmap_main_set_input (&conn->io, pool_has_data_cb);
+
+   serial = conn->serial;
+   for (request = conn->requests; request != NULL; request = request->next) {
+
+      if (pool_send (conn, request) == -1) {
+         pool_release (conn, 1);
+         return;
+      }
+      if (conn->serial != serial) return;
+   }
+}
+
+
+/* Picks a connection to the server of the request: the least loaded open
+ * one, unless it is busy and a new connection can be opened.
+ */
+static HttpPoolConnection *pool_find (const HttpAsyncContext *request) {
+
+   HttpPoolConnection *idle = NULL;
+   HttpPoolConnection *best = NULL;
+   int i;
+
+   for (i = 0; i < HTTP_POOL_SIZE; i++) {
+
+      HttpPoolConnection *conn = HttpPool + i;
+
+      if (conn->state == pool_Idle) {
+         if (idle == NULL) idle = conn;
+         continue;
+      }
+
+      if (conn->closing ||
+          conn->count >= HTTP_POOL_PIPELINE ||
+          conn->port != request->port ||
+          strcmp (conn->server, request->server)) {
+         continue;
+      }
+
+      if (best == NULL || conn->count < best->count) best = conn;
+   }
+
+   if (best != NULL && (best->count == 0 || idle == NULL)) return best;
+
+   return idle;
+}
+
+
+static int pool_dispatch (HttpAsyncContext *request) {
+
+   HttpPoolConnection *conn = pool_find (request);
+   HttpAsyncContext **last;
+
+   if (conn == NULL) return -1;
+
+   request->sent = 0;
+   request->next = NULL;
+   request->connection = conn;
+
+   if (conn->state == pool_Idle) {
+
+      strncpy_safe (conn->server, request->server, sizeof (conn->server));
+      conn->port = request->port;
+      conn->requests = request;
+      conn->count = 1;
+      conn->responses = 0;
+      conn->closing = 0;
+      conn->state = pool_Connecting;
+
+      if (roadmap_net_connect_async ("tcp", conn->server, 0, conn->port,
+                                     pool_connect_cb, conn) == -1) {
+         conn->state = pool_Idle;
+         conn->requests = NULL;
+         conn->count = 0;
+         request->connection = NULL;
+         return -1;
+      }
+
+      return 0;
+   }
+
+   for (last = &conn->requests; *last != NULL; last = &(*last)->next) ;
+   *last = request;
+   conn->count++;
+
+   if (conn->state == pool_Connected && pool_send (conn, request) == -1) {
+
+      /* the connection is lost: the request goes with the others */
+      pool_release (conn, 1);
+   }
+
+   return 0;
+}
+
+
+static void pool_abort (HttpAsyncContext *request) {
+
+   HttpPoolConnection *conn = request->connection;
+   HttpAsyncContext **link;
+
+   if (conn->current == request) {
+      conn->current = NULL;
+      pool_free_request (request);
+      pool_release (conn, 0);
+      return;
+   }
+
+   for (link = &conn->requests; *link != NULL; link = &(*link)->next) {
+      if (*link == request) {
+         *link = request->next;
+         conn->count--;
+         break;
+      }
+   }
+
+   if (request->sent) {
+      /* its response is still coming: the connection can't be used */
+      pool_free_request (request);
+      pool_release (conn, 0);
+   } else {
+      pool_free_request (request);
+   }
+}
+
+
+HttpAsyncContext *roadmap_http_async_get (RoadMapHttpAsyncCallbacks *callbacks,
+                                          void *context,
+                                          const char *source,
+                                          time_t update_time) {
+
+   HttpAsyncContext *hcontext;
+   char service[WSA_SERVICE_NAME_MAXSIZE + 1];
+   char update_since[WDF_MODIFIED_HEADER_SIZE + 1];
+   char host[WSA_SERVER_URL_MAXSIZE + 16];
+   char packet[WSA_SERVICE_NAME_MAXSIZE + WSA_SERVER_URL_MAXSIZE + WDF_MODIFIED_HEADER_SIZE + 128];
+
+#ifdef IPHONE
+   /* the pool does not go through the proxy */
+   if (roadmap_main_get_proxy (source) != NULL) {
+      return roadmap_http_async_copy (callbacks, context, source, update_time);
+   }
+#endif
+
+   hcontext = calloc (1, sizeof (HttpAsyncContext));
+   roadmap_check_allocated (hcontext);
+
+   hcontext->callbacks = callbacks;
+   hcontext->cb_context = context;
+   hcontext->io.os.socket = ROADMAP_INVALID_SOCKET;
+
+   if (!WSA_ExtractParams (source, hcontext->server, &hcontext->port, service)) {
+      roadmap_log (ROADMAP_ERROR, "Bad http address '%s'", source);
+      callbacks->error (context, 1, "Can't create http connection.");
+      free (hcontext);
+      return NULL;
+   }
+
+   if (pool_find (hcontext) == NULL) {
+      /* all the connections are busy with another server */
+      free (hcontext);
+      return roadmap_http_async_copy (callbacks, context, source, update_time);
+   }
+
+   if (hcontext->port == 80) {
+      snprintf (host, sizeof (host), "%s", hcontext->server);
+   } else {
+      snprintf (host, sizeof (host), "%s:%d", hcontext->server, hcontext->port);
+   }
+
+   WDF_FormatHttpIfModifiedSince (update_time, update_since);
+   snprintf (packet, sizeof (packet),
+             "GET %s HTTP/1.1\r\n"
+             "Host: %s\r\n"
+             "User-Agent: FreeMap/%s\r\n"
+             "%s"
+             "Connection: keep-alive\r\n"
+             "\r\n",
+             service, host, roadmap_start_version (), update_since);
+
+   hcontext->request = strdup (packet);
+   roadmap_check_allocated (hcontext->request);
+
+   PoolStarting = hcontext;
+
+   if (pool_dispatch (hcontext) == -1) {
+      callbacks->error (context, 1, "Can't create http connection.");
+      pool_free_request (hcontext);
+      return NULL;
+   }
+
+   if (PoolStarting == NULL) {
+      /* its connection was lost while it was sent, and it failed */
+      return NULL;
+   }
+   PoolStarting = NULL;
+
+   return hcontext;
+}
+
+
 void roadmap_http_async_copy_abort (HttpAsyncContext *context) {
 
+   if (context->connection != NULL) {
+      pool_abort (context);
+      return;
+   }
+
 	if (ROADMAP_NET_IS_VALID(context->io.os.socket)) {
 	   roadmap_main_remove_input(&context->io);
 	   roadmap_io_close (&context->io);
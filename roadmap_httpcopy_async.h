@@ -46,6 +46,14 @@ HttpAsyncContext *roadmap_http_async_copy (RoadMapHttpAsyncCallbacks *callbacks,
 									  void *context,
                              const char *source,
                              time_t update_time);
+/* Same as roadmap_http_async_copy, for small requests that come in bursts:
+ * the request goes over a kept alive HTTP/1.1 connection to the server,
+ * possibly behind other requests that were not answered yet.
+ */
+HttpAsyncContext *roadmap_http_async_get (RoadMapHttpAsyncCallbacks *callbacks,
+                                          void *context,
+                                          const char *source,
+                                          time_t update_time);
 void	roadmap_http_async_copy_abort (HttpAsyncContext *context);
 
 
@@ -38,6 +38,9 @@
 
 static char *RoadMapLineSpeedType = "RoadMapLineSpeedContext";
 
+#define SPEED_TIME_SLOTS      48
+#define SPEED_SLOT_SECONDS    (30 * 60)
+
 typedef struct {
 
    char *type;
@@ -54,6 +57,9 @@ typedef struct {
    int                 *LineSpeedIndex;
    int                  LineSpeedIndexCount;
 
+   /* Speed of each speed_ref at each time slot, decoded on first use */
+   unsigned char       *LineSpeedTable;
+
 } RoadMapLineSpeedContext;
 
 static RoadMapLineSpeedContext *RoadMapLineSpeedActive = NULL;
@@ -131,6 +137,7 @@ static void roadmap_line_speed_unmap (void *context) {
    if (line_speed_context->type != RoadMapLineSpeedType) {
       roadmap_log (ROADMAP_FATAL, "unmapping invalid line speed context");
    }
+   free (line_speed_context->LineSpeedTable);
    free (line_speed_context);
 }
 
@@ -147,15 +154,30 @@ static int get_time_slot (time_t when) {
 #ifdef J2ME
    return 24;
 #else
-   int time_slot;
-   struct tm *t = localtime (&when);
+   static time_t slot_start = 0;
+   static int slot_index;
+   struct tm *t;
+
+   /* Routing asks for many times close to each other; only convert
+    * to local time when leaving the cached slot. The local time never
+    * jumps (daylight saving) inside a slot, only at its boundaries.
+    */
+   if (slot_start && (when >= slot_start) &&
+       (when < slot_start + SPEED_SLOT_SECONDS)) {
+
+      return slot_index;
+   }
+
+   t = localtime (&when);
+
+   slot_index = t->tm_hour * 2;
 
-   time_slot = t->tm_hour * 2;
+   if (t->tm_min >= 30) slot_index++;
 
-   if (t->tm_min >= 30) time_slot++;
+   slot_start = when - ((t->tm_min % 30) * 60 + t->tm_sec);
 
-   //time_slot = 18;
-   return time_slot;
+   //slot_index = 18;
+   return slot_index;
 #endif
 }
 
@@ -242,17 +264,11 @@ int roadmap_line_speed_get_avg (int speed_ref) {
 }
 
 
-int roadmap_line_speed_get (int speed_ref, int time_slot) {
+static int find_slot_speed (int speed_ref, int time_slot) {
 
    RoadMapLineSpeedRef *speed;
    int index;
 
-   if (RoadMapLineSpeedActive == NULL) return 0; /* No data. */
-   if (RoadMapLineSpeedActive->LineSpeedIndexCount <= speed_ref) {
-      roadmap_log (ROADMAP_ERROR, "Invalid speed_ref index:%d", speed_ref);
-      return 0;
-   }
-
    index = RoadMapLineSpeedActive->LineSpeedIndex[speed_ref];
    speed = &RoadMapLineSpeedActive->LineSpeedSlots[index];
 
@@ -266,6 +282,67 @@ int roadmap_line_speed_get (int speed_ref, int time_slot) {
 }
 
 
+static unsigned char *get_speed_table (void) {
+
+   unsigned char *table;
+   int speed_ref;
+
+   if (RoadMapLineSpeedActive->LineSpeedTable) {
+      return RoadMapLineSpeedActive->LineSpeedTable;
+   }
+
+   table = malloc (RoadMapLineSpeedActive->LineSpeedIndexCount * SPEED_TIME_SLOTS);
+   if (table == NULL) {
+      roadmap_log (ROADMAP_ERROR, "no more memory");
+      return NULL;
+   }
+
+   for (speed_ref = 0; speed_ref < RoadMapLineSpeedActive->LineSpeedIndexCount; speed_ref++) {
+
+      int index = RoadMapLineSpeedActive->LineSpeedIndex[speed_ref];
+      RoadMapLineSpeedRef *speed = &RoadMapLineSpeedActive->LineSpeedSlots[index];
+      unsigned char *slots = table + speed_ref * SPEED_TIME_SLOTS;
+      int time_slot;
+
+      /* same walk as find_slot_speed, resumed from slot to slot */
+      for (time_slot = 0; time_slot < SPEED_TIME_SLOTS; time_slot++) {
+
+         while (!(speed->time_slot & SPEED_EOL) &&
+            (((speed+1)->time_slot & ~SPEED_EOL) <= time_slot)) {
+
+            speed++;
+         }
+
+         slots[time_slot] = speed->speed;
+      }
+   }
+
+   RoadMapLineSpeedActive->LineSpeedTable = table;
+
+   return table;
+}
+
+
+int roadmap_line_speed_get (int speed_ref, int time_slot) {
+
+   unsigned char *table;
+
+   if (RoadMapLineSpeedActive == NULL) return 0; /* No data. */
+   if (RoadMapLineSpeedActive->LineSpeedIndexCount <= speed_ref) {
+      roadmap_log (ROADMAP_ERROR, "Invalid speed_ref index:%d", speed_ref);
+      return 0;
+   }
+
+   if ((time_slot < 0) || (time_slot >= SPEED_TIME_SLOTS) ||
+       ((table = get_speed_table ()) == NULL)) {
+
+      return find_slot_speed (speed_ref, time_slot);
+   }
+
+   return table[speed_ref * SPEED_TIME_SLOTS + time_slot];
+}
+
+
 int roadmap_line_speed_get_cross_times (int line,
                                         LineRouteTime *from,
                                         LineRouteTime *to) {
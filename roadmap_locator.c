@@ -494,6 +494,26 @@ int roadmap_locator_load_tile_mem (int index, void *data, size_t size) {
 }
 
 
+int roadmap_locator_load_tile_prepared (int fips, int index, void *prepared) {
+
+   if (prepared == NULL) {
+      return ROADMAP_US_NOMAP;
+   }
+
+   if (fips != RoadMapActiveCounty) {
+      roadmap_db_discard_prepared (prepared);
+      return ROADMAP_US_NOMAP;
+   }
+
+   if (! roadmap_db_open_prepared (prepared, RoadMapTileModel)) {
+
+      return ROADMAP_US_NOMAP;
+   }
+
+   return ROADMAP_US_OK;
+}
+
+
 int roadmap_locator_unload_tile (int index) {
 	
    if (RoadMapActiveCounty <= 0) {
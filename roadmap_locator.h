@@ -57,6 +57,10 @@ int  roadmap_locator_search_city (const char *str, RoadMapDictionaryCB cb,
 int roadmap_locator_static_county (void);
 int roadmap_locator_load_tile (int index);
 int roadmap_locator_load_tile_mem (int index, void *data, size_t size);
+/* Opens a tile prepared by roadmap_db_prepare, or discards it if the
+ * county is no longer active.
+ */
+int roadmap_locator_load_tile_prepared (int fips, int index, void *prepared);
 int roadmap_locator_unload_tile (int index);
 
 #endif // _ROADMAP_LOCATOR__H_
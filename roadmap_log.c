@@ -79,11 +79,16 @@ static struct roadmap_message_descriptor {
 
 
 static roadmap_log_msgbox_handler RoadmapLogMsgBox;
+static roadmap_log_redirect_handler RoadmapLogRedirect;
 
 void roadmap_log_register_msgbox (roadmap_log_msgbox_handler handler) {
    RoadmapLogMsgBox = handler;
 }
 
+void roadmap_log_register_redirect (roadmap_log_redirect_handler handler) {
+   RoadmapLogRedirect = handler;
+}
+
 
 #ifndef J2ME
 void roadmap_log_push (const char *description) {
@@ -302,6 +307,17 @@ void roadmap_log (int level, const char *source, int line, const char *format, .
 
    if (level < roadmap_verbosity()) return;
 
+   if (RoadmapLogRedirect != NULL && level < ROADMAP_MESSAGE_FATAL) {
+
+      int taken;
+
+      va_start(ap, format);
+      taken = RoadmapLogRedirect (level, source, line, format, ap);
+      va_end(ap);
+
+      if (taken) return;
+   }
+
 #if(defined DEBUG && defined SKIP_DEBUG_LOGS)
    return;
 #endif   // SKIP_DEBUG_LOGS
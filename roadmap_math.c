@@ -51,6 +51,26 @@
 
 #include "roadmap_math.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define ROADMAP_MATH_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ROADMAP_MATH_NEON
+#endif
+
+#ifdef ROADMAP_MATH_SSE2
+/* The low 32 bits of each product, SSE2 has no such instruction */
+static __inline __m128i roadmap_math_mullo (__m128i a, __m128i b) {
+
+   __m128i even = _mm_mul_epu32 (a, b);
+   __m128i odd = _mm_mul_epu32 (_mm_srli_epi64 (a, 32), _mm_srli_epi64 (b, 32));
+
+   return _mm_unpacklo_epi32 (_mm_shuffle_epi32 (even, _MM_SHUFFLE (0, 0, 2, 0)),
+                              _mm_shuffle_epi32 (odd, _MM_SHUFFLE (0, 0, 2, 0)));
+}
+#endif
+
 #define ROADMAP_BASE_IMPERIAL 0
 #define ROADMAP_BASE_METRIC   1
 
@@ -600,39 +620,175 @@ int roadmap_math_set_scale (int scale, int use_map_units) {
 /* Rotation of the screen:
  * rotate the coordinates of a point on the screen, the center of
  * the rotation being the center of the screen.
+ *
+ * The points are rotated a few at a time with the SIMD unit when there is
+ * one. The results are the same as the scalar code: the products fit in
+ * 32 bits and the division by 32768 rounds toward zero as in C.
  */
-void roadmap_math_rotate_coordinates (int count, RoadMapGuiPoint *points) {
+static void roadmap_math_rotate_batch (int count, RoadMapGuiPoint *points) {
 
-   int i;
+   const int center_x = RoadMapContext.center_x;
+   const int center_y = RoadMapContext.center_y;
+   const int cos_o = RoadMapContext.cos_orientation;
+   const int sin_o = RoadMapContext.sin_orientation;
+   int i = 0;
    int x;
    int y;
 
+#if defined(ROADMAP_MATH_SSE2)
+   /* two points per vector: x0, y0, x1, y1 */
+   const __m128i center = _mm_set_epi32 (center_y, center_x, center_y, center_x);
+   const __m128i flip = _mm_set_epi32 (-1, 0, -1, 0);
+   const __m128i cosv = _mm_set1_epi32 (cos_o);
+   const __m128i sinv = _mm_set_epi32 (-sin_o, sin_o, -sin_o, sin_o);
+   const __m128i bias = _mm_set1_epi32 (16383);
+   const __m128i round = _mm_set1_epi32 (32767);
 
-   if (!RoadMapContext.orientation && !RoadMapContext._3D_horizon) return;
+   for (; i + 2 <= count; i += 2) {
 
-   for (i = count; i > 0; --i) {
+      __m128i p = _mm_loadu_si128 ((const __m128i *)(points + i));
+
+      /* x - center_x, center_y - y */
+      __m128i d = _mm_sub_epi32 (_mm_xor_si128 (_mm_sub_epi32 (p, center), flip), flip);
+      __m128i s = _mm_shuffle_epi32 (d, _MM_SHUFFLE (2, 3, 0, 1));
 
-      if (RoadMapContext.orientation) {
-         x = points->x - RoadMapContext.center_x;
-         y = RoadMapContext.center_y - points->y;
+      __m128i r = _mm_add_epi32 (_mm_add_epi32 (roadmap_math_mullo (d, cosv),
+                                                roadmap_math_mullo (s, sinv)),
+                                 bias);
 
-         points->x =
-            RoadMapContext.center_x +
-            (((x * RoadMapContext.cos_orientation)
-              + (y * RoadMapContext.sin_orientation) + 16383) / 32768);
+      r = _mm_srai_epi32 (_mm_add_epi32 (r, _mm_and_si128 (_mm_srai_epi32 (r, 31), round)), 15);
 
-         points->y =
-            RoadMapContext.center_y -
-            (((y * RoadMapContext.cos_orientation)
-              - (x * RoadMapContext.sin_orientation) + 16383) / 32768);
+      /* center_x + rx, center_y - ry */
+      r = _mm_add_epi32 (center, _mm_sub_epi32 (_mm_xor_si128 (r, flip), flip));
+      _mm_storeu_si128 ((__m128i *)(points + i), r);
+   }
+#elif defined(ROADMAP_MATH_NEON)
+   {
+      const int center_a[4] = {center_x, center_y, center_x, center_y};
+      const int sign_a[4] = {1, -1, 1, -1};
+      const int sin_a[4] = {sin_o, -sin_o, sin_o, -sin_o};
+      const int32x4_t center = vld1q_s32 (center_a);
+      const int32x4_t sign = vld1q_s32 (sign_a);
+      const int32x4_t cosv = vdupq_n_s32 (cos_o);
+      const int32x4_t sinv = vld1q_s32 (sin_a);
+      const int32x4_t bias = vdupq_n_s32 (16383);
+      const int32x4_t round = vdupq_n_s32 (32767);
+
+      for (; i + 2 <= count; i += 2) {
+
+         int32x4_t p = vld1q_s32 ((const int32_t *)(points + i));
+         int32x4_t d = vmulq_s32 (vsubq_s32 (p, center), sign);
+         int32x4_t s = vrev64q_s32 (d);
+         int32x4_t r = vaddq_s32 (vmlaq_s32 (vmulq_s32 (d, cosv), s, sinv), bias);
+
+         r = vshrq_n_s32 (vaddq_s32 (r, vandq_s32 (vshrq_n_s32 (r, 31), round)), 15);
+         vst1q_s32 ((int32_t *)(points + i), vmlaq_s32 (center, r, sign));
       }
+   }
+#endif
 
-      if (RoadMapContext._3D_horizon) {
+   for (; i < count; i++) {
 
-         roadmap_math_project (points);
+      x = points[i].x - center_x;
+      y = center_y - points[i].y;
+
+      points[i].x =
+         center_x + (((x * cos_o) + (y * sin_o) + 16383) / 32768);
+
+      points[i].y =
+         center_y - (((y * cos_o) - (x * sin_o) + 16383) / 32768);
+   }
+}
+
+
+void roadmap_math_rotate_coordinates (int count, RoadMapGuiPoint *points) {
+
+   int i;
+
+   if (RoadMapContext.orientation) {
+      roadmap_math_rotate_batch (count, points);
+   }
+
+   if (RoadMapContext._3D_horizon) {
+      for (i = 0; i < count; i++) {
+         roadmap_math_project (points + i);
       }
+   }
+}
 
-      points += 1;
+
+void roadmap_math_coordinates (int count, const RoadMapPosition *positions,
+                               RoadMapGuiPoint *points) {
+
+   const int west = RoadMapContext.upright_screen.west;
+   const int north = RoadMapContext.upright_screen.north;
+   const int zoom_x = RoadMapContext.zoom_x;
+   const int zoom_y = RoadMapContext.zoom_y;
+   int i = 0;
+
+   /* The quotients are estimated with the reciprocal of the zoom, then
+    * corrected with the remainder, which is exact whatever the floating
+    * point rounding. The division rounds toward zero as in C.
+    */
+#if defined(ROADMAP_MATH_SSE2)
+   const __m128i origin = _mm_set_epi32 (north, -west, north, -west);
+   const __m128i flip = _mm_set_epi32 (-1, 0, -1, 0);
+   const __m128i zoom = _mm_set_epi32 (zoom_y, zoom_x, zoom_y, zoom_x);
+   const __m128i zoom_max = _mm_sub_epi32 (zoom, _mm_set1_epi32 (1));
+   const __m128d ratio = _mm_set_pd (1.0 / zoom_y, 1.0 / zoom_x);
+
+   for (; i + 2 <= count; i += 2) {
+
+      __m128i p = _mm_loadu_si128 ((const __m128i *)(positions + i));
+
+      /* longitude - west, north - latitude */
+      __m128i d = _mm_add_epi32 (_mm_sub_epi32 (_mm_xor_si128 (p, flip), flip), origin);
+      __m128i sign = _mm_srai_epi32 (d, 31);
+      __m128i a = _mm_sub_epi32 (_mm_xor_si128 (d, sign), sign);
+
+      __m128i q0 = _mm_cvttpd_epi32 (_mm_mul_pd (_mm_cvtepi32_pd (a), ratio));
+      __m128i q1 = _mm_cvttpd_epi32
+                     (_mm_mul_pd (_mm_cvtepi32_pd (_mm_srli_si128 (a, 8)), ratio));
+      __m128i q = _mm_unpacklo_epi64 (q0, q1);
+      __m128i r = _mm_sub_epi32 (a, roadmap_math_mullo (q, zoom));
+
+      q = _mm_add_epi32 (q, _mm_cmplt_epi32 (r, _mm_setzero_si128 ()));
+      q = _mm_sub_epi32 (q, _mm_cmpgt_epi32 (r, zoom_max));
+
+      _mm_storeu_si128 ((__m128i *)(points + i),
+                        _mm_sub_epi32 (_mm_xor_si128 (q, sign), sign));
+   }
+#elif defined(ROADMAP_MATH_NEON) && defined(__aarch64__)
+   const int32_t origin_a[2] = {-west, north};
+   const int32_t sign_a[2] = {1, -1};
+   const int32_t zoom_a[2] = {zoom_x, zoom_y};
+   const double ratio_a[2] = {1.0 / zoom_x, 1.0 / zoom_y};
+   const int32x2_t origin = vld1_s32 (origin_a);
+   const int32x2_t sign = vld1_s32 (sign_a);
+   const int32x2_t zoom = vld1_s32 (zoom_a);
+   const float64x2_t ratio = vld1q_f64 (ratio_a);
+
+   for (; i < count; i++) {
+
+      /* longitude - west, north - latitude */
+      int32x2_t d = vmla_s32 (origin, vld1_s32 ((const int32_t *)(positions + i)), sign);
+      int32x2_t a = vabs_s32 (d);
+      float64x2_t f = vcvtq_f64_s64 (vmovl_s32 (a));
+      int32x2_t q = vmovn_s64 (vcvtq_s64_f64 (vmulq_f64 (f, ratio)));
+      int32x2_t r = vmls_s32 (a, q, zoom);
+
+      q = vadd_s32 (q, vreinterpret_s32_u32 (vclt_s32 (r, vdup_n_s32 (0))));
+      q = vsub_s32 (q, vreinterpret_s32_u32 (vcge_s32 (r, zoom)));
+
+      /* back to the sign of the difference */
+      vst1_s32 ((int32_t *)(points + i),
+                vbsl_s32 (vclt_s32 (d, vdup_n_s32 (0)), vneg_s32 (q), q));
+   }
+#endif
+
+   for (; i < count; i++) {
+      points[i].x = (positions[i].longitude - west) / zoom_x;
+      points[i].y = (north - positions[i].latitude) / zoom_y;
    }
 }
 
@@ -1073,6 +1229,13 @@ int  roadmap_math_get_zoom (void) {
    return (int) RoadMapContext.zoom;
 }
 
+
+void roadmap_math_get_zoom_ratio (int *zoom_x, int *zoom_y) {
+
+   *zoom_x = RoadMapContext.zoom_x;
+   *zoom_y = RoadMapContext.zoom_y;
+}
+
 #ifdef IPHONE
 float roadmap_math_get_angle (RoadMapGuiPoint *point0, RoadMapGuiPoint *point1) {
    float delta_x = point0->x - point1->x + 1;
@@ -1195,6 +1358,24 @@ long roadmap_math_screen_distance
 }
 
 
+/* The inverse of roadmap_math_azymuth and roadmap_math_distance, flat earth
+ * around the current context. Distance is in the current units.
+ */
+void roadmap_math_position_ahead
+       (const RoadMapPosition *from, int azymuth, int distance, RoadMapPosition *to) {
+
+   int sine;
+   int cosine;
+
+   roadmap_math_trigonometry (azymuth, &sine, &cosine);
+
+   to->longitude = from->longitude +
+      (int) ((float) distance * sine / 32768 / RoadMapContext.units->unit_per_longitude);
+   to->latitude = from->latitude +
+      (int) ((float) distance * cosine / 32768 / RoadMapContext.units->unit_per_latitude);
+}
+
+
 int roadmap_math_distance
        (const RoadMapPosition *position1, const RoadMapPosition *position2) {
 
@@ -246,6 +246,11 @@ void roadmap_math_project     (RoadMapGuiPoint *point);
 void roadmap_math_unproject   (RoadMapGuiPoint *point);
 
 void roadmap_math_rotate_coordinates (int count, RoadMapGuiPoint *points);
+
+/* roadmap_math_coordinate for a whole array */
+void roadmap_math_coordinates (int count, const RoadMapPosition *positions,
+                               RoadMapGuiPoint *points);
+
 void roadmap_math_counter_rotate_coordinate (RoadMapGuiPoint *point);
 
 void roadmap_math_rotate_point (RoadMapGuiPoint *points,
@@ -269,6 +274,8 @@ char *roadmap_math_speed_unit    (void);
 
 int  roadmap_math_distance
         (const RoadMapPosition *position1, const RoadMapPosition *position2);
+void roadmap_math_position_ahead
+        (const RoadMapPosition *from, int azymuth, int distance, RoadMapPosition *to);
 
 int  roadmap_math_distance_convert (const char *string, int *was_explicit);
 int  roadmap_math_to_trip_distance (int distance);
@@ -320,6 +327,8 @@ int roadmap_math_calc_line_length (const RoadMapPosition *position,
                                    int *total_length);
 
 int  roadmap_math_get_zoom (void);
+/* The position units per pixel, which also depend on the latitude */
+void roadmap_math_get_zoom_ratio (int *zoom_x, int *zoom_y);
 
 #ifdef IPHONE
 float roadmap_math_get_angle (RoadMapGuiPoint *point0, RoadMapGuiPoint *point1);
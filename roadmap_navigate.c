@@ -710,6 +710,8 @@ void roadmap_navigate_locate (const RoadMapGpsPosition *gps_position, time_t gps
    roadmap_math_set_context ((RoadMapPosition *)gps_position, 20);
 
 	roadmap_square_request_location ((const RoadMapPosition *)gps_position);
+	roadmap_square_request_track ((const RoadMapPosition *)gps_position,
+											gps_position->speed, gps_position->steering);
 	 
    if (gps_position->speed < roadmap_gps_speed_accuracy()) {
 
@@ -71,6 +71,7 @@ static int roadmap_option_synchronous = 0;
 
 static char *roadmap_option_debug = "";
 static char *roadmap_option_gps = NULL;
+static char *roadmap_option_route_bench = NULL;
 
 static float roadmap_option_fast_forward_factor = 1.0F;
 
@@ -114,6 +115,12 @@ char *roadmap_gps_source (void) {
 }
 
 
+const char *roadmap_route_bench_source (void) {
+
+   return roadmap_option_route_bench;
+}
+
+
 int roadmap_verbosity (void) {
 
    return roadmap_option_verbose;
@@ -255,6 +262,15 @@ static void roadmap_option_set_gps (const char *value) {
 }
 
 
+static void roadmap_option_set_route_bench (const char *value) {
+
+    if (roadmap_option_route_bench != NULL) {
+        free (roadmap_option_route_bench);
+    }
+    roadmap_option_route_bench = strdup (value);
+}
+
+
 static void roadmap_option_set_cache (const char *value) {
 
     roadmap_option_cache_size = atoi(value);
@@ -345,6 +361,9 @@ static struct roadmap_option_descriptor RoadMapOptionMap[] = {
     {"--gps-sync", "", roadmap_option_set_synchronous,
         "Update the map synchronously when receiving each GPS position"},
 
+    {"--route-bench=", "FILE", roadmap_option_set_route_bench,
+        "Run the origin / destination pairs of FILE through the route calculation and exit"},
+
     {"--cache=", "INTEGER", roadmap_option_set_cache,
         "Set the number of entries in the RoadMap's map cache"},
 
@@ -51,6 +51,7 @@
 #include "roadmap_lang.h"
 #include "roadmap_messagebox.h"
 #include "roadmap_line_route.h"
+#include "roadmap_hash.h"
 
 #include "roadmap_sprite.h"
 #include "roadmap_object.h"
@@ -208,6 +209,7 @@ static RoadMapGuiPoint *RoadMapScreenLinePointsAccum = RoadMapScreenLinePoints.d
 static struct roadmap_screen_point_buffer RoadMapScreenPoints;
 
 static int RoadMapPolygonGeoPoints[ROADMAP_SCREEN_BULK];
+static RoadMapPosition RoadMapPolygonPositions[ROADMAP_SCREEN_BULK];
 
 
 static RoadMapPen RoadMapBackground = NULL;
@@ -222,6 +224,302 @@ static void roadmap_screen_repaint_now (void);
 #define INLINE_DEC
 #endif
 
+#ifndef J2ME
+/* While the squares are drawn, the flushed lines and points are recorded
+ * in a display list with their pen and layer instead of being drawn. The
+ * list is then drawn sorted by layer and pen, so that each pen is selected
+ * once per layer and all its lines are drawn in one call.
+ */
+#define DISPLAY_LINES   0
+#define DISPLAY_POINTS  1
+
+#define DISPLAY_MAX_PENS 64
+
+typedef struct {
+   int         z;
+   int         pen_order;
+   int         seq;
+   int         type;
+   RoadMapPen  pen;
+   int         first_object;
+   int         object_count;
+   int         first_point;
+   int         point_count;
+} ScreenDisplayItem;
+
+static int RoadMapScreenDisplayRecording = 0;
+static int RoadMapScreenDisplayZ = 0;
+
+static ScreenDisplayItem *DisplayItems = NULL;
+static int DisplayItemCount = 0;
+static int DisplayItemSize = 0;
+
+static int *DisplayObjects = NULL;
+static int DisplayObjectCount = 0;
+static int DisplayObjectSize = 0;
+
+static RoadMapGuiPoint *DisplayPoints = NULL;
+static int DisplayPointCount = 0;
+static int DisplayPointSize = 0;
+
+/* the runs of items drawn in one call are gathered here */
+static int *DisplayRunObjects = NULL;
+static int DisplayRunObjectSize = 0;
+static RoadMapGuiPoint *DisplayRunPoints = NULL;
+static int DisplayRunPointSize = 0;
+
+static RoadMapPen DisplayPens[DISPLAY_MAX_PENS];
+static int DisplayPenCount = 0;
+
+/* the point marks of the gray lines, drawn over everything recorded */
+static RoadMapGuiPoint *DisplayMarks = NULL;
+static int *DisplayMarkRadius = NULL;
+static int DisplayMarkCount = 0;
+static int DisplayMarkSize = 0;
+static int DisplayMarkRadiusSize = 0;
+static RoadMapPen DisplayMarkPen = NULL;
+static const char *DisplayMarkColor = NULL;
+
+
+static void *roadmap_screen_display_grow (void *data, int *size,
+                                          int needed, int item_size) {
+
+   if (needed <= *size) return data;
+
+   while (*size < needed) *size = *size ? *size * 2 : 1024;
+
+   data = realloc (data, *size * item_size);
+   roadmap_check_allocated (data);
+
+   return data;
+}
+
+
+static int roadmap_screen_display_pen_order (RoadMapPen pen) {
+
+   int i;
+
+   for (i = 0; i < DisplayPenCount; i++) {
+      if (DisplayPens[i] == pen) return i;
+   }
+
+   if (DisplayPenCount == DISPLAY_MAX_PENS) return DISPLAY_MAX_PENS;
+
+   DisplayPens[DisplayPenCount] = pen;
+   return DisplayPenCount++;
+}
+
+
+/* Returns 0 if the caller should draw the data itself */
+static int roadmap_screen_display_record (int type,
+                                          int object_count, const int *objects,
+                                          int point_count,
+                                          const RoadMapGuiPoint *points) {
+
+   ScreenDisplayItem *item;
+
+   if (!RoadMapScreenDisplayRecording || !RoadMapScreenLastPen) return 0;
+
+   DisplayItems = roadmap_screen_display_grow
+      (DisplayItems, &DisplayItemSize, DisplayItemCount + 1,
+       sizeof (ScreenDisplayItem));
+   DisplayObjects = roadmap_screen_display_grow
+      (DisplayObjects, &DisplayObjectSize, DisplayObjectCount + object_count,
+       sizeof (int));
+   DisplayPoints = roadmap_screen_display_grow
+      (DisplayPoints, &DisplayPointSize, DisplayPointCount + point_count,
+       sizeof (RoadMapGuiPoint));
+
+   item = DisplayItems + DisplayItemCount;
+   item->z = RoadMapScreenDisplayZ;
+   item->pen = RoadMapScreenLastPen;
+   item->pen_order = roadmap_screen_display_pen_order (RoadMapScreenLastPen);
+   item->seq = DisplayItemCount++;
+   item->type = type;
+   item->first_object = DisplayObjectCount;
+   item->object_count = object_count;
+   item->first_point = DisplayPointCount;
+   item->point_count = point_count;
+
+   memcpy (DisplayObjects + DisplayObjectCount, objects,
+           object_count * sizeof (int));
+   DisplayObjectCount += object_count;
+
+   memcpy (DisplayPoints + DisplayPointCount, points,
+           point_count * sizeof (RoadMapGuiPoint));
+   DisplayPointCount += point_count;
+
+   return 1;
+}
+
+
+static void roadmap_screen_display_submit (void);
+
+/* Sets the pen and color of the marks recorded next */
+static void roadmap_screen_display_mark_style (RoadMapPen pen, const char *color) {
+
+   if (DisplayMarkCount &&
+       (pen != DisplayMarkPen || strcmp (color, DisplayMarkColor))) {
+      roadmap_screen_display_submit ();
+   }
+
+   DisplayMarkPen = pen;
+   DisplayMarkColor = color;
+}
+
+
+/* Returns 0 if the caller should draw the mark itself */
+static int roadmap_screen_display_record_mark (const RoadMapGuiPoint *point) {
+
+   if (!RoadMapScreenDisplayRecording || !DisplayMarkPen) return 0;
+
+   DisplayMarks = roadmap_screen_display_grow
+      (DisplayMarks, &DisplayMarkSize, DisplayMarkCount + 1,
+       sizeof (RoadMapGuiPoint));
+   DisplayMarkRadius = roadmap_screen_display_grow
+      (DisplayMarkRadius, &DisplayMarkRadiusSize, DisplayMarkCount + 1,
+       sizeof (int));
+
+   DisplayMarks[DisplayMarkCount] = *point;
+   DisplayMarkRadius[DisplayMarkCount] = 2;
+   DisplayMarkCount++;
+
+   return 1;
+}
+
+
+static int roadmap_screen_display_compare (const void *a, const void *b) {
+
+   const ScreenDisplayItem *item1 = (const ScreenDisplayItem *)a;
+   const ScreenDisplayItem *item2 = (const ScreenDisplayItem *)b;
+
+   if (item1->z != item2->z) return item1->z - item2->z;
+   if (item1->pen_order != item2->pen_order) {
+      return item1->pen_order - item2->pen_order;
+   }
+
+   return item1->seq - item2->seq;
+}
+
+
+/* Draws what was recorded so far */
+static void roadmap_screen_display_submit (void) {
+
+   RoadMapPen current = NULL;
+   int i;
+   int j;
+
+   if (DisplayItemCount == 0 && DisplayMarkCount == 0) return;
+
+   qsort (DisplayItems, DisplayItemCount, sizeof (ScreenDisplayItem),
+          roadmap_screen_display_compare);
+
+   for (i = 0; i < DisplayItemCount; i = j) {
+
+      ScreenDisplayItem *item = DisplayItems + i;
+      int *objects = DisplayObjects + item->first_object;
+      RoadMapGuiPoint *points = DisplayPoints + item->first_point;
+      int object_count = item->object_count;
+      int point_count = item->point_count;
+
+      for (j = i + 1; j < DisplayItemCount; j++) {
+         if (DisplayItems[j].z != item->z ||
+             DisplayItems[j].pen != item->pen ||
+             DisplayItems[j].type != item->type) {
+            break;
+         }
+      }
+
+      if (j > i + 1) {
+
+         int k;
+
+         object_count = 0;
+         point_count = 0;
+         for (k = i; k < j; k++) {
+            object_count += DisplayItems[k].object_count;
+            point_count += DisplayItems[k].point_count;
+         }
+
+         DisplayRunObjects = roadmap_screen_display_grow
+            (DisplayRunObjects, &DisplayRunObjectSize, object_count, sizeof (int));
+         DisplayRunPoints = roadmap_screen_display_grow
+            (DisplayRunPoints, &DisplayRunPointSize, point_count,
+             sizeof (RoadMapGuiPoint));
+
+         objects = DisplayRunObjects;
+         points = DisplayRunPoints;
+
+         for (k = i; k < j; k++) {
+            memcpy (objects, DisplayObjects + DisplayItems[k].first_object,
+                    DisplayItems[k].object_count * sizeof (int));
+            memcpy (points, DisplayPoints + DisplayItems[k].first_point,
+                    DisplayItems[k].point_count * sizeof (RoadMapGuiPoint));
+            objects += DisplayItems[k].object_count;
+            points += DisplayItems[k].point_count;
+         }
+
+         objects = DisplayRunObjects;
+         points = DisplayRunPoints;
+      }
+
+      if (item->pen != current) {
+         roadmap_canvas_select_pen (item->pen);
+         current = item->pen;
+      }
+
+      if (item->type == DISPLAY_LINES) {
+         roadmap_canvas_draw_multiple_lines
+            (object_count, objects, points, RoadMapScreenFastRefresh);
+      } else {
+         roadmap_canvas_draw_multiple_points (point_count, points);
+      }
+   }
+
+   if (DisplayMarkCount) {
+      roadmap_canvas_select_pen (DisplayMarkPen);
+      roadmap_canvas_set_foreground (DisplayMarkColor);
+      roadmap_canvas_draw_multiple_circles
+         (DisplayMarkCount, DisplayMarks, DisplayMarkRadius, 5, 1);
+      DisplayMarkCount = 0;
+   }
+
+   DisplayItemCount = 0;
+   DisplayObjectCount = 0;
+   DisplayPointCount = 0;
+
+   /* the recording did not select the pens */
+   RoadMapScreenLastPen = NULL;
+}
+
+
+static void roadmap_screen_display_begin (void) {
+
+   RoadMapScreenDisplayRecording = 1;
+   RoadMapScreenDisplayZ = 0;
+   DisplayPenCount = 0;
+}
+
+
+static void roadmap_screen_display_end (void) {
+
+   roadmap_screen_display_submit ();
+   RoadMapScreenDisplayRecording = 0;
+}
+
+#else
+
+#define RoadMapScreenDisplayRecording 0
+#define roadmap_screen_display_record(type,object_count,objects,point_count,points) 0
+#define roadmap_screen_display_submit()
+#define roadmap_screen_display_mark_style(pen,color)
+#define roadmap_screen_display_record_mark(point) 0
+#define roadmap_screen_display_begin()
+#define roadmap_screen_display_end()
+
+#endif /* J2ME */
+
+
 INLINE_DEC void roadmap_screen_flush_points (void) {
 
    if (RoadMapScreenPoints.cursor == RoadMapScreenPoints.data) return;
@@ -231,9 +529,15 @@ INLINE_DEC void roadmap_screen_flush_points (void) {
        (RoadMapScreenPoints.cursor - RoadMapScreenPoints.data,
         RoadMapScreenPoints.data);
 
-   roadmap_canvas_draw_multiple_points
-       (RoadMapScreenPoints.cursor - RoadMapScreenPoints.data,
-        RoadMapScreenPoints.data);
+   if (!roadmap_screen_display_record
+          (DISPLAY_POINTS, 0, NULL,
+           RoadMapScreenPoints.cursor - RoadMapScreenPoints.data,
+           RoadMapScreenPoints.data)) {
+
+      roadmap_canvas_draw_multiple_points
+          (RoadMapScreenPoints.cursor - RoadMapScreenPoints.data,
+           RoadMapScreenPoints.data);
+   }
 
    RoadMapScreenPoints.cursor  = RoadMapScreenPoints.data;
 
@@ -252,10 +556,18 @@ INLINE_DEC void roadmap_screen_flush_lines (void) {
         RoadMapScreenLinePoints.data);
 
    dbg_time_end(DBG_TIME_FLUSH_LINES);
-   roadmap_canvas_draw_multiple_lines
-      (RoadMapScreenObjects.cursor - RoadMapScreenObjects.data,
-       RoadMapScreenObjects.data,
-       RoadMapScreenLinePoints.data, RoadMapScreenFastRefresh);
+   if (!roadmap_screen_display_record
+          (DISPLAY_LINES,
+           RoadMapScreenObjects.cursor - RoadMapScreenObjects.data,
+           RoadMapScreenObjects.data,
+           RoadMapScreenLinePoints.cursor - RoadMapScreenLinePoints.data,
+           RoadMapScreenLinePoints.data)) {
+
+      roadmap_canvas_draw_multiple_lines
+         (RoadMapScreenObjects.cursor - RoadMapScreenObjects.data,
+          RoadMapScreenObjects.data,
+          RoadMapScreenLinePoints.data, RoadMapScreenFastRefresh);
+   }
 
    dbg_time_start(DBG_TIME_FLUSH_LINES);
    if (RoadMapScreenLinePoints.cursor < RoadMapScreenLinePointsAccum) {
@@ -350,7 +662,7 @@ INLINE_DEC int roadmap_screen_add_segment_point (RoadMapGuiPoint *point,
          roadmap_screen_flush_lines ();
          roadmap_screen_flush_points ();
          dbg_time_start(DBG_TIME_ADD_SEGMENT);
-         if (pen) roadmap_canvas_select_pen (pen);
+         if (pen && !RoadMapScreenDisplayRecording) roadmap_canvas_select_pen (pen);
          RoadMapScreenLastPen = pen;
       }
 
@@ -1310,24 +1622,33 @@ static void roadmap_screen_draw_polygons (void) {
                        - RoadMapScreenLinePoints.cursor - 1);
       }
 
+      for (j = 0; j < size; ++j) {
+         roadmap_point_position (RoadMapPolygonGeoPoints[j],
+                                 RoadMapPolygonPositions + j);
+      }
+
+      /* Project all the points at once, then drop the repeated ones */
+      roadmap_math_coordinates
+         (size, RoadMapPolygonPositions, RoadMapScreenLinePoints.cursor);
+
       geo_point = RoadMapPolygonGeoPoints;
       graphic_point = RoadMapScreenLinePoints.cursor;
       previous_point = &null_point;
 
-      for (j = size; j > 0; --j) {
+      for (j = 0; j < size; ++j) {
+
+         RoadMapGuiPoint *point = RoadMapScreenLinePoints.cursor + j;
 
-         roadmap_point_position  (*geo_point, &position);
-         roadmap_math_coordinate (&position, graphic_point);
-         RoadMapScreenLinePoints.real
-            [graphic_point - RoadMapScreenLinePoints.data] = !(POINT_FAKE_FLAG & *geo_point);
+         if ((point->x != previous_point->x) ||
+             (point->y != previous_point->y)) {
 
-         if ((graphic_point->x != previous_point->x) ||
-             (graphic_point->y != previous_point->y)) {
+            *graphic_point = *point;
+            RoadMapScreenLinePoints.real
+               [graphic_point - RoadMapScreenLinePoints.data] = !(POINT_FAKE_FLAG & geo_point[j]);
 
             previous_point = graphic_point;
             graphic_point += 1;
          }
-         geo_point += 1;
       }
 
       /* Do not show polygons that have been reduced to a single
@@ -1412,119 +1733,352 @@ static void roadmap_screen_draw_square_edges (int square) {
    RoadMapScreenLastPen = NULL;
 }
 
-#if 0
-struct square_cache_line {
-   int cfcc;
-   RoadMapPosition from;
-   RoadMapPosition to;
-   int first_shape;
-   int last_shape;
-   int contained;
-};
+/* The lines of a square and category, projected at the zoom they were
+ * built for and relative to the north west corner of the square. Moving
+ * the map only translates them, and the rotation is applied when the lines
+ * are flushed, so a frame at the same zoom draws them without reading the
+ * lines and shapes again. Only the lines fully on the screen are drawn from
+ * the cache; the others still need clipping.
+ */
+typedef struct {
+   RoadMapArea       edges;         /* of the line and its shape points */
+   int               first_point;
+   int               count;         /* consecutive equal points are dropped */
+   int               length_sq;     /* labelling heuristic, as when drawn */
+   int               angle;
+   RoadMapGuiPoint   middle;
+} ScreenCacheLine;
+
+typedef struct {
+   int               square;        /* -1 for a free entry */
+   int               cfcc;
+   int               fips;
+   int               zoom_x;
+   int               zoom_y;
+   RoadMapPosition   origin;
+   int               first_line;
+   int               line_count;
+   ScreenCacheLine   *lines;
+   RoadMapGuiPoint   *points;
+   int               mem_size;
+   int               next;
+   int               prev;
+} ScreenCacheEntry;
 
-struct square_cache {
-   int count;
-   struct square_cache_line lines[1];
-};
+#ifndef J2ME
 
-static struct square_cache *SquareCache[9000];
+#define SCREEN_CACHE_ENTRIES  1024
+#define SCREEN_CACHE_MEMORY   (4 * 1024 * 1024)
 
-static struct square_cache *roadmap_screen_cache_square
-              (int square, int *layers, int layer_count) {
+/* A circular LRU list; the sentinel at SCREEN_CACHE_ENTRIES is followed by
+ * the most recently used entry, free entries are kept at the end.
+ */
+static ScreenCacheEntry ScreenCache[SCREEN_CACHE_ENTRIES + 1];
+static RoadMapHashMap *ScreenCacheHash = NULL;
+static int ScreenCacheMemory = 0;
 
-   int line;
-   int first_line;
-   int last_line;
-   int first_shape;
-   int last_shape;
-   int fips = roadmap_locator_active ();
+
+static void roadmap_screen_cache_init (void) {
 
    int i;
 
-   struct square_cache *cache = NULL;
-   RoadMapArea square_edges;
+   for (i = 0; i <= SCREEN_CACHE_ENTRIES; i++) {
+      ScreenCache[i].square = -1;
+      ScreenCache[i].next = (i + 1) % (SCREEN_CACHE_ENTRIES + 1);
+      ScreenCache[i].prev = (i + SCREEN_CACHE_ENTRIES) % (SCREEN_CACHE_ENTRIES + 1);
+   }
 
-   roadmap_square_edges (square, &square_edges);
+   ScreenCacheHash = roadmap_hash_map_new ("screen", SCREEN_CACHE_ENTRIES);
+}
 
-   roadmap_square_set_current (square);
 
-   for (i = 0; i < layer_count; ++i) {
+static void roadmap_screen_cache_move (int slot, int after) {
 
-      int cfcc = layers[i];
+   ScreenCache[ScreenCache[slot].next].prev = ScreenCache[slot].prev;
+   ScreenCache[ScreenCache[slot].prev].next = ScreenCache[slot].next;
 
-      if ((cfcc < ROADMAP_ROAD_FIRST) || (cfcc > ROADMAP_ROAD_LAST)) {
-         continue;
+   ScreenCache[slot].prev = after;
+   ScreenCache[slot].next = ScreenCache[after].next;
+   ScreenCache[ScreenCache[after].next].prev = slot;
+   ScreenCache[after].next = slot;
+}
+
+
+static void roadmap_screen_cache_free (int slot) {
+
+   ScreenCacheEntry *entry = ScreenCache + slot;
+
+   if (entry->square < 0) return;
+
+   roadmap_hash_map_remove (ScreenCacheHash, entry->square, entry->cfcc);
+   free (entry->lines);
+   free (entry->points);
+   ScreenCacheMemory -= entry->mem_size;
+
+   entry->square = -1;
+   entry->lines = NULL;
+   entry->points = NULL;
+   entry->mem_size = 0;
+
+   roadmap_screen_cache_move (slot, ScreenCache[SCREEN_CACHE_ENTRIES].prev);
+}
+
+
+/* Appends the point at position to the line, measuring the segment from
+ * the previous point as the drawing does for the labels.
+ */
+static void roadmap_screen_cache_add (ScreenCacheEntry *entry,
+                                      ScreenCacheLine *cached,
+                                      const RoadMapPosition *from,
+                                      const RoadMapPosition *position,
+                                      const RoadMapGuiPoint *origin,
+                                      int *longest) {
+
+   RoadMapGuiPoint *point = entry->points + cached->first_point + cached->count;
+   int length_sq;
+
+   roadmap_math_coordinate (position, point);
+   point->x -= origin->x;
+   point->y -= origin->y;
+
+   if (position->longitude < cached->edges.west) cached->edges.west = position->longitude;
+   if (position->longitude > cached->edges.east) cached->edges.east = position->longitude;
+   if (position->latitude < cached->edges.south) cached->edges.south = position->latitude;
+   if (position->latitude > cached->edges.north) cached->edges.north = position->latitude;
+
+   if (cached->count == 0) {
+      cached->count = 1;
+      return;
+   }
+
+   length_sq = roadmap_math_screen_distance (point - 1, point, MATH_DIST_SQUARED);
+   if (length_sq == 0) return;
+
+   cached->length_sq += length_sq;
+   if (length_sq > *longest) {
+      *longest = length_sq;
+      cached->angle = roadmap_math_azymuth (from, position);
+      cached->middle.x = (point[-1].x + point->x) / 2;
+      cached->middle.y = (point[-1].y + point->y) / 2;
+   }
+   cached->count++;
+}
+
+
+static ScreenCacheEntry *roadmap_screen_cache_get (int square, int cfcc,
+                                                   int first_line, int last_line) {
+
+   ScreenCacheEntry *entry;
+   RoadMapArea edges;
+   RoadMapGuiPoint origin;
+   int fips = roadmap_locator_active ();
+   int line_count = last_line - first_line + 1;
+   int has_shapes = roadmap_square_has_shapes (square);
+   int first_shape;
+   int last_shape;
+   int num_points;
+   int mem_size;
+   int zoom_x;
+   int zoom_y;
+   int line;
+   int slot;
+   int prev;
+
+   if (ScreenCacheHash == NULL) roadmap_screen_cache_init ();
+
+   roadmap_math_get_zoom_ratio (&zoom_x, &zoom_y);
+
+   slot = roadmap_hash_map_get (ScreenCacheHash, square, cfcc);
+   if (slot >= 0) {
+
+      entry = ScreenCache + slot;
+      if (entry->fips == fips &&
+          entry->zoom_x == zoom_x && entry->zoom_y == zoom_y &&
+          entry->first_line == first_line && entry->line_count == line_count) {
+
+         roadmap_screen_cache_move (slot, SCREEN_CACHE_ENTRIES);
+         return entry;
       }
 
-      if (roadmap_line_in_square (square, cfcc, &first_line, &last_line) > 0) {
-         int has_shapes;
+      roadmap_screen_cache_free (slot);
+   }
 
-         if (!cache) {
-            cache = malloc(sizeof(*cache) + sizeof(struct square_cache_line) * 2000);
-            cache->count = 0;
-         }
+   /* while zooming or dragging the next frame would not use it */
+   if (RoadMapScreenFastRefresh) return NULL;
 
-         if (roadmap_square_has_shapes (square)) {
-            has_shapes = 1;
-         } else {
-            has_shapes = 0;
-            first_shape = last_shape = -1;
-         }
+   num_points = 0;
+   for (line = first_line; line <= last_line; ++line) {
 
-         for (line = first_line; line <= last_line; ++line) {
+      num_points += 2;
+      if (has_shapes) {
+         roadmap_line_shapes (line, &first_shape, &last_shape);
+         if (first_shape >= 0) num_points += last_shape - first_shape + 1;
+      }
+   }
 
-            /* A plugin may override a line: it can change the pen or
-             * decide not to draw the line.
-             */
+   mem_size = line_count * sizeof (ScreenCacheLine) + num_points * sizeof (RoadMapGuiPoint);
+   if (mem_size > SCREEN_CACHE_MEMORY / 8) return NULL;
 
-            struct square_cache_line *cache_entry = cache->lines + cache->count;
+   for (slot = ScreenCache[SCREEN_CACHE_ENTRIES].prev;
+        slot != SCREEN_CACHE_ENTRIES && ScreenCacheMemory + mem_size > SCREEN_CACHE_MEMORY;
+        slot = prev) {
 
-            if (!roadmap_plugin_override_line (line, cfcc, fips)) {
+      prev = ScreenCache[slot].prev;
+      roadmap_screen_cache_free (slot);
+   }
 
+   slot = ScreenCache[SCREEN_CACHE_ENTRIES].prev;
+   roadmap_screen_cache_free (slot);
+   roadmap_screen_cache_move (slot, SCREEN_CACHE_ENTRIES);
+
+   entry = ScreenCache + slot;
+   entry->lines = malloc (line_count * sizeof (ScreenCacheLine));
+   roadmap_check_allocated (entry->lines);
+   entry->points = malloc (num_points * sizeof (RoadMapGuiPoint));
+   roadmap_check_allocated (entry->points);
+
+   entry->square = square;
+   entry->cfcc = cfcc;
+   entry->fips = fips;
+   entry->zoom_x = zoom_x;
+   entry->zoom_y = zoom_y;
+   entry->first_line = first_line;
+   entry->line_count = line_count;
+   entry->mem_size = mem_size;
 
-               if (has_shapes) {
+   roadmap_square_edges (square, &edges);
+   entry->origin.longitude = edges.west;
+   entry->origin.latitude = edges.north;
+   roadmap_math_coordinate (&entry->origin, &origin);
 
-                  roadmap_line_shapes (line, square, &first_shape, &last_shape);
-               }
+   num_points = 0;
+   first_shape = last_shape = -1;
 
-               cache_entry->contained = 1;
+   for (line = first_line; line <= last_line; ++line) {
 
-               roadmap_line_from (line, &cache_entry->from);
-               roadmap_line_to (line, &cache_entry->to);
+      ScreenCacheLine *cached = entry->lines + (line - first_line);
+      RoadMapPosition from;
+      RoadMapPosition to;
+      RoadMapPosition position;
+      RoadMapPosition previous;
+      int longest = -1;
+      int i;
 
-               if (first_shape != -1) {
-                  int j;
-                  RoadMapPosition shape_pos;
-                  shape_pos = cache_entry->from;
-                  for (j = first_shape; j <= last_shape; ++j) {
+      if (has_shapes) {
+         roadmap_line_shapes (line, &first_shape, &last_shape);
+      }
 
-                     roadmap_shape_get_position (j, &shape_pos);
+      roadmap_line_from (line, &from);
+      roadmap_line_to (line, &to);
 
-                     if ((shape_pos.longitude > square_edges.east) ||
-                           (shape_pos.longitude < square_edges.west) ||
-                           (shape_pos.latitude  > square_edges.north) ||
-                           (shape_pos.latitude  < square_edges.south)) {
+      cached->first_point = num_points;
+      cached->count = 0;
+      cached->length_sq = 0;
+      cached->angle = 90;
+      cached->middle.x = cached->middle.y = 0;
+      cached->edges.west = cached->edges.east = from.longitude;
+      cached->edges.south = cached->edges.north = from.latitude;
 
-                        cache_entry->contained = 0;
-                        break;
-                     }
-                  }
-               }
+      roadmap_screen_cache_add (entry, cached, &from, &from, &origin, &longest);
 
-               cache_entry->first_shape = first_shape;
-               cache_entry->last_shape = last_shape;
-               cache_entry->cfcc = cfcc;
-               cache->count++;
-            }
+      previous = position = from;
+      if (first_shape >= 0) {
+         for (i = first_shape; i <= last_shape; ++i) {
+
+            roadmap_shape_get_position (i, &position);
+            roadmap_screen_cache_add (entry, cached, &previous, &position, &origin, &longest);
+            previous = position;
          }
       }
+
+      roadmap_screen_cache_add (entry, cached, &previous, &to, &origin, &longest);
+
+      num_points += cached->count;
    }
 
-   roadmap_log_pop ();
-   if (!cache) cache = -1;
-   return cache;
+   ScreenCacheMemory += mem_size;
+   roadmap_hash_map_set (ScreenCacheHash, square, cfcc, slot);
+
+   return entry;
 }
+
+
+static int roadmap_screen_draw_cached_line (const ScreenCacheEntry *entry,
+                                            const ScreenCacheLine *cached,
+                                            const RoadMapGuiPoint *offset,
+                                            RoadMapPen *pens,
+                                            int num_pens,
+                                            int label_max_proj,
+                                            int *total_length_ptr,
+                                            RoadMapGuiPoint *middle,
+                                            int *angle) {
+
+   const RoadMapGuiPoint *points = entry->points + cached->first_point;
+   RoadMapGuiPoint point;
+   int count = cached->count;
+   int proj = 0;
+   int i;
+
+   if (total_length_ptr) *total_length_ptr = 0;
+
+   if (count == 1) {
+
+      point.x = points[0].x + offset->x;
+      point.y = points[0].y + offset->y;
+      roadmap_screen_add_segment_point (&point, pens, num_pens, SEGMENT_AS_POINT);
+      return 1;
+   }
+
+   if (count + 3 >= RoadMapScreenLinePoints.end - RoadMapScreenLinePoints.cursor) {
+
+      if (count + 3 >= RoadMapScreenLinePoints.end - RoadMapScreenLinePoints.data) {
+
+         roadmap_log (ROADMAP_ERROR,
+               "cannot show all shape points (%d entries needed).", count + 3);
+         count = (RoadMapScreenLinePoints.end - RoadMapScreenLinePoints.data) - 4;
+      }
+      roadmap_screen_flush_lines ();
+   }
+
+   for (i = 0; i < count; i++) {
+
+      point.x = points[i].x + offset->x;
+      point.y = points[i].y + offset->y;
+      proj = roadmap_screen_add_segment_point
+         (&point, pens, num_pens,
+          i == 0 ? SEGMENT_START : (i == count - 1 ? SEGMENT_END : 0));
+   }
+
+   if (total_length_ptr && proj <= label_max_proj) {
+      *total_length_ptr = cached->length_sq;
+      if (angle) *angle = cached->angle;
+      middle->x = cached->middle.x + offset->x;
+      middle->y = cached->middle.y + offset->y;
+   }
+
+   return 1;
+}
+
+#else
+
+#define roadmap_screen_cache_get(square,cfcc,first_line,last_line) NULL
+#define roadmap_screen_draw_cached_line(entry,cached,offset,pens,num_pens,label_max_proj,total_length_ptr,middle,angle) 0
+
+#endif /* J2ME */
+
+
+void roadmap_screen_clear_square (int square) {
+
+#ifndef J2ME
+   int i;
+
+   if (ScreenCacheHash == NULL) return;
+
+   for (i = 0; i < SCREEN_CACHE_ENTRIES; i++) {
+      if (ScreenCache[i].square == square) roadmap_screen_cache_free (i);
+   }
 #endif
+}
 
 //#define DEBUG_TIME
 #ifdef J2ME
@@ -1560,8 +2114,10 @@ roadmap_screen_draw_points (RoadMapGuiPoint *point0,
          from.y = (int)y;
 		 roadmap_math_rotate_coordinates (1, &from);
 
-		 width = 2;
-   	     roadmap_canvas_draw_multiple_circles(1 , &from, &width, 5,1);
+		 if (!roadmap_screen_display_record_mark (&from)) {
+		    width = 2;
+   	        roadmap_canvas_draw_multiple_circles(1 , &from, &width, 5,1);
+		 }
 
          x += step_x*3;
          y += step_y*3;
@@ -1595,15 +2151,17 @@ void roadmap_screen_draw_line_points (RoadMapPosition *from,
   	return;
   }
 
-  roadmap_screen_flush_lines ();
+  /* while recording, the marks are drawn once the lines are submitted */
+  if (!RoadMapScreenDisplayRecording) roadmap_screen_flush_lines ();
 
    if (points_pen == NULL) {
       points_pen = roadmap_canvas_create_pen ("points_mark");
       roadmap_canvas_set_foreground (color);
-   } else {
+   } else if (!RoadMapScreenDisplayRecording) {
      roadmap_canvas_select_pen (points_pen);
      roadmap_canvas_set_foreground (color);
    }
+   roadmap_screen_display_mark_style (points_pen, color);
 
    if (first_shape >= 0) {
 
@@ -1640,7 +2198,7 @@ void roadmap_screen_draw_line_points (RoadMapPosition *from,
 
 //   roadmap_screen_flush_lines ();
 
-   RoadMapScreenLastPen = NULL;
+   if (!RoadMapScreenDisplayRecording) RoadMapScreenLastPen = NULL;
 }
 INLINE_DEC int roadmap_screen_draw_square
               (int square, int cfcc, int fully_visible, int pen_type) {
@@ -1739,6 +2297,12 @@ INLINE_DEC int roadmap_screen_draw_square
 #endif
    if (roadmap_line_in_square (square, cfcc, &first_line, &last_line) > 0) {
       int has_shapes;
+      int scale = roadmap_square_get_screen_scale ();
+      ScreenCacheEntry *cache =
+         roadmap_screen_cache_get (square, cfcc, first_line, last_line);
+      RoadMapGuiPoint cache_offset = {0, 0};
+
+      if (cache) roadmap_math_coordinate (&cache->origin, &cache_offset);
 
       if (roadmap_square_has_shapes (square)) {
          has_shapes = 1;
@@ -1762,15 +2326,10 @@ INLINE_DEC int roadmap_screen_draw_square
             RoadMapPosition from;
             RoadMapPosition to;
             RoadMapPen override_pen;
-
-
-            if (has_shapes) {
-
-               roadmap_line_shapes (line, &first_shape, &last_shape);
-            }
-
-            roadmap_line_from (line, &from);
-            roadmap_line_to (line, &to);
+            RoadMapPen *pens = layer_pens;
+            int num_pens = LAYER_PROJ_AREAS;
+            int gray = 0;
+            const ScreenCacheLine *cached = NULL;
 
             /* Check if the plugin wants to override the pen. */
             if (RoadMapScreenFastRefresh == 0 &&
@@ -1778,29 +2337,52 @@ INLINE_DEC int roadmap_screen_draw_square
                      (line, cfcc, active_fips, pen_type, &override_pen)) {
 
                if (override_pen == NULL) continue;
+               pens = &override_pen;
+               num_pens = 1;
+            } else if ((cfcc < ROADMAP_ROAD_PEDESTRIAN) && (pen_type == 1) &&
+                       roadmap_line_route_is_low_weight (line) &&
+                       editor_screen_gray_scale() && !scale) {
+               pens = layer_pens2;
+               gray = 1;
+            }
+
+            if (cache && !gray) {
+               cached = cache->lines + (line - first_line);
+               switch (roadmap_math_is_visible (&cached->edges)) {
+                  case 0:
+                     drawn += 1;
+                     continue;
+                  case 1:
+                     break;
+                  default:
+                     cached = NULL;
+               }
+            }
+
+            if (cached) {
+
+               roadmap_screen_draw_cached_line
+                  (cache, cached, &cache_offset, pens, num_pens,
+                   label_max_proj, total_length_ptr, &seg_middle, angle_ptr);
+            } else {
+
+               if (has_shapes) {
+
+                  roadmap_line_shapes (line, &first_shape, &last_shape);
+               }
+
+               roadmap_line_from (line, &from);
+               roadmap_line_to (line, &to);
+
                roadmap_screen_draw_one_line_internal
                   (&from, &to, fully_visible, &from, first_shape, last_shape,
-                   NULL, &override_pen, 1, label_max_proj,
+                   NULL, pens, num_pens, label_max_proj,
                    total_length_ptr, &seg_middle, angle_ptr);
-            } else {
-            	int low_weight;
-            	int scale = roadmap_square_get_screen_scale ();
-            	low_weight = roadmap_line_route_is_low_weight (line);
-            	if ((cfcc < ROADMAP_ROAD_PEDESTRIAN) && (pen_type == 1) && low_weight && editor_screen_gray_scale() && !scale) {
-       					roadmap_screen_draw_one_line_internal
-                  			(&from, &to, fully_visible, &from, first_shape, last_shape,
-                   				NULL, layer_pens2, LAYER_PROJ_AREAS,
-                   				label_max_proj, total_length_ptr, &seg_middle, angle_ptr);
-						roadmap_screen_draw_line_points(&from, &to, &from, first_shape, last_shape,
-                   				NULL, "#b2bfdc");
-                }
-                else{
-     					roadmap_screen_draw_one_line_internal
-                  			(&from, &to, fully_visible, &from, first_shape, last_shape,
-                   				NULL, layer_pens, LAYER_PROJ_AREAS,
-                   				label_max_proj, total_length_ptr, &seg_middle, angle_ptr);
-
-                }
+
+               if (gray) {
+                  roadmap_screen_draw_line_points(&from, &to, &from, first_shape, last_shape,
+                                                  NULL, "#b2bfdc");
+               }
             }
 
             if (total_length_ptr && total_length && (cutoff_dist == 0 ||
@@ -2087,6 +2669,113 @@ static void fast_refresh_end (void) {
 }
 
 
+#ifdef ROADMAP_CANVAS_RETAIN
+/* The map of the last full frame is kept by the canvas. While dragging or
+ * zooming it is moved and scaled to where its center is now, and only the
+ * squares it does not cover are drawn.
+ */
+static struct {
+   int               valid;
+   RoadMapPosition   center;
+   RoadMapGuiPoint   point;
+   int               zoom_x;
+   int               orientation;
+} RoadMapScreenRetained;
+
+static int              RoadMapScreenCoverValid = 0;
+static RoadMapGuiRect   RoadMapScreenCover;
+
+
+static void roadmap_screen_retain (void) {
+
+   int zoom_y;
+
+   if (RoadMapScreenViewMode == VIEW_MODE_3D) {
+      RoadMapScreenRetained.valid = 0;
+      roadmap_canvas_discard_retained_map ();
+      return;
+   }
+
+   roadmap_canvas_retain_map ();
+
+   RoadMapScreenRetained.center = RoadMapScreenCenter;
+   roadmap_math_coordinate (&RoadMapScreenCenter, &RoadMapScreenRetained.point);
+   roadmap_math_rotate_coordinates (1, &RoadMapScreenRetained.point);
+   roadmap_math_get_zoom_ratio (&RoadMapScreenRetained.zoom_x, &zoom_y);
+   RoadMapScreenRetained.orientation = roadmap_math_get_orientation ();
+   RoadMapScreenRetained.valid = 1;
+}
+
+
+static int roadmap_screen_retained_move (RoadMapGuiPoint *offset, int *scale) {
+
+   RoadMapGuiPoint point;
+   int center_x = roadmap_canvas_width () / 2;
+   int center_y = roadmap_canvas_height () / 2;
+   int zoom_x;
+   int zoom_y;
+
+   if (!RoadMapScreenRetained.valid ||
+       RoadMapScreenViewMode == VIEW_MODE_3D ||
+       RoadMapScreenRetained.orientation != roadmap_math_get_orientation ()) {
+      return 0;
+   }
+
+   roadmap_math_get_zoom_ratio (&zoom_x, &zoom_y);
+   if (zoom_x <= 0) return 0;
+
+   *scale = (int)(((long long)RoadMapScreenRetained.zoom_x * 1024) / zoom_x);
+
+   roadmap_math_coordinate (&RoadMapScreenRetained.center, &point);
+   roadmap_math_rotate_coordinates (1, &point);
+
+   /* the canvas scales around its center */
+   offset->x = point.x - center_x -
+      ((RoadMapScreenRetained.point.x - center_x) * *scale) / 1024;
+   offset->y = point.y - center_y -
+      ((RoadMapScreenRetained.point.y - center_y) * *scale) / 1024;
+
+   return 1;
+}
+
+
+static int roadmap_screen_square_covered (int square) {
+
+   RoadMapArea edges;
+   RoadMapPosition corners[4];
+   RoadMapGuiPoint points[4];
+   int i;
+
+   roadmap_square_edges (square, &edges);
+
+   corners[0].longitude = edges.west;
+   corners[0].latitude = edges.north;
+   corners[1].longitude = edges.east;
+   corners[1].latitude = edges.north;
+   corners[2].longitude = edges.east;
+   corners[2].latitude = edges.south;
+   corners[3].longitude = edges.west;
+   corners[3].latitude = edges.south;
+
+   for (i = 0; i < 4; i++) {
+      roadmap_math_coordinate (corners + i, points + i);
+   }
+   roadmap_math_rotate_coordinates (4, points);
+
+   for (i = 0; i < 4; i++) {
+      if (points[i].x < RoadMapScreenCover.minx ||
+          points[i].x > RoadMapScreenCover.maxx ||
+          points[i].y < RoadMapScreenCover.miny ||
+          points[i].y > RoadMapScreenCover.maxy) {
+         return 0;
+      }
+   }
+
+   return 1;
+}
+#endif
+
+
 INLINE_DEC int roadmap_screen_repaint_square (int square, int pen_type,
                                           int layer_count, int *layers) {
 
@@ -2102,14 +2791,6 @@ INLINE_DEC int roadmap_screen_repaint_square (int square, int pen_type,
 
    if (pen_type == 0) roadmap_screen_draw_square_edges (square);
 
-#if 0
-   if (!SquareCache[square]) {
-      SquareCache[square] = roadmap_screen_cache_square (square, layers, layer_count);
-   }
-
-   if (SquareCache[square] == -1) return 0;
-#endif
-
    roadmap_log_push ("roadmap_screen_repaint_square");
 
    roadmap_square_edges (square, &edges);
@@ -2131,6 +2812,14 @@ INLINE_DEC int roadmap_screen_repaint_square (int square, int pen_type,
 
         category = layers[i];
 
+#ifndef J2ME
+        /* what the previous layer left pending is recorded with its own z;
+         * the layers are drawn in this order, the pen types above.
+         */
+        roadmap_screen_flush_lines ();
+        roadmap_screen_flush_points ();
+        RoadMapScreenDisplayZ = ((pen_type + 1) << 8) + (layer_count - 1 - i);
+#endif
         drawn += roadmap_screen_draw_square
                     (square, category, fully_visible, pen_type);
 
@@ -2159,7 +2848,12 @@ static void roadmap_screen_repaint_now (void) {
     int max_pen = roadmap_layer_max_pen();
     static int nomap;
     int use_only_main_pen = 0;
+    int square_consumer;
     RoadMapGuiPoint area;
+#ifdef ROADMAP_CANVAS_RETAIN
+    RoadMapGuiPoint retained_offset = {0, 0};
+    int retained_scale = 0;
+#endif
 
 #ifdef DEBUG_TIME
     int start_time;
@@ -2227,12 +2921,22 @@ static void roadmap_screen_repaint_now (void) {
     }
 #endif
 
+#ifdef ROADMAP_CANVAS_RETAIN
+    RoadMapScreenCoverValid =
+       RoadMapScreenFastRefresh &&
+       roadmap_screen_retained_move (&retained_offset, &retained_scale) &&
+       roadmap_canvas_retained_map_area
+          (retained_offset.x, retained_offset.y, retained_scale,
+           &RoadMapScreenCover);
+#endif
+
     if (in_view == NULL) {
        in_view = calloc (ROADMAP_MAX_VISIBLE, sizeof(int));
        roadmap_check_allocated(in_view);
     }
 
     roadmap_log_push ("roadmap_screen_repaint");
+    square_consumer = roadmap_square_set_consumer (ROADMAP_SQUARE_CONSUMER_SCREEN);
 
     /* Repaint the drawing buffer. */
 
@@ -2301,6 +3005,7 @@ static void roadmap_screen_repaint_now (void) {
 #endif
 
         dbg_time_end(DBG_TIME_T2);
+        roadmap_screen_display_begin ();
         max_pen--;
         for (k = 0; k <= max_pen; ++k) {
 
@@ -2326,6 +3031,12 @@ static void roadmap_screen_repaint_now (void) {
 #endif
            dbg_time_end(DBG_TIME_T3);
            for (j = count - 1; j >= 0; --j) {
+#ifdef ROADMAP_CANVAS_RETAIN
+              if (RoadMapScreenCoverValid &&
+                  roadmap_screen_square_covered (in_view[j])) {
+                 continue;
+              }
+#endif
               roadmap_square_set_current (in_view[j]);
 
               if (k == 0) {
@@ -2345,6 +3056,7 @@ static void roadmap_screen_repaint_now (void) {
         dbg_time_end(DBG_TIME_FULL);
         roadmap_screen_flush_lines ();
         roadmap_screen_flush_points ();
+        roadmap_screen_display_end ();
         dbg_time_start(DBG_TIME_FULL);
 
 #ifdef DEBUG_TIME
@@ -2378,6 +3090,15 @@ static void roadmap_screen_repaint_now (void) {
     }
 #endif
 
+#ifdef ROADMAP_CANVAS_RETAIN
+    if (RoadMapScreenCoverValid) {
+       roadmap_canvas_draw_retained_map
+          (retained_offset.x, retained_offset.y, retained_scale);
+    } else if (!RoadMapScreenFastRefresh) {
+       roadmap_screen_retain ();
+    }
+#endif
+
 #ifdef DEBUG_TIME
     end_time = NOPH_System_currentTimeMillis();
     printf ("roadmap_screen_repaint end drawing map %d ms\n", end_time - start_time);
@@ -2443,6 +3164,7 @@ static void roadmap_screen_repaint_now (void) {
     dbg_time_end(DBG_TIME_T4);
     roadmap_canvas_refresh ();
 
+    roadmap_square_set_consumer (square_consumer);
     roadmap_log_pop ();
     dbg_time_end(DBG_TIME_FULL);
 //    dbg_time_print();
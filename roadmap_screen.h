@@ -127,6 +127,9 @@ void roadmap_screen_touched(void);
 void roadmap_screen_touched_off(void);
 
 void roadmap_screen_mark_redraw (void);
+
+/* Drops the lines of the square projected for the previous frames */
+void roadmap_screen_clear_square (int square);
 int roadmap_screen_show_icons_only_when_touched(void);
 
 #define DBG_TIME_FULL 0
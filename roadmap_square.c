@@ -61,6 +61,9 @@
 #include "roadmap_hash.h"
 #include "roadmap_tile_manager.h"
 #include "roadmap_tile_status.h"
+#include "roadmap_screen.h"
+#include "roadmap_config.h"
+#include "roadmap_time.h"
 
 #include "roadmap_square.h"
 
@@ -96,19 +99,30 @@ typedef struct {
 } RoadMapSquareData;
 
 
+/* The cache keeps as many tiles as fit in the "Cache memory" budget, and
+ * no more than ROADMAP_SQUARE_CACHE_SIZE of them.
+ */
 #ifdef J2ME
 #define ROADMAP_SQUARE_CACHE_SIZE	64
+#define ROADMAP_SQUARE_CACHE_MEMORY	"1000000"
 #else
 #define ROADMAP_SQUARE_CACHE_SIZE	4096
+#define ROADMAP_SQUARE_CACHE_MEMORY	"48000000"
 #endif
 
 #define ROADMAP_SQUARE_UNAVAILABLE	((RoadMapSquareData *)-1)
 #define ROADMAP_SQUARE_NOT_LOADED	NULL
 
+#define SQUARE_TRACK_SECONDS		120
+#define SQUARE_TRACK_MIN_SPEED	10		/* knots */
+#define SQUARE_TRACK_STEERING		15		/* degrees */
+
 typedef struct {
 	int	square;
 	int	next;
 	int	prev;
+	int	size;		/* bytes of tile data */
+	int	pins;		/* not evicted while positive */
 } SquareCacheNode;
 
 typedef struct RoadMapSquareContext_t {
@@ -119,7 +133,8 @@ typedef struct RoadMapSquareContext_t {
    RoadMapSquareData **Square;
 
 	SquareCacheNode	SquareCache[ROADMAP_SQUARE_CACHE_SIZE + 1];
-	RoadMapHash			*SquareHash;
+	RoadMapHashMap		*SquareHash;
+	int					CacheBytes;
 } RoadMapSquareContext;
 
 
@@ -131,7 +146,34 @@ static int RoadMapSquareCurrentSlot = -1;
 
 static int RoadMapSquareForceUpdateMode = 0;
 
+static RoadMapConfigDescriptor RoadMapSquareCacheMemoryCfg =
+                        ROADMAP_CONFIG_ITEM("Tiles", "Cache memory");
+
+static int RoadMapSquareConsumer = ROADMAP_SQUARE_CONSUMER_OTHER;
+static RoadMapSquareStats RoadMapSquareConsumerStats[ROADMAP_SQUARE_CONSUMERS];
+
+/* The squares pinned by the last view, and the county they belong to */
+static int *RoadMapSquareViewPins = NULL;
+static int RoadMapSquareViewPinsCount = 0;
+static int RoadMapSquareViewPinsSize = 0;
+static struct RoadMapSquareContext_t *RoadMapSquareViewPinsContext = NULL;
+
 static void roadmap_square_unload_all (void);
+static void roadmap_square_evicted (int fips, int square);
+
+static int roadmap_square_cache_budget (void) {
+
+	static int declared = 0;
+
+	if (!declared) {
+		roadmap_config_declare
+			("preferences", &RoadMapSquareCacheMemoryCfg, ROADMAP_SQUARE_CACHE_MEMORY, NULL);
+		declared = 1;
+	}
+
+	return roadmap_config_get_integer (&RoadMapSquareCacheMemoryCfg);
+}
+
 
 static void *roadmap_square_map (const roadmap_db_data_file *file) {
 
@@ -163,10 +205,13 @@ static void *roadmap_square_map (const roadmap_db_data_file *file) {
 		context->SquareCache[i].square = -1;
 		context->SquareCache[i].next = (i + 1) % (ROADMAP_SQUARE_CACHE_SIZE + 1);
 		context->SquareCache[i].prev = (i + ROADMAP_SQUARE_CACHE_SIZE) % (ROADMAP_SQUARE_CACHE_SIZE + 1);
+		context->SquareCache[i].size = 0;
+		context->SquareCache[i].pins = 0;
 	}
+	context->CacheBytes = 0;
+
+	context->SquareHash = roadmap_hash_map_new ("tiles", ROADMAP_SQUARE_CACHE_SIZE); 
 
-	context->SquareHash = roadmap_hash_new ("tiles", ROADMAP_SQUARE_CACHE_SIZE); 
-	
    RoadMapSquareCurrent = -1;
 
    RoadMapSquareActive = NULL;
@@ -201,8 +246,12 @@ static void roadmap_square_unmap (void *context) {
    if (RoadMapSquareActive == square_context) {
       RoadMapSquareActive = NULL;
    }
+   if (RoadMapSquareViewPinsContext == square_context) {
+      RoadMapSquareViewPinsContext = NULL;
+      RoadMapSquareViewPinsCount = 0;
+   }
 
-   roadmap_hash_free (square_context->SquareHash);
+   roadmap_hash_map_free (square_context->SquareHash);
    free (square_context->Square);
    free (square_context);
 }
@@ -272,17 +321,7 @@ static void roadmap_square_unload (int slot) {
 
 static int roadmap_square_find (int square) {
 
-	int slot = roadmap_hash_get_first (RoadMapSquareActive->SquareHash, square);
-	
-	while (slot >= 0) {
-		
-		if (RoadMapSquareActive->SquareCache[slot].square == square)
-			return slot;
-			
-		slot = roadmap_hash_get_next (RoadMapSquareActive->SquareHash, slot);		
-	} 
-	
-	return -1;	
+	return roadmap_hash_map_get (RoadMapSquareActive->SquareHash, square, 0);
 }
 
 
@@ -303,37 +342,149 @@ static void roadmap_square_promote (int slot) {
 }
 
 
+/* Moves a slot to the end of the LRU list, to be reused first */
+static void roadmap_square_demote (int slot) {
+
+	SquareCacheNode *cache = RoadMapSquareActive->SquareCache;
+	
+	if (cache[ROADMAP_SQUARE_CACHE_SIZE].prev != slot) {
+		cache[cache[slot].next].prev = cache[slot].prev;
+		cache[cache[slot].prev].next = cache[slot].next;
+		
+		cache[slot].prev = cache[ROADMAP_SQUARE_CACHE_SIZE].prev;
+		cache[slot].next = ROADMAP_SQUARE_CACHE_SIZE;
+		
+		cache[cache[ROADMAP_SQUARE_CACHE_SIZE].prev].next = slot;
+		cache[ROADMAP_SQUARE_CACHE_SIZE].prev = slot;
+	}	
+}
+
+
+static void roadmap_square_free_slot (int slot) {
+
+	SquareCacheNode *node = RoadMapSquareActive->SquareCache + slot;
+
+	RoadMapSquareActive->Square[slot] = ROADMAP_SQUARE_NOT_LOADED;
+	RoadMapSquareActive->CacheBytes -= node->size;
+	node->square = -1;
+	node->size = 0;
+	node->pins = 0;
+	roadmap_square_demote (slot);
+}
+
+
+/* Called before the database of a tile is closed, whether the cache
+ * evicted it or it was closed elsewhere (e.g. replaced by a newer version):
+ * its slot is freed rather than kept in its place in the LRU.
+ */
+static void roadmap_square_evicted (int fips, int square) {
+
+	int slot;
+
+	if (RoadMapSquareActive == NULL || fips != roadmap_locator_active ()) return;
+
+	slot = roadmap_square_find (square);
+	if (slot < 0) return;
+
+	roadmap_hash_map_remove (RoadMapSquareActive->SquareHash, square, 0);
+	roadmap_square_free_slot (slot);
+}
+
+
+void roadmap_square_initialize (void) {
+
+	roadmap_db_set_evict_hook (roadmap_square_evicted);
+}
+
+
 static void roadmap_square_unload_all (void) {
 
+	SquareCacheNode *cache = RoadMapSquareActive->SquareCache;
 	int i;
 	
-	for (i = 1; i <= ROADMAP_SQUARE_CACHE_SIZE; i++) {
+	for (i = 0; i < ROADMAP_SQUARE_CACHE_SIZE; i++) {
 	
-		if (RoadMapSquareActive->SquareCache[i].square >= 0) {
+		if (cache[i].square >= 0) {
 			roadmap_square_unload (i);
-			RoadMapSquareActive->SquareCache[i].square = -1;
-		}		
-		RoadMapSquareActive->SquareCache[i].next = (i + 1) % (ROADMAP_SQUARE_CACHE_SIZE + 1);
-		RoadMapSquareActive->SquareCache[i].prev = (i + ROADMAP_SQUARE_CACHE_SIZE) % (ROADMAP_SQUARE_CACHE_SIZE + 1);
+		}
+	}
+
+	for (i = 0; i <= ROADMAP_SQUARE_CACHE_SIZE; i++) {
+
+		cache[i].square = -1;
+		cache[i].size = 0;
+		cache[i].pins = 0;
+		cache[i].next = (i + 1) % (ROADMAP_SQUARE_CACHE_SIZE + 1);
+		cache[i].prev = (i + ROADMAP_SQUARE_CACHE_SIZE) % (ROADMAP_SQUARE_CACHE_SIZE + 1);
 	}
+	RoadMapSquareActive->CacheBytes = 0;
 }
 
 
-static int roadmap_square_cache (int square) {
+static int roadmap_square_evictable (int slot) {
 
-	SquareCacheNode *node;
-	int slot = RoadMapSquareActive->SquareCache[ROADMAP_SQUARE_CACHE_SIZE].prev;
-	
 	// make sure not to unload the current tile
-	if (slot == RoadMapSquareCurrentSlot) {
-		slot = RoadMapSquareActive->SquareCache[slot].prev;
+	return slot != RoadMapSquareCurrentSlot &&
+			 RoadMapSquareActive->SquareCache[slot].pins == 0;
+}
+
+
+static void roadmap_square_evict (int slot) {
+
+	RoadMapSquareConsumerStats[RoadMapSquareConsumer].evictions++;
+	roadmap_square_unload (slot);
+
+	if (RoadMapSquareActive->SquareCache[slot].square >= 0) {
+		/* the tile was not open, only its slot was left */
+		roadmap_hash_map_remove (RoadMapSquareActive->SquareHash,
+										 RoadMapSquareActive->SquareCache[slot].square, 0);
+		roadmap_square_free_slot (slot);
 	}
-	node = RoadMapSquareActive->SquareCache + slot;
+}
+
+
+/* Finds a slot for a tile of the given size, evicting the least recently
+ * used tiles until it fits in the budget. Pinned tiles are skipped, unless
+ * all the slots are pinned.
+ */
+static int roadmap_square_cache (int square, int size) {
+
+	SquareCacheNode *cache = RoadMapSquareActive->SquareCache;
+	int budget = roadmap_square_cache_budget ();
+	int slot;
+	int prev;
+
+	for (slot = cache[ROADMAP_SQUARE_CACHE_SIZE].prev;
+		  slot != ROADMAP_SQUARE_CACHE_SIZE &&
+		  RoadMapSquareActive->CacheBytes + size > budget;
+		  slot = prev) {
+
+		prev = cache[slot].prev;
+		if (cache[slot].square >= 0 && roadmap_square_evictable (slot)) {
+			roadmap_square_evict (slot);
+		}
+	}
+
+	slot = cache[ROADMAP_SQUARE_CACHE_SIZE].prev;
+	while (slot != ROADMAP_SQUARE_CACHE_SIZE && !roadmap_square_evictable (slot)) {
+		slot = cache[slot].prev;
+	}
+
+	if (slot == ROADMAP_SQUARE_CACHE_SIZE) {
+		roadmap_log (ROADMAP_WARNING, "All %d cached tiles are pinned", ROADMAP_SQUARE_CACHE_SIZE);
+		slot = cache[ROADMAP_SQUARE_CACHE_SIZE].prev;
+		if (slot == RoadMapSquareCurrentSlot) {
+			slot = cache[slot].prev;
+		}
+	}
+
 	//printf ("Putting square %d in slot %d\n", square, slot);	
-	if (node->square >= 0) {
-		roadmap_square_unload (slot);
+	if (cache[slot].square >= 0) {
+		roadmap_square_evict (slot);
 	}
-	node->square = square;
+	cache[slot].square = square;
+	cache[slot].size = size;
+	RoadMapSquareActive->CacheBytes += size;
 	return slot;
 }
 
@@ -368,13 +519,14 @@ static void *roadmap_square_map_one (const roadmap_db_data_file *file) {
 							  &context->edges.north);
 		
 	RoadMapSquareCurrent = index;
-   slot = roadmap_square_cache (index);
+   slot = roadmap_square_cache (index, (int)roadmap_db_data_size (file));
 	RoadMapSquareActive->Square[slot] = context;
 	RoadMapSquareCurrentSlot = slot;
+	roadmap_square_promote (slot);
 
 	//printf ("roadmap_square_map_one: slot %d tile %d\n", RoadMapSquareCurrentSlot, RoadMapSquareCurrent);
 	
-	roadmap_hash_add (RoadMapSquareActive->SquareHash, index, slot);
+	roadmap_hash_map_set (RoadMapSquareActive->SquareHash, index, 0, slot);
 	
 
    for (j = 0; j < NUM_SUB_HANDLERS; j++) {
@@ -403,7 +555,7 @@ void roadmap_square_delete_reference (int square) {
 	
 	if (slot >= 0) {
 
-		roadmap_hash_remove (RoadMapSquareActive->SquareHash, square, slot);
+		roadmap_hash_map_remove (RoadMapSquareActive->SquareHash, square, 0);
 		RoadMapSquareActive->Square[slot] = ROADMAP_SQUARE_NOT_LOADED;
 	}
 }
@@ -470,6 +622,82 @@ int roadmap_square_get_attribute (int square, int attribute) {
 }
 
 
+int roadmap_square_pin (int square) {
+
+	int slot;
+
+	if (RoadMapSquareActive == NULL) return 0;
+
+	slot = roadmap_square_find (square);
+	if (slot < 0) return 0;
+
+	RoadMapSquareActive->SquareCache[slot].pins++;
+	return 1;
+}
+
+
+void roadmap_square_unpin (int square) {
+
+	int slot;
+
+	if (RoadMapSquareActive == NULL) return;
+
+	slot = roadmap_square_find (square);
+
+	/* the pins of a tile are dropped when it is closed */
+	if (slot >= 0 && RoadMapSquareActive->SquareCache[slot].pins > 0) {
+		RoadMapSquareActive->SquareCache[slot].pins--;
+	}
+}
+
+
+/* Replaces the squares pinned by the previous view with these ones */
+static void roadmap_square_pin_view (const int *square, int count) {
+
+	int i;
+
+	if (RoadMapSquareViewPinsContext == RoadMapSquareActive) {
+		for (i = 0; i < RoadMapSquareViewPinsCount; i++) {
+			roadmap_square_unpin (RoadMapSquareViewPins[i]);
+		}
+	}
+
+	if (count > RoadMapSquareViewPinsSize) {
+		RoadMapSquareViewPins = realloc (RoadMapSquareViewPins, count * sizeof (int));
+		roadmap_check_allocated (RoadMapSquareViewPins);
+		RoadMapSquareViewPinsSize = count;
+	}
+
+	RoadMapSquareViewPinsCount = 0;
+	for (i = 0; i < count; i++) {
+		if (roadmap_square_pin (square[i])) {
+			RoadMapSquareViewPins[RoadMapSquareViewPinsCount++] = square[i];
+		}
+	}
+	RoadMapSquareViewPinsContext = RoadMapSquareActive;
+}
+
+
+int roadmap_square_set_consumer (int consumer) {
+
+	int previous = RoadMapSquareConsumer;
+
+	if (consumer >= 0 && consumer < ROADMAP_SQUARE_CONSUMERS) {
+		RoadMapSquareConsumer = consumer;
+	}
+
+	return previous;
+}
+
+
+void roadmap_square_get_stats (int consumer, RoadMapSquareStats *stats) {
+
+	*stats = RoadMapSquareConsumerStats[consumer];
+	stats->mem_used = RoadMapSquareActive ? RoadMapSquareActive->CacheBytes : 0;
+	stats->mem_budget = roadmap_square_cache_budget ();
+}
+
+
 static int roadmap_square_location (const RoadMapPosition *position, int scale_index) {
 
 	return roadmap_tile_get_id_from_position (scale_index, position);
@@ -534,6 +762,60 @@ void roadmap_square_request_location (const RoadMapPosition *position) {
 }
 
 
+/* Prefetches the tiles the GPS track leads to, as far as it goes in
+ * SQUARE_TRACK_SECONDS at the current speed.
+ */
+void roadmap_square_request_track (const RoadMapPosition *position, int speed, int steering) {
+
+	static int last_square = -1;
+	static int last_steering = 0;
+	static int last_horizon = 0;
+	int horizon;
+	int step;
+	int distance;
+	int square;
+	int previous;
+	RoadMapPosition ahead;
+
+	if (speed < SQUARE_TRACK_MIN_SPEED) return;
+
+	/* knots to meters in SQUARE_TRACK_SECONDS, in the current units */
+	horizon = roadmap_math_to_current_unit (speed * 1852 / 36 * SQUARE_TRACK_SECONDS, "cm");
+
+	square = roadmap_square_location (position, 0);
+	if (square == last_square &&
+		 abs (steering - last_steering) < SQUARE_TRACK_STEERING &&
+		 horizon <= last_horizon) {
+		return;
+	}
+
+	/* half a tile, so that no tile along the track is skipped */
+	ahead = *position;
+	ahead.latitude += roadmap_tile_get_size (0) / 2;
+	step = roadmap_math_distance (position, &ahead);
+	if (step <= 0) return;
+
+	previous = square;
+	for (distance = step; distance <= horizon; distance += step) {
+
+		roadmap_math_position_ahead (position, steering, distance, &ahead);
+		square = roadmap_square_location (&ahead, 0);
+		if (square == previous) continue;
+
+		if (!roadmap_tile_prefetch (square, ROADMAP_TILE_STATUS_PRIORITY_TRACK, 0)) {
+			/* over budget, try again on the next fix */
+			last_square = -1;
+			return;
+		}
+		previous = square;
+	}
+
+	last_square = roadmap_square_location (position, 0);
+	last_steering = steering;
+	last_horizon = horizon;
+}
+
+
 int roadmap_square_search (const RoadMapPosition *position, int scale_index) {
 
    int square;
@@ -790,7 +1072,8 @@ int roadmap_square_view (int *square, int size) {
 
 			if (slot < 0) {
 				roadmap_tile_request (index, ROADMAP_TILE_STATUS_PRIORITY_ON_SCREEN, 0, NULL);
-				if (roadmap_square_set_current (index)) {
+				if (!roadmap_square_prefetch (index) &&
+					 roadmap_square_set_current (index)) {
 					slot = roadmap_square_find (index);
 				}
 			}
@@ -815,6 +1098,10 @@ int roadmap_square_view (int *square, int size) {
       }
    }
 
+	if (size > 0) {
+		roadmap_square_pin_view (square, count < size ? count : size);
+	}
+
 #ifndef J2ME
 	roadmap_square_get_tiles (&peripheral, RoadMapScaleCurrent);
 #endif
@@ -875,8 +1162,69 @@ void roadmap_square_rebuild_index (void) {
 }
 
 
+static int RoadMapSquarePrefetchPosting = 0;
+
+static void roadmap_square_prefetch_done (int fips, int square, void *prepared, void *context) {
+
+	int *status;
+	int res;
+
+	if (prepared) {
+		res = roadmap_locator_load_tile_prepared (fips, square, prepared);
+	} else {
+		/* not in the storage, the map file may still have it */
+		res = roadmap_locator_load_tile (square);
+	}
+
+	status = roadmap_tile_status_get (square);
+	if (status != NULL) {
+		*status = (*status) | ROADMAP_TILE_STATUS_FLAG_CHECKED;
+	}
+
+	if (res == ROADMAP_US_OK) {
+		if (status != NULL) {
+			*status = (*status) | ROADMAP_TILE_STATUS_FLAG_EXISTS;
+		}
+		/* when read inline, the screen is being drawn right now */
+		if (!RoadMapSquarePrefetchPosting) {
+			roadmap_screen_refresh ();
+		}
+	}
+}
+
+
+/* Reads the square in the background; returns 1 while it is being read,
+ * 0 if it must be read now or does not exist.
+ */
+int roadmap_square_prefetch (int square) {
+
+	int fips = roadmap_locator_active ();
+	int *status;
+
+	if (roadmap_db_pending (fips, square)) return 1;
+
+	status = roadmap_tile_status_get (square);
+	if (status == NULL) return 0;
+
+	if (((*status) & ROADMAP_TILE_STATUS_FLAG_CHECKED) &&
+		 !((*status) & ROADMAP_TILE_STATUS_FLAG_EXISTS)) {
+		return 0;
+	}
+
+	/* CHECKED is set when the read is done, until then the square is
+	 * read synchronously by roadmap_square_set_current
+	 */
+	RoadMapSquarePrefetchPosting = 1;
+	roadmap_db_prepare (fips, square, NULL, 0, roadmap_square_prefetch_done, NULL);
+	RoadMapSquarePrefetchPosting = 0;
+
+	return roadmap_db_pending (fips, square);
+}
+
+
 int roadmap_square_set_current_internal (int square) {
 
+   RoadMapSquareStats *stats = RoadMapSquareConsumerStats + RoadMapSquareConsumer;
    int j;
    int slot;
 
@@ -884,11 +1232,13 @@ int roadmap_square_set_current_internal (int square) {
    if (slot < 0) {
 			
 		int res;
+		uint32_t start;
 		int *status = roadmap_tile_status_get (square);
 		
 		if (status != NULL) {
 			
-			if ((*status) & ROADMAP_TILE_STATUS_FLAG_CHECKED) {
+			if (((*status) & ROADMAP_TILE_STATUS_FLAG_CHECKED) &&
+				 !roadmap_db_pending (roadmap_locator_active (), square)) {
 				if (!((*status) & ROADMAP_TILE_STATUS_FLAG_EXISTS)) {
 					return 0;
 				}
@@ -896,7 +1246,10 @@ int roadmap_square_set_current_internal (int square) {
 			*status = (*status) | ROADMAP_TILE_STATUS_FLAG_CHECKED;	
 		}
 		
+		start = roadmap_time_get_millis ();
 		res = roadmap_square_load (square);
+		stats->load_ms += (int)(roadmap_time_get_millis () - start);
+		stats->misses++;
 		
 		switch (res) {
 		case ROADMAP_US_OK:
@@ -920,6 +1273,8 @@ int roadmap_square_set_current_internal (int square) {
 		default:
 			roadmap_log (ROADMAP_FATAL, "Invalid status %d from roadmap_square_load (%08x)", status, square); 
 		}
+	} else {
+		stats->hits++;
 	}
 
 	if (slot >= 0) {		
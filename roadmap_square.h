@@ -33,6 +33,22 @@
 #define ROADMAP_SQUARE_OTHER  -2
 
 #define ROADMAP_SQUARE_ATTR_ON_SCREEN	0x0001
+
+/* Who the squares are loaded for, to account the cache per consumer */
+#define ROADMAP_SQUARE_CONSUMER_OTHER	0
+#define ROADMAP_SQUARE_CONSUMER_SCREEN	1
+#define ROADMAP_SQUARE_CONSUMER_ROUTE	2
+#define ROADMAP_SQUARE_CONSUMERS			3
+
+typedef struct {
+	int hits;			/* square made current from the cache */
+	int misses;			/* square read from the storage */
+	int evictions;
+	int load_ms;		/* time spent reading the missed squares */
+	int mem_used;		/* bytes of tile data in the cache */
+	int mem_budget;
+} RoadMapSquareStats;
+
 extern int RoadMapSquareCurrent;
 extern int RoadMapScaleCurrent;
 
@@ -80,6 +96,7 @@ int 	roadmap_square_reset_attribute (int square, int attribute);
 int 	roadmap_square_get_attribute (int square, int attribute);
 
 void 	roadmap_square_request_location (const RoadMapPosition *position);
+void 	roadmap_square_request_track (const RoadMapPosition *position, int speed, int steering);
 int   roadmap_square_search (const RoadMapPosition *position, int scale_index);
 int 	roadmap_square_find_neighbours (const RoadMapPosition *position, int scale_index, int squares[9]);
 void  roadmap_square_min    (int square, RoadMapPosition *position);
@@ -87,16 +104,29 @@ void  roadmap_square_min    (int square, RoadMapPosition *position);
 void  roadmap_square_edges  (int square, RoadMapArea *edges);
 int   roadmap_square_cross_pos (RoadMapPosition *position);
 
+/* A pinned square is not evicted from the cache until it is unpinned as
+ * many times; only a loaded square can be pinned.
+ */
+int 	roadmap_square_pin (int square);
+void 	roadmap_square_unpin (int square);
+
+/* Returns the previous consumer, to be restored when done */
+int 	roadmap_square_set_consumer (int consumer);
+void 	roadmap_square_get_stats (int consumer, RoadMapSquareStats *stats);
+
 void 	roadmap_square_force_next_update (void);
+/* The squares returned stay pinned until the next call */
 int   roadmap_square_view (int *square, int size);
 int   roadmap_square_first_point  (int square);
 int   roadmap_square_points_count (int square);
 int   roadmap_square_has_shapes   (int square);
 int   roadmap_square_first_shape  (int square);
 
+void 	roadmap_square_initialize (void);
 void 	roadmap_square_load_index (void);
 void  roadmap_square_rebuild_index (void);
 int   roadmap_square_set_current (int square);
+int   roadmap_square_prefetch (int square);
 int	roadmap_square_active (void);
 
 void	roadmap_square_adjust_scale (int zoom_factor);
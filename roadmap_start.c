@@ -37,6 +37,7 @@
 #include "roadmap_copyright.h"
 #include "roadmap_dbread.h"
 #include "roadmap_math.h"
+#include "roadmap_square.h"
 #include "roadmap_string.h"
 #include "roadmap_config.h"
 #include "roadmap_history.h"
@@ -144,6 +145,7 @@ const char*   grid_menu_labels[256];
 
 
 #include "navigate/navigate_main.h"
+#include "navigate/navigate_bench.h"
 #include "editor/editor_main.h"
 #include "editor/editor_screen.h"
 #include "editor/db/editor_db.h"
@@ -2486,6 +2488,7 @@ void roadmap_start (int argc, char **argv) {
    roadmap_option_initialize   ();
    roadmap_alerter_initialize  ();
    roadmap_math_initialize     ();
+   roadmap_square_initialize   ();
    roadmap_trip_initialize     ();
    roadmap_pointer_initialize  ();
    roadmap_screen_initialize   ();
@@ -2642,6 +2645,11 @@ void roadmap_start_continue(void)   {
 #endif
    roadmap_start_set_closed_properly("no");
 
+   if (roadmap_route_bench_source () != NULL) {
+      navigate_bench_run (roadmap_route_bench_source (), NULL);
+      roadmap_main_exit ();
+      return;
+   }
 
    //do_alloc_trace = 1;
 }
@@ -0,0 +1,639 @@
+/* roadmap_tile_archive.c - Packed tile storage.
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009 Ehud Shabtai.
+ *
+ *   This file is part of Waze.
+ *
+ *   Waze is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Waze is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Waze; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * SYNOPSYS:
+ *
+ *   See roadmap_tile_archive.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "roadmap.h"
+#include "roadmap_file.h"
+#include "roadmap_path.h"
+#include "roadmap_dbread.h"
+#include "roadmap_data_format.h"
+#include "roadmap_tile_archive.h"
+
+/* records start on a page, so that a tile can be mapped where it is; the
+ * first page holds the file header.
+ */
+#define ARCHIVE_RECORD_ALIGN     4096
+#define ARCHIVE_FIRST_RECORD     ARCHIVE_RECORD_ALIGN
+
+/* the index is rewritten after this many records were added or removed;
+ * records added since are recovered from the data file anyway.
+ */
+#define ARCHIVE_INDEX_CHANGES    64
+
+#define ARCHIVE_COMPACT_MIN_SIZE (1024 * 1024)
+#define ARCHIVE_COMPACT_PERCENT  50
+
+#define ARCHIVE_TEMP_TYPE        ".tmp"
+
+typedef struct {
+
+   int                     fips;    /* -1 when no archive is open */
+   RoadMapFile             file;
+
+   roadmap_archive_entry   *index;
+   int                     num_tiles;
+   int                     max_tiles;
+
+   unsigned int            data_end;
+   unsigned int            garbage;
+   int                     changes;
+} TileArchive;
+
+static TileArchive Archive = {-1, ROADMAP_INVALID_FILE, NULL, 0, 0, 0, 0, 0};
+
+
+static void reset_archive (void) {
+
+   memset (&Archive, 0, sizeof (Archive));
+   Archive.fips = -1;
+   Archive.file = ROADMAP_INVALID_FILE;
+}
+
+
+static const char *archive_filename (int fips, const char *type) {
+
+   static char filename[512];
+   char name[30];
+
+   snprintf (name, sizeof (name), "%05d_tiles%s", fips, type);
+   roadmap_path_format (filename, sizeof (filename), roadmap_db_map_path (), name);
+
+   return filename;
+}
+
+
+static unsigned int record_capacity (size_t size) {
+
+   return ((ROADMAP_ARCHIVE_DATA_OFFSET + size + ARCHIVE_RECORD_ALIGN - 1) &
+           ~(ARCHIVE_RECORD_ALIGN - 1)) - ROADMAP_ARCHIVE_DATA_OFFSET;
+}
+
+
+/* Returns the position of the tile in the index, or -(insert position + 1) */
+static int find_entry (int tile_index) {
+
+   int hi = Archive.num_tiles - 1;
+   int lo = 0;
+
+   while (hi >= lo) {
+
+      int mid = (hi + lo) / 2;
+      int tile_id = Archive.index[mid].tile_id;
+
+      if (tile_index < tile_id) {
+         hi = mid - 1;
+      } else if (tile_index > tile_id) {
+         lo = mid + 1;
+      } else {
+         return mid;
+      }
+   }
+
+   return -(lo + 1);
+}
+
+
+static void remove_entry (int i) {
+
+   Archive.garbage += ROADMAP_ARCHIVE_DATA_OFFSET + Archive.index[i].capacity;
+
+   memmove (Archive.index + i, Archive.index + i + 1,
+            (Archive.num_tiles - i - 1) * sizeof (roadmap_archive_entry));
+   Archive.num_tiles--;
+}
+
+
+static int set_entry (int tile_index, unsigned int offset, unsigned int capacity,
+                      unsigned int size) {
+
+   int i = find_entry (tile_index);
+
+   if (i >= 0) {
+      Archive.garbage += ROADMAP_ARCHIVE_DATA_OFFSET + Archive.index[i].capacity;
+   } else {
+
+      i = -i - 1;
+
+      if (Archive.num_tiles == Archive.max_tiles) {
+         int max_tiles = Archive.max_tiles ? Archive.max_tiles * 2 : 256;
+         roadmap_archive_entry *index =
+            realloc (Archive.index, max_tiles * sizeof (roadmap_archive_entry));
+
+         if (!index) return -1;
+         Archive.index = index;
+         Archive.max_tiles = max_tiles;
+      }
+
+      memmove (Archive.index + i + 1, Archive.index + i,
+               (Archive.num_tiles - i) * sizeof (roadmap_archive_entry));
+      Archive.num_tiles++;
+   }
+
+   Archive.index[i].tile_id = tile_index;
+   Archive.index[i].offset = offset;
+   Archive.index[i].capacity = capacity;
+   Archive.index[i].size = size;
+
+   return 0;
+}
+
+
+static int write_header (RoadMapFile file) {
+
+   roadmap_data_file_header header;
+
+   memcpy (header.signature, ROADMAP_ARCHIVE_SIGNATURE, sizeof (header.signature));
+   header.endianness = ROADMAP_DATA_ENDIAN_CORRECT;
+   header.version = ROADMAP_ARCHIVE_CURRENT_VERSION;
+
+   return roadmap_file_seek (file, 0, ROADMAP_SEEK_START) < 0 ||
+          roadmap_file_write (file, &header, sizeof (header)) != (int)sizeof (header);
+}
+
+
+/* Writes a record and its tile at offset. The file is extended to the end
+ * of the record, so that its length covers the data end of the index.
+ */
+static int write_record (RoadMapFile file, unsigned int offset, int tile_index,
+                         const void *data, size_t size, unsigned int capacity) {
+
+   char head[ROADMAP_ARCHIVE_DATA_OFFSET];
+   roadmap_archive_record *record = (roadmap_archive_record *)head;
+   char end = 0;
+
+   memset (head, 0, sizeof (head));
+   record->tile_id = tile_index;
+   record->size = size;
+   record->capacity = capacity;
+
+   if (roadmap_file_seek (file, offset, ROADMAP_SEEK_START) < 0 ||
+       roadmap_file_write (file, head, sizeof (head)) != (int)sizeof (head) ||
+       roadmap_file_write (file, data, size) != (int)size) {
+      return -1;
+   }
+
+   if (capacity > size &&
+       (roadmap_file_seek (file, offset + ROADMAP_ARCHIVE_DATA_OFFSET + capacity - 1,
+                           ROADMAP_SEEK_START) < 0 ||
+        roadmap_file_write (file, &end, 1) != 1)) {
+      return -1;
+   }
+
+   return 0;
+}
+
+
+static int check_header (const roadmap_data_file_header *header, const char *signature) {
+
+   return !memcmp (header->signature, signature, sizeof (header->signature)) &&
+          header->endianness == ROADMAP_DATA_ENDIAN_CORRECT &&
+          header->version == ROADMAP_ARCHIVE_CURRENT_VERSION;
+}
+
+
+static void write_index (void) {
+
+   const char *name = archive_filename (Archive.fips, ROADMAP_ARCHIVE_INDEX_TYPE);
+   roadmap_archive_index_header header;
+   int size = Archive.num_tiles * sizeof (roadmap_archive_entry);
+   RoadMapFile file = roadmap_file_open (name, "w");
+
+   if (!ROADMAP_FILE_IS_VALID (file)) {
+      roadmap_log (ROADMAP_ERROR, "Can't write tile archive index %s", name);
+      return;
+   }
+
+   memcpy (header.general_header.signature, ROADMAP_ARCHIVE_INDEX_SIGNATURE,
+           sizeof (header.general_header.signature));
+   header.general_header.endianness = ROADMAP_DATA_ENDIAN_CORRECT;
+   header.general_header.version = ROADMAP_ARCHIVE_CURRENT_VERSION;
+   header.data_end = Archive.data_end;
+   header.num_tiles = Archive.num_tiles;
+
+   if (roadmap_file_write (file, &header, sizeof (header)) != (int)sizeof (header) ||
+       roadmap_file_write (file, Archive.index, size) != size) {
+      roadmap_log (ROADMAP_ERROR, "Can't write tile archive index %s", name);
+   } else {
+      Archive.changes = 0;
+   }
+
+   roadmap_file_close (file);
+}
+
+
+/* Loads the index written last; returns the data offset it covers */
+static unsigned int read_index (unsigned int length) {
+
+   const char *name = archive_filename (Archive.fips, ROADMAP_ARCHIVE_INDEX_TYPE);
+   roadmap_archive_index_header header;
+   RoadMapFile file = roadmap_file_open (name, "r");
+   unsigned int live = 0;
+   int size;
+   int i;
+
+   if (!ROADMAP_FILE_IS_VALID (file)) return ARCHIVE_FIRST_RECORD;
+
+   if (roadmap_file_read (file, &header, sizeof (header)) != (int)sizeof (header) ||
+       !check_header (&header.general_header, ROADMAP_ARCHIVE_INDEX_SIGNATURE) ||
+       header.data_end < ARCHIVE_FIRST_RECORD ||
+       header.data_end > length ||
+       header.num_tiles < 0) {
+
+      roadmap_file_close (file);
+      return ARCHIVE_FIRST_RECORD;
+   }
+
+   size = header.num_tiles * sizeof (roadmap_archive_entry);
+   Archive.index = malloc (size + sizeof (roadmap_archive_entry));
+
+   if (!Archive.index ||
+       roadmap_file_read (file, Archive.index, size) != size) {
+
+      roadmap_log (ROADMAP_ERROR, "Bad tile archive index %s, rebuilding", name);
+      free (Archive.index);
+      Archive.index = NULL;
+      roadmap_file_close (file);
+      return ARCHIVE_FIRST_RECORD;
+   }
+   roadmap_file_close (file);
+
+   /* the tiles are mapped, so none may be outside of the data file */
+   for (i = 0; i < header.num_tiles; i++) {
+
+      roadmap_archive_entry *entry = Archive.index + i;
+
+      if (entry->offset < ARCHIVE_FIRST_RECORD ||
+          entry->size > entry->capacity ||
+          entry->offset + ROADMAP_ARCHIVE_DATA_OFFSET + entry->capacity > header.data_end) {
+
+         roadmap_log (ROADMAP_ERROR, "Bad tile archive index %s, rebuilding", name);
+         free (Archive.index);
+         Archive.index = NULL;
+         return ARCHIVE_FIRST_RECORD;
+      }
+      live += ROADMAP_ARCHIVE_DATA_OFFSET + entry->capacity;
+   }
+
+   Archive.num_tiles = Archive.max_tiles = header.num_tiles;
+   Archive.garbage = header.data_end - ARCHIVE_FIRST_RECORD - live;
+
+   return header.data_end;
+}
+
+
+/* Adds the records written after the index, which override older ones */
+static void scan_records (unsigned int offset, unsigned int length) {
+
+   roadmap_archive_record record;
+
+   while (offset + ROADMAP_ARCHIVE_DATA_OFFSET <= length) {
+
+      if (roadmap_file_read_at (Archive.file, offset, &record, sizeof (record)) != (int)sizeof (record) ||
+          record.size > record.capacity ||
+          offset + ROADMAP_ARCHIVE_DATA_OFFSET + record.capacity > length) {
+         /* a record whose write was interrupted */
+         break;
+      }
+
+      if (record.tile_id == -1) {
+         Archive.garbage += ROADMAP_ARCHIVE_DATA_OFFSET + record.capacity;
+      } else if (set_entry (record.tile_id, offset, record.capacity, record.size) < 0) {
+         break;
+      }
+      offset += ROADMAP_ARCHIVE_DATA_OFFSET + record.capacity;
+      Archive.changes++;
+   }
+
+   Archive.data_end = offset;
+}
+
+
+static void close_archive (void) {
+
+   if (Archive.fips < 0) return;
+
+   if (Archive.changes) write_index ();
+
+   roadmap_file_close (Archive.file);
+   free (Archive.index);
+   reset_archive ();
+}
+
+
+static int open_archive (int fips) {
+
+   char name[512];
+   roadmap_data_file_header header;
+   int length;
+
+   if (Archive.fips == fips) return 0;
+
+   close_archive ();
+
+   strncpy_safe (name, archive_filename (fips, ROADMAP_ARCHIVE_TYPE), sizeof (name));
+
+   if (!roadmap_file_exists (NULL, name)) {
+      /* a compaction stopped after it removed the old data file; its
+       * copy was complete by then.
+       */
+      const char *temp_name = archive_filename (fips, ARCHIVE_TEMP_TYPE);
+
+      if (roadmap_file_exists (NULL, temp_name)) roadmap_file_rename (temp_name, name);
+   }
+
+   Archive.file = roadmap_file_open (name, "rw");
+   if (!ROADMAP_FILE_IS_VALID (Archive.file)) {
+      roadmap_log (ROADMAP_ERROR, "Can't open tile archive %s", name);
+      return -1;
+   }
+
+   length = roadmap_file_length (NULL, name);
+
+   if (length >= (int)sizeof (header) &&
+       (roadmap_file_read (Archive.file, &header, sizeof (header)) != (int)sizeof (header) ||
+        !check_header (&header, ROADMAP_ARCHIVE_SIGNATURE))) {
+
+      /* another format: the tiles are downloaded again */
+      roadmap_log (ROADMAP_WARNING, "Bad tile archive format %s, starting a new one", name);
+      roadmap_file_close (Archive.file);
+      roadmap_file_remove (NULL, name);
+      roadmap_file_remove (NULL, archive_filename (fips, ROADMAP_ARCHIVE_INDEX_TYPE));
+
+      Archive.file = roadmap_file_open (name, "rw");
+      if (!ROADMAP_FILE_IS_VALID (Archive.file)) {
+         roadmap_log (ROADMAP_ERROR, "Can't open tile archive %s", name);
+         return -1;
+      }
+      length = 0;
+   }
+
+   if (length < (int)sizeof (header)) {
+      if (write_header (Archive.file)) {
+         roadmap_log (ROADMAP_ERROR, "Can't initialize tile archive %s", name);
+         roadmap_file_close (Archive.file);
+         return -1;
+      }
+      length = sizeof (header);
+   }
+
+   Archive.fips = fips;
+   scan_records (read_index (length), length);
+
+   roadmap_log (ROADMAP_INFO, "Opened tile archive %s: %d tiles, %u bytes, %u free",
+                name, Archive.num_tiles, Archive.data_end, Archive.garbage);
+   return 0;
+}
+
+
+static void mark_free (unsigned int offset) {
+
+   int free_id = -1;
+
+   if (roadmap_file_seek (Archive.file, offset, ROADMAP_SEEK_START) >= 0) {
+      roadmap_file_write (Archive.file, &free_id, sizeof (free_id));
+   }
+}
+
+
+int roadmap_tile_archive_load (int fips, int tile_index, void **data, size_t *size) {
+
+   roadmap_archive_entry *entry;
+   int i;
+
+   if (open_archive (fips)) return -1;
+
+   i = find_entry (tile_index);
+   if (i < 0) return -1;
+
+   entry = Archive.index + i;
+
+   *data = malloc (entry->size);
+   if (!*data) return -1;
+
+   if (roadmap_file_read_at (Archive.file, entry->offset + ROADMAP_ARCHIVE_DATA_OFFSET,
+                             *data, entry->size) != (int)entry->size) {
+
+      roadmap_log (ROADMAP_ERROR, "Bad tile archive record for tile %d", tile_index);
+      free (*data);
+      remove_entry (i);
+      Archive.changes++;
+      return -1;
+   }
+
+   *size = entry->size;
+   return 0;
+}
+
+
+#ifdef ROADMAP_TILE_MAPPING
+int roadmap_tile_archive_map (int fips, int tile_index, void **data, size_t *size,
+                              RoadMapFileContext *file) {
+
+   roadmap_archive_entry *entry;
+   int i;
+
+   if (open_archive (fips)) return -1;
+
+   i = find_entry (tile_index);
+   if (i < 0) return -1;
+
+   entry = Archive.index + i;
+
+   *file = roadmap_file_map_range (Archive.file, entry->offset + ROADMAP_ARCHIVE_DATA_OFFSET,
+                                   entry->size, "c");
+   if (*file == NULL) return -1;
+
+   *data = roadmap_file_base (*file);
+   *size = entry->size;
+   return 0;
+}
+#endif
+
+
+int roadmap_tile_archive_exists (int fips, int tile_index) {
+
+   if (open_archive (fips)) return 0;
+
+   return find_entry (tile_index) >= 0;
+}
+
+
+/* The new version of the tile is written to a new record, and the old one
+ * is freed after: a write cut short never damages a tile in use. The free
+ * records are reclaimed by roadmap_tile_archive_compact.
+ */
+int roadmap_tile_archive_store (int fips, int tile_index, const void *data, size_t size) {
+
+   unsigned int capacity = record_capacity (size);
+   unsigned int offset;
+   int old_offset = -1;
+   int i;
+
+   if (open_archive (fips)) return -1;
+
+   offset = Archive.data_end;
+
+   if (write_record (Archive.file, offset, tile_index, data, size, capacity)) {
+      roadmap_log (ROADMAP_ERROR, "Can't write tile %d to the tile archive", tile_index);
+      return -1;
+   }
+   Archive.data_end += ROADMAP_ARCHIVE_DATA_OFFSET + capacity;
+
+   i = find_entry (tile_index);
+   if (i >= 0) old_offset = (int)Archive.index[i].offset;
+
+   if (set_entry (tile_index, offset, capacity, size) < 0) {
+      /* found again when the records are scanned */
+      return -1;
+   }
+   Archive.changes++;
+
+   if (old_offset >= 0) mark_free (old_offset);
+
+   if (Archive.changes >= ARCHIVE_INDEX_CHANGES) write_index ();
+
+   return 0;
+}
+
+
+void roadmap_tile_archive_remove (int fips, int tile_index) {
+
+   int i;
+
+   if (open_archive (fips)) return;
+
+   i = find_entry (tile_index);
+   if (i < 0) return;
+
+   mark_free (Archive.index[i].offset);
+   remove_entry (i);
+   Archive.changes++;
+}
+
+
+/* Copies the live records to a new data file, which then replaces the old one */
+int roadmap_tile_archive_compact (int fips) {
+
+   char name[512];
+   char temp_name[512];
+   char index_name[512];
+   RoadMapFile temp;
+   unsigned int offset = ARCHIVE_FIRST_RECORD;
+   int res = 0;
+   int i;
+
+   if (open_archive (fips)) return -1;
+
+   strncpy_safe (name, archive_filename (fips, ROADMAP_ARCHIVE_TYPE), sizeof (name));
+   strncpy_safe (index_name, archive_filename (fips, ROADMAP_ARCHIVE_INDEX_TYPE), sizeof (index_name));
+   strncpy_safe (temp_name, archive_filename (fips, ARCHIVE_TEMP_TYPE), sizeof (temp_name));
+
+   temp = roadmap_file_open (temp_name, "w");
+   if (!ROADMAP_FILE_IS_VALID (temp)) return -1;
+
+   if (write_header (temp)) res = -1;
+
+   for (i = 0; i < Archive.num_tiles && res == 0; i++) {
+
+      roadmap_archive_entry *entry = Archive.index + i;
+      unsigned int capacity = record_capacity (entry->size);
+      void *data = malloc (entry->size);
+
+      if (!data ||
+          roadmap_file_read_at (Archive.file, entry->offset + ROADMAP_ARCHIVE_DATA_OFFSET,
+                                data, entry->size) != (int)entry->size ||
+          write_record (temp, offset, entry->tile_id, data, entry->size, capacity)) {
+         res = -1;
+      }
+      free (data);
+
+      entry->offset = offset;
+      entry->capacity = capacity;
+      offset += ROADMAP_ARCHIVE_DATA_OFFSET + capacity;
+   }
+
+   roadmap_file_close (temp);
+   roadmap_file_close (Archive.file);
+
+   if (res == 0) {
+
+      /* The index describes the old offsets: without it the records of
+       * whichever data file is left are scanned again on the next open.
+       */
+      roadmap_file_remove (NULL, index_name);
+
+      if (roadmap_file_rename (temp_name, name) != 0) {
+         /* where a rename can't replace a file, the copy is recovered
+          * by open_archive if we stop in between.
+          */
+         roadmap_file_remove (NULL, name);
+         res = roadmap_file_rename (temp_name, name);
+      }
+   } else {
+      roadmap_file_remove (NULL, temp_name);
+   }
+
+   if (res != 0) {
+      /* reopen the data file which is left, as it was */
+      roadmap_log (ROADMAP_ERROR, "Tile archive compaction failed");
+      free (Archive.index);
+      reset_archive ();
+      open_archive (fips);
+      return -1;
+   }
+
+   Archive.file = roadmap_file_open (name, "rw");
+   if (!ROADMAP_FILE_IS_VALID (Archive.file)) {
+      free (Archive.index);
+      reset_archive ();
+      return -1;
+   }
+
+   roadmap_log (ROADMAP_INFO, "Compacted tile archive %s from %u to %u bytes",
+                name, Archive.data_end, offset);
+
+   Archive.data_end = offset;
+   Archive.garbage = 0;
+   write_index ();
+
+   return 0;
+}
+
+
+void roadmap_tile_archive_close (void) {
+
+   if (Archive.fips >= 0 &&
+       Archive.data_end > ARCHIVE_COMPACT_MIN_SIZE &&
+       Archive.garbage > Archive.data_end / 100 * ARCHIVE_COMPACT_PERCENT) {
+      roadmap_tile_archive_compact (Archive.fips);
+   }
+
+   close_archive ();
+}
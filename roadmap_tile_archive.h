@@ -0,0 +1,59 @@
+/* roadmap_tile_archive.h - Packed tile storage.
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009 Ehud Shabtai.
+ *
+ *   This file is part of Waze.
+ *
+ *   Waze is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Waze is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Waze; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * DESCRIPTION:
+ *
+ *   The tiles of a county are kept in a single data file, each in a record
+ *   which starts on a page, so that the tile can be mapped in place. An
+ *   updated tile is appended and its old record freed. A sorted index of
+ *   the records is loaded in memory, so a lookup is a binary search and a
+ *   single read. The data file is compacted when it is closed with more
+ *   than half of it in free records. Tile index -1 marks a free record and
+ *   can't be stored.
+ */
+#ifndef ROADMAP_TILE_ARCHIVE_H_
+#define ROADMAP_TILE_ARCHIVE_H_
+
+#include <stdlib.h>
+
+#include "roadmap_file.h"
+#include "roadmap_tile_storage.h"
+
+int  roadmap_tile_archive_load   (int fips, int tile_index, void **data, size_t *size);
+int  roadmap_tile_archive_store  (int fips, int tile_index, const void *data, size_t size);
+void roadmap_tile_archive_remove (int fips, int tile_index);
+int  roadmap_tile_archive_exists (int fips, int tile_index);
+
+#ifdef ROADMAP_TILE_MAPPING
+/* Maps the tile where it is in the data file, until it is unmapped */
+int  roadmap_tile_archive_map    (int fips, int tile_index, void **data, size_t *size,
+                                  RoadMapFileContext *file);
+#endif
+
+int  roadmap_tile_archive_compact (int fips);
+
+/* Writes the index and closes the data file, compacting it if needed.
+ * Called once the tile worker is stopped, as the compaction may be long.
+ */
+void roadmap_tile_archive_close (void);
+
+#endif /*ROADMAP_TILE_ARCHIVE_H_*/
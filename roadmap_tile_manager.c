@@ -37,9 +37,11 @@
 #include "roadmap_locator.h"
 #include "roadmap_data_format.h"
 #include "roadmap_label.h"
+#include "roadmap_screen.h"
 #include "roadmap_square.h"
 #include "roadmap_main.h"
 #include "roadmap_config.h"
+#include "roadmap_dbread.h"
 #include "navigate/navigate_graph.h"
 #include "Realtime/Realtime.h"
 #include "roadmap_street.h"
@@ -51,10 +53,12 @@
 #elif defined(IPHONE) || defined(ANDROID)
 #define	TM_MAX_CONCURRENT		3
 #else
-#define	TM_MAX_CONCURRENT		1
+/* requests are pipelined on a couple of connections */
+#define	TM_MAX_CONCURRENT		4
 #endif
 
 #define TM_MAX_QUEUE						256
+#define TM_MAX_BATCH						16
 #define TM_RETRY_CONNECTION_SECONDS	30
 #define TM_HTTP_TIMEOUT_SECONDS		30
 
@@ -70,6 +74,47 @@ typedef struct {
 	HttpAsyncContext	*http_context;
 } ConnectionContext;
 
+/* A batch request fetches several queued tiles at once, from the
+ * "Download, Tiles Batch" url (batch requests are off when it is empty):
+ *
+ *    <url>?fips=<fips>&tiles=<tile>.<time>,<tile>.<time>,...
+ *
+ * where the tile index and the time of the stored version are in hex.
+ * The response is a
+ * sequence of parts, each one a header of two 32 bit big endian numbers
+ * (the tile index and the size of the tile data) followed by the data. A
+ * size of 0 or less means that the tile was not modified since the time
+ * given in the request, or is not available. The parts are stored as soon
+ * as they arrive.
+ */
+#define TM_BATCH_PART_HEADER				8
+#define TM_BATCH_MAX_TILE_SIZE			(4 * 1024 * 1024)
+
+typedef struct {
+
+	int					tile_index;
+	int					*tile_status;
+	RoadMapCallback	callback;
+} BatchTile;
+
+typedef struct {
+
+	time_t				time_out;
+	int					count;			/* 0 when no batch is in flight */
+	BatchTile			tiles[TM_MAX_BATCH];
+	char					url[512];
+	HttpAsyncContext	*http_context;
+
+	/* the part being received */
+	unsigned char		part_header[TM_BATCH_PART_HEADER];
+	int					part_header_size;
+	int					part_tile_index;
+	int					part_size;
+	char					*tile_data;
+	size_t				tile_size;
+	int					broken;
+} BatchContext;
+
 
 static enum {
 	stat_First,
@@ -82,6 +127,11 @@ static int					  		 	NumOpenConnections = 0;
 
 static RoadMapConfigDescriptor 	RoadMapConfigTilesUrl =
                                   ROADMAP_CONFIG_ITEM("Download", "Tiles");
+static RoadMapConfigDescriptor 	RoadMapConfigTilesBatchUrl =
+                                  ROADMAP_CONFIG_ITEM("Download", "Tiles Batch");
+
+static BatchContext					Batch;
+static int								BatchUnsupported = 0;
 
 typedef struct {
 
@@ -102,12 +152,25 @@ static RoadMapConfigDescriptor 	LastLoadingSessionCfg =
 static RoadMapConfigDescriptor 	LoadingSessionLifetimeCfg =
                         ROADMAP_CONFIG_ITEM("Tiles", "Loading session lifetime");
 
+/* Prefetch budget: a rate limit, and a limit for the whole run which
+ * bounds what prefetching adds to the storage.
+ */
+static RoadMapConfigDescriptor 	PrefetchRateCfg =
+                        ROADMAP_CONFIG_ITEM("Tiles", "Prefetch tiles per minute");
+static RoadMapConfigDescriptor 	PrefetchLimitCfg =
+                        ROADMAP_CONFIG_ITEM("Tiles", "Prefetch tiles limit");
+
+static int								PrefetchTokens = -1;
+static time_t							PrefetchRefillTime = 0;
+static int								PrefetchCount = 0;
+
 
 
 static void load_next_tile (void);
 static void queue_tile (int index, int push, RoadMapCallback on_loaded);
 static void roadmap_tile_manager_login_cb (void);
 static void on_connection_failure (ConnectionContext *conn);
+static void requeue (int tile_index, int *tile_status, RoadMapCallback callback);
 
 static void init_loading_session (void) {
 
@@ -170,6 +233,79 @@ static void http_cb_progress (void *context, char *data, size_t size) {
 	conn->time_out = time (NULL) + TM_HTTP_TIMEOUT_SECONDS;
 }
 
+/* Called once the downloaded tile was stored and read, on the main thread */
+static void tile_prepared (int fips, int tile_index, void *prepared, void *context) {
+
+	RoadMapCallback *callback = (RoadMapCallback *)context;
+	int *tile_status = roadmap_tile_status_get (tile_index);
+	int unloaded;
+	int rc;
+
+   unloaded = roadmap_locator_unload_tile (tile_index);
+
+  	roadmap_label_clear (tile_index);
+  	roadmap_screen_clear_square (tile_index);
+  	navigate_graph_clear (tile_index);
+   if (!unloaded) {
+   	roadmap_square_delete_reference (tile_index);
+   }
+
+	rc = roadmap_locator_load_tile_prepared (fips, tile_index, prepared);
+
+   if (rc != ROADMAP_US_OK) {
+   	free (callback);
+		return;
+	}
+
+  	if (roadmap_tile_get_scale (tile_index) == 0) {
+		roadmap_street_update_city_index ();
+  	}
+
+   if (*callback) {
+   	(*callback) ();
+   }
+   free (callback);
+
+	roadmap_log (ROADMAP_DEBUG, "Download of tile %d complete", tile_index);
+   if (TileCallback != NULL && tile_status != NULL &&
+   	 (*tile_status) & ROADMAP_TILE_STATUS_FLAG_CALLBACK) {
+   	roadmap_log (ROADMAP_DEBUG, "Calling callback for tile %d", tile_index);
+   	TileCallback (tile_index);
+   }
+
+   roadmap_screen_refresh();
+}
+
+static void tile_received (int tile_index, int *tile_status, RoadMapCallback on_loaded,
+									char *tile_data, size_t tile_size) {
+
+   RoadMapCallback *callback = malloc (sizeof (RoadMapCallback));
+
+   roadmap_check_allocated (callback);
+   *callback = on_loaded;
+
+   *tile_status = ((*tile_status) |
+						 (ROADMAP_TILE_STATUS_FLAG_EXISTS | ROADMAP_TILE_STATUS_FLAG_UPTODATE)) &
+						~ROADMAP_TILE_STATUS_FLAG_ACTIVE;
+
+   /* storing and reading the tile are done in the background; the old
+    * version stays visible until then.
+    */
+   roadmap_db_prepare (roadmap_locator_active (), tile_index, tile_data, tile_size,
+   						  tile_prepared, callback);
+}
+
+/* The tile was not modified, or could not be downloaded */
+static void tile_not_received (int *tile_status, RoadMapCallback callback) {
+
+   *tile_status = ((*tile_status) |
+   							 (ROADMAP_TILE_STATUS_FLAG_ERROR | ROADMAP_TILE_STATUS_FLAG_UPTODATE)) &
+   							~ROADMAP_TILE_STATUS_FLAG_ACTIVE;
+   if (callback) {
+   	callback ();
+   }
+}
+
 static void http_cb_error (void *context, int connection_failure, const char *format, ...) {
 
    va_list ap;
@@ -197,81 +333,179 @@ static void http_cb_error (void *context, int connection_failure, const char *fo
 		return;
 	}
 
-   *conn->tile_status = ((*conn->tile_status) |
-   							 (ROADMAP_TILE_STATUS_FLAG_ERROR | ROADMAP_TILE_STATUS_FLAG_UPTODATE)) &
-   							~ROADMAP_TILE_STATUS_FLAG_ACTIVE;
-   if (conn->callback) {
-   	conn->callback ();
-   }
+   tile_not_received (conn->tile_status, conn->callback);
    conn->tile_status = NULL;
    NumOpenConnections--;
 
    load_next_tile ();
 }
 
-#ifndef J2ME
-#define NOPH_System_currentTimeMillis() time(NULL)
-#endif
 static void http_cb_done (void *context) {
 
    ConnectionContext *conn = (ConnectionContext *)context;
 	int *tile_status = conn->tile_status;
-   int tile_index = conn->tile_index;
-   int unloaded;
-	time_t t1;
-	time_t t2;
-	int rc;
-
-   t1 = NOPH_System_currentTimeMillis();
-   unloaded = roadmap_locator_unload_tile (tile_index);
-   t2 = NOPH_System_currentTimeMillis();
-   //printf("http_cb_done: unload %dms\n", t2 - t1);
-
-   roadmap_tile_store(roadmap_locator_active(), tile_index, conn->tile_data, conn->tile_size);
 
-   t2 = NOPH_System_currentTimeMillis();
-   //printf("http_cb_done: save %dms\n", t2 - t1);
-   *tile_status = ((*tile_status) |
-						 (ROADMAP_TILE_STATUS_FLAG_EXISTS | ROADMAP_TILE_STATUS_FLAG_UPTODATE)) &
-						~ROADMAP_TILE_STATUS_FLAG_ACTIVE;
    conn->tile_status = NULL;
    NumOpenConnections--;
 
-  	roadmap_label_clear (tile_index);
-  	navigate_graph_clear (tile_index);
-   if (!unloaded) {
-   	roadmap_square_delete_reference (tile_index);
-   }
+   tile_received (conn->tile_index, tile_status, conn->callback,
+   					conn->tile_data, conn->tile_size);
+   conn->tile_data = NULL;
 
-	rc = roadmap_locator_load_tile_mem (tile_index, conn->tile_data, conn->tile_size);
-	free (conn->tile_data);
-	conn->tile_data = NULL;
+   load_next_tile ();
+}
 
-   t2 = NOPH_System_currentTimeMillis();
-   //printf("http_cb_done: load %dms\n", t2 - t1);
+static void batch_part_done (void) {
 
-   load_next_tile ();
+	BatchTile *tile = NULL;
+	int i;
 
-   if (rc != ROADMAP_US_OK) {
-		return;
+	for (i = 0; i < Batch.count; i++) {
+		if (Batch.tiles[i].tile_index == Batch.part_tile_index &&
+			 Batch.tiles[i].tile_status != NULL) {
+			tile = Batch.tiles + i;
+			break;
+		}
 	}
 
-  	if (roadmap_tile_get_scale (tile_index) == 0) {
-		roadmap_street_update_city_index ();
-  	}
+	if (tile == NULL) {
+		roadmap_log (ROADMAP_ERROR, "Unexpected tile %d in batch response", Batch.part_tile_index);
+		free (Batch.tile_data);
+	} else if (Batch.part_size > 0) {
+		tile_received (tile->tile_index, tile->tile_status, tile->callback,
+							Batch.tile_data, Batch.tile_size);
+		tile->tile_status = NULL;
+	} else {
+		tile_not_received (tile->tile_status, tile->callback);
+		tile->tile_status = NULL;
+	}
 
-   if (conn->callback) {
-   	conn->callback ();
-   }
+	Batch.tile_data = NULL;
+	Batch.tile_size = 0;
+	Batch.part_header_size = 0;
+}
 
-	roadmap_log (ROADMAP_DEBUG, "Download of tile %d complete", tile_index);
-   if (TileCallback != NULL &&
-   	 (*tile_status) & ROADMAP_TILE_STATUS_FLAG_CALLBACK) {
-   	roadmap_log (ROADMAP_DEBUG, "Calling callback for tile %d", tile_index);
-   	TileCallback (tile_index);
-   }
+static int  batch_cb_size (void *context, size_t size) {
 
-   roadmap_screen_refresh();
+	Batch.part_header_size = 0;
+	Batch.tile_data = NULL;
+	Batch.broken = 0;
+
+	return size;
+}
+
+/* Splits the response into tiles */
+static void batch_cb_progress (void *context, char *data, size_t size) {
+
+	Batch.time_out = time (NULL) + TM_HTTP_TIMEOUT_SECONDS;
+
+	while (size > 0 && !Batch.broken) {
+
+		size_t copy;
+
+		if (Batch.part_header_size < TM_BATCH_PART_HEADER) {
+
+			copy = TM_BATCH_PART_HEADER - Batch.part_header_size;
+			if (copy > size) copy = size;
+			memcpy (Batch.part_header + Batch.part_header_size, data, copy);
+			Batch.part_header_size += copy;
+			data += copy;
+			size -= copy;
+
+			if (Batch.part_header_size < TM_BATCH_PART_HEADER) break;
+
+			Batch.part_tile_index = (int)(((unsigned int)Batch.part_header[0] << 24) |
+													(Batch.part_header[1] << 16) |
+													(Batch.part_header[2] << 8) |
+													 Batch.part_header[3]);
+			Batch.part_size = (int)(((unsigned int)Batch.part_header[4] << 24) |
+											(Batch.part_header[5] << 16) |
+											(Batch.part_header[6] << 8) |
+											 Batch.part_header[7]);
+
+			if (Batch.part_size > TM_BATCH_MAX_TILE_SIZE) {
+				roadmap_log (ROADMAP_ERROR, "Bad size %d for tile %d in batch response",
+								 Batch.part_size, Batch.part_tile_index);
+				Batch.broken = 1;
+				break;
+			}
+
+			if (Batch.part_size > 0) {
+				Batch.tile_data = malloc (Batch.part_size);
+				roadmap_check_allocated (Batch.tile_data);
+			}
+			Batch.tile_size = 0;
+		}
+
+		if (Batch.part_size > 0) {
+			copy = Batch.part_size - Batch.tile_size;
+			if (copy > size) copy = size;
+			memcpy (Batch.tile_data + Batch.tile_size, data, copy);
+			Batch.tile_size += copy;
+			data += copy;
+			size -= copy;
+
+			if ((int)Batch.tile_size < Batch.part_size) break;
+		}
+
+		batch_part_done ();
+	}
+}
+
+/* Ends the batch; the tiles which were not received are queued again */
+static void batch_end (int retry) {
+
+	int i;
+
+	if (Batch.tile_data) {
+		free (Batch.tile_data);
+		Batch.tile_data = NULL;
+	}
+
+	for (i = 0; i < Batch.count; i++) {
+		BatchTile *tile = Batch.tiles + i;
+
+		if (tile->tile_status == NULL) continue;
+
+		if (retry) {
+			requeue (tile->tile_index, tile->tile_status, tile->callback);
+		} else {
+			tile_not_received (tile->tile_status, tile->callback);
+		}
+	}
+
+	Batch.count = 0;
+	Batch.http_context = NULL;
+	NumOpenConnections--;
+}
+
+static void batch_cb_error (void *context, int connection_failure, const char *format, ...) {
+
+   va_list ap;
+   char err_string[1024];
+
+   va_start (ap, format);
+   vsnprintf (err_string, 1024, format, ap);
+   va_end (ap);
+	roadmap_log (ROADMAP_ERROR, "Batch tile request failed: %s", err_string);
+
+	batch_end (1);
+
+	if (connection_failure) {
+		on_connection_failure (NULL);
+		return;
+	}
+
+	/* probably not supported by the server, get the tiles one by one */
+	BatchUnsupported = 1;
+	load_next_tile ();
+}
+
+static void batch_cb_done (void *context) {
+
+	if (Batch.broken) BatchUnsupported = 1;
+	batch_end (Batch.broken);
+	load_next_tile ();
 }
 
 static void init_url (void) {
@@ -279,6 +513,9 @@ static void init_url (void) {
    roadmap_config_declare
       ("preferences",
       &RoadMapConfigTilesUrl, "", NULL);
+   roadmap_config_declare
+      ("preferences",
+      &RoadMapConfigTilesBatchUrl, "", NULL);
 }
 
 static const char *get_url_prefix (void) {
@@ -317,6 +554,82 @@ static void next_to_load (int *tile_index, int *priority, RoadMapCallback *callb
 }
 
 
+/* Takes the next tile which still needs to be loaded off the queue */
+static int *dequeue_tile (int *tile_index, int *priority, RoadMapCallback *tile_callback) {
+
+	int *tile_status;
+
+	do {
+		next_to_load (tile_index, priority, tile_callback);
+		if (*tile_index == -1) {
+			return NULL;
+		}
+		tile_status = roadmap_tile_status_get (*tile_index);
+		assert (tile_status != NULL);
+		if (((*tile_status) & ROADMAP_TILE_STATUS_FLAG_UPTODATE ) && *tile_callback) {
+			(*tile_callback) ();
+		}
+		*tile_status &= ~ROADMAP_TILE_STATUS_FLAG_QUEUED;
+	}
+	while ((*tile_status) & (ROADMAP_TILE_STATUS_FLAG_ACTIVE | ROADMAP_TILE_STATUS_FLAG_UPTODATE));
+
+	return tile_status;
+}
+
+/* Requests the tiles at the head of the queue together */
+static void load_batch (void) {
+
+	static RoadMapHttpAsyncCallbacks callbacks = { batch_cb_size, batch_cb_progress, batch_cb_error, batch_cb_done };
+	int fips = roadmap_locator_active ();
+	int tile_index;
+	int priority;
+	int *tile_status;
+	RoadMapCallback tile_callback;
+	size_t len;
+
+	len = snprintf (Batch.url, sizeof (Batch.url), "%s?fips=%05d&tiles=",
+						 roadmap_config_get (&RoadMapConfigTilesBatchUrl), fips);
+
+	Batch.count = 0;
+	while (Batch.count < TM_MAX_BATCH && len + 20 < sizeof (Batch.url)) {
+
+		BatchTile *tile;
+
+		tile_status = dequeue_tile (&tile_index, &priority, &tile_callback);
+		if (tile_status == NULL) break;
+
+		tile = Batch.tiles + Batch.count++;
+		tile->tile_index = tile_index;
+		tile->tile_status = tile_status;
+		tile->callback = tile_callback;
+		*tile_status |= ROADMAP_TILE_STATUS_FLAG_ACTIVE;
+
+		/* the tile and the time of the version we have */
+		len += snprintf (Batch.url + len, sizeof (Batch.url) - len, "%s%x.%lx",
+							  Batch.count > 1 ? "," : "", tile_index,
+							  (unsigned long)roadmap_square_timestamp (tile_index));
+	}
+
+	if (Batch.count == 0) return;
+
+	roadmap_log (ROADMAP_DEBUG, "Loading a batch of %d tiles", Batch.count);
+
+	Batch.time_out = 0;
+	Batch.tile_data = NULL;
+	Batch.part_header_size = 0;
+	NumOpenConnections++;
+
+	Batch.http_context = roadmap_http_async_get (&callbacks, &Batch, Batch.url, 0);
+
+	// failure is handled by batch_cb_error
+}
+
+static int batch_enabled (void) {
+
+	return !BatchUnsupported && Batch.count == 0 &&
+			 *roadmap_config_get (&RoadMapConfigTilesBatchUrl) != '\0';
+}
+
 static void load_next_tile (void) {
 
 	static RoadMapHttpAsyncCallbacks callbacks = { http_cb_size, http_cb_progress, http_cb_error, http_cb_done };
@@ -333,19 +646,15 @@ static void load_next_tile (void) {
 		return;
 	}
 
-	do {
-		next_to_load (&tile_index, &priority, &tile_callback);
-		if (tile_index == -1) {
-			return;
-		}
-		tile_status = roadmap_tile_status_get (tile_index);
-		assert (tile_status != NULL);
-		if (((*tile_status) & ROADMAP_TILE_STATUS_FLAG_UPTODATE ) && tile_callback) {
-			tile_callback ();
-		}
-		*tile_status &= ~ROADMAP_TILE_STATUS_FLAG_QUEUED;
+	if (QueueSize > 1 && batch_enabled ()) {
+		load_batch ();
+		return;
+	}
+
+	tile_status = dequeue_tile (&tile_index, &priority, &tile_callback);
+	if (tile_status == NULL) {
+		return;
 	}
-	while ((*tile_status) & (ROADMAP_TILE_STATUS_FLAG_ACTIVE | ROADMAP_TILE_STATUS_FLAG_UPTODATE));
 
 	roadmap_log (ROADMAP_DEBUG, "Loading tile %d -- priority %d",
 						tile_index, priority);
@@ -373,7 +682,7 @@ static void load_next_tile (void) {
 	tile_time = roadmap_square_timestamp (tile_index);
 
 	Connections[conn].http_context =
-		roadmap_http_async_copy (&callbacks,
+		roadmap_http_async_get (&callbacks,
 										 &Connections[conn],
 										 Connections[conn].url,
 										 tile_time);
@@ -381,10 +690,15 @@ static void load_next_tile (void) {
 	// failure is handled by http_cb_error
 }
 
+static void requeue (int tile_index, int *tile_status, RoadMapCallback callback) {
+
+   *tile_status = (*tile_status) & ~ROADMAP_TILE_STATUS_FLAG_ACTIVE;
+	queue_tile (tile_index, (*tile_status) & ROADMAP_TILE_STATUS_MASK_PRIORITY, callback);
+}
+
 static void requeue_tile (ConnectionContext *conn) {
 
-   *conn->tile_status = (*conn->tile_status) & ~ROADMAP_TILE_STATUS_FLAG_ACTIVE;
-	queue_tile (conn->tile_index, (*conn->tile_status) & ROADMAP_TILE_STATUS_MASK_PRIORITY, conn->callback);
+	requeue (conn->tile_index, conn->tile_status, conn->callback);
    conn->tile_status = NULL;
    NumOpenConnections--;
 }
@@ -402,6 +716,12 @@ static void roadmap_tile_manager_check_timeouts (void) {
 			requeue_tile (conn);
 		}
 	}
+
+	if (Batch.count && Batch.time_out && Batch.time_out < time_now) {
+		roadmap_log (ROADMAP_ERROR, "Timed out waiting for a batch of %d tiles", Batch.count);
+		roadmap_http_async_copy_abort (Batch.http_context);
+		batch_end (1);
+	}
 }
 
 static void start_network (void) {
@@ -423,7 +743,7 @@ static void roadmap_tile_manager_login_cb (void) {
 
 static void on_connection_failure (ConnectionContext *conn) {
 
-	requeue_tile (conn);
+	if (conn != NULL) requeue_tile (conn);
 	if (Status != stat_Active) return;
 	Status = stat_Waiting;
 	roadmap_main_set_periodic (TM_RETRY_CONNECTION_SECONDS * 1000, start_network);
@@ -487,6 +807,65 @@ static void queue_tile (int index, int priority, RoadMapCallback on_loaded) {
 						index, slot, (slot + 1 + TM_MAX_QUEUE - QueueHead) % TM_MAX_QUEUE, priority, Status);
 }
 
+static int prefetch_budget (void) {
+
+	int rate;
+	time_t now = time (NULL);
+
+	if (PrefetchTokens < 0) {
+		roadmap_config_declare ("preferences", &PrefetchRateCfg, "30", NULL);
+		roadmap_config_declare ("preferences", &PrefetchLimitCfg, "2000", NULL);
+		PrefetchTokens = 0;
+	}
+
+	if (PrefetchCount >= roadmap_config_get_integer (&PrefetchLimitCfg)) return 0;
+
+	rate = roadmap_config_get_integer (&PrefetchRateCfg);
+	if (now - PrefetchRefillTime >= 60) {
+		PrefetchTokens = rate;
+		PrefetchRefillTime = now;
+	} else {
+		int refill = rate * (int)(now - PrefetchRefillTime) / 60;
+
+		if (refill > 0) {
+			PrefetchTokens += refill;
+			if (PrefetchTokens > rate) PrefetchTokens = rate;
+			PrefetchRefillTime = now;
+		}
+	}
+
+	return PrefetchTokens > 0;
+}
+
+int roadmap_tile_prefetch (int index, int priority, int force_update) {
+
+	int *tile_status = roadmap_tile_status_get (index);
+
+	if ((*tile_status) & (ROADMAP_TILE_STATUS_FLAG_ACTIVE |
+								 ROADMAP_TILE_STATUS_FLAG_UPTODATE |
+								 ROADMAP_TILE_STATUS_FLAG_QUEUED)) {
+		return 1;
+	}
+
+	if (!force_update &&
+		 (((*tile_status) & ROADMAP_TILE_STATUS_FLAG_EXISTS) ||
+		  roadmap_tile_exists (roadmap_locator_active (), index))) {
+		/* already stored, a newer version is not worth the bandwidth */
+		return 1;
+	}
+
+	/* keep room in the queue for the tiles which are needed now */
+	if (QueueSize >= TM_MAX_QUEUE / 2 || !prefetch_budget ()) {
+		return 0;
+	}
+
+	PrefetchTokens--;
+	PrefetchCount++;
+	roadmap_tile_request (index, priority, 1, NULL);
+
+	return 1;
+}
+
 void roadmap_tile_request (int index, int priority, int force_update, RoadMapCallback on_loaded) {
 
 	int *tile_status = roadmap_tile_status_get (index);
@@ -30,6 +30,12 @@ typedef void (*RoadMapTileCallback) (int tile_id);
 
 RoadMapTileCallback roadmap_tile_register_callback (RoadMapTileCallback cb);
 void roadmap_tile_request (int index, int priority, int force_update, RoadMapCallback on_loaded);
+
+/* Requests a tile ahead of need, within the prefetch budget. Tiles which
+ * are already stored are only requested when force_update is set.
+ * Returns 0 if the budget is used up and the tile should be asked again.
+ */
+int  roadmap_tile_prefetch (int index, int priority, int force_update);
 void roadmap_tile_reset_session (void);
 
 #endif // _ROADMAP_TILE_MANAGER__H
@@ -46,7 +46,7 @@ typedef struct {
 static int	NumTiles = 0;
 
 static TileStatus *Tiles[TS_MAX_BLOCKS];
-static RoadMapHash *TileHash = NULL;
+static RoadMapHashMap *TileHash = NULL;
 
 static TileStatus *tile_status (int position) {
 	
@@ -70,17 +70,15 @@ static int *roadmap_tile_status_add (int index) {
 			return NULL;
 		}
 		if (TileHash == NULL) {
-			TileHash = roadmap_hash_new ("tile_loader", NumTiles + TS_BLOCK_SIZE);	
-		} else {
-			roadmap_hash_resize (TileHash, NumTiles + TS_BLOCK_SIZE); 
-		}	
+			TileHash = roadmap_hash_map_new ("tile_loader", TS_BLOCK_SIZE);	
+		}
 	}
 	
 	tile = Tiles[NumTiles / TS_BLOCK_SIZE] + NumTiles % TS_BLOCK_SIZE;
 	tile->status = 0;
 	tile->tile_index = index;
 	
-	roadmap_hash_add (TileHash, index, NumTiles);
+	roadmap_hash_map_set (TileHash, index, 0, NumTiles);
 	
 	NumTiles++;
 	return &tile->status;
@@ -88,20 +86,15 @@ static int *roadmap_tile_status_add (int index) {
 
 int *roadmap_tile_status_get (int index) {
 
-	TileStatus *tile;
 	int i;
 	
 	if (NumTiles == 0) {
 		return roadmap_tile_status_add (index);
 	}
 	
-	i = roadmap_hash_get_first (TileHash, index);
-	while (i >= 0) {
-		tile = tile_status (i);
-		if (tile->tile_index == index) {
-			return &tile->status;
-		}
-		i = roadmap_hash_get_next (TileHash, i);	
+	i = roadmap_hash_map_get (TileHash, index, 0);
+	if (i >= 0) {
+		return &tile_status (i)->status;
 	}
 	
 	return roadmap_tile_status_add (index);
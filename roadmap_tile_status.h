@@ -36,6 +36,7 @@
 
 #define	ROADMAP_TILE_STATUS_MASK_PRIORITY			0x00FF0000
 #define	ROADMAP_TILE_STATUS_PRIORITY_NONE			0x00000000
+#define	ROADMAP_TILE_STATUS_PRIORITY_TRACK			0x00080000	// ahead on the GPS track
 #define	ROADMAP_TILE_STATUS_PRIORITY_ON_SCREEN		0x00100000	// tile on screen
 
 #define	ROADMAP_TILE_STATUS_PRIORITY_PREFETCH		0x00300000	// 10KM ahead on navigation route
@@ -32,7 +32,18 @@
 #include "roadmap_file.h"
 #include "roadmap_path.h"
 #include "roadmap_locator.h"
+#include "roadmap_data_format.h"
+#include "roadmap_tile_worker.h"
 
+#ifdef ROADMAP_TILE_ARCHIVE
+#include "roadmap_tile_archive.h"
+#endif
+
+#ifdef ROADMAP_TILE_MAPPING
+#include "zlib/zlib.h"
+#endif
+
+static int RoadMapTileLoadCount = 0;
 
 static const char * get_tile_filename (int fips, int tile_index, int create_path) {
 
@@ -76,36 +87,130 @@ static const char * get_tile_filename (int fips, int tile_index, int create_path
    return filename;
 }
 
+#ifdef ROADMAP_TILE_MAPPING
+/* Uncompresses a compressed tile into a new buffer, so that it can be used
+ * in place. Returns NULL if the data is not a valid compressed tile.
+ */
+static void *make_raw (const void *data, size_t size, size_t *raw_tile_size) {
+
+   const roadmap_tile_file_header *compressed = (const roadmap_tile_file_header *)data;
+   roadmap_tile_file_header *raw;
+   unsigned char *raw_tile;
+   unsigned long raw_size;
+
+   if (size < sizeof (roadmap_tile_file_header) ||
+       compressed->compressed_data_size != size - sizeof (roadmap_tile_file_header)) {
+      return NULL;
+   }
+
+   raw_size = compressed->raw_data_size;
+   raw_tile = malloc (ROADMAP_TILE_RAW_DATA_OFFSET + raw_size);
+   if (!raw_tile) return NULL;
+
+   if (uncompress (raw_tile + ROADMAP_TILE_RAW_DATA_OFFSET, &raw_size,
+                   (const unsigned char *)(compressed + 1),
+                   compressed->compressed_data_size) != Z_OK ||
+       raw_size != compressed->raw_data_size) {
+      free (raw_tile);
+      return NULL;
+   }
+
+   memset (raw_tile, 0, ROADMAP_TILE_RAW_DATA_OFFSET);
+   raw = (roadmap_tile_file_header *)raw_tile;
+   *raw = *compressed;
+   raw->compressed_data_size = 0;
+
+   *raw_tile_size = ROADMAP_TILE_RAW_DATA_OFFSET + raw_size;
+   return raw_tile;
+}
+#endif
+
 int roadmap_tile_store (int fips, int tile_index, void *data, size_t size) {
 
    int res = 0;
+#ifdef ROADMAP_TILE_MAPPING
+   size_t raw_size;
+   void *raw = make_raw (data, size, &raw_size);
+
+   if (raw) {
+      data = raw;
+      size = raw_size;
+   }
+#endif
 
-   RoadMapFile file = roadmap_file_open(get_tile_filename(fips, tile_index, 1), "w");
+   roadmap_tile_worker_lock ();
 
-   if (ROADMAP_FILE_IS_VALID(file)) {
-      res = (roadmap_file_write(file, data, size) != (int)size);
+#ifdef ROADMAP_TILE_ARCHIVE
+   if (tile_index != -1) {
+      res = roadmap_tile_archive_store (fips, tile_index, data, size);
+      if (res == 0) {
+         /* a copy of the old layout is out of date */
+         roadmap_file_remove (NULL, get_tile_filename(fips, tile_index, 0));
+      } else {
+         roadmap_log(ROADMAP_ERROR, "Can't save tile data for %d", tile_index);
+      }
+   } else
+#endif
+   {
+      RoadMapFile file = roadmap_file_open(get_tile_filename(fips, tile_index, 1), "w");
 
-      roadmap_file_close(file);
-   } else {
-      res = -1;
-      roadmap_log(ROADMAP_ERROR, "Can't save tile data for %d", tile_index);
+      if (ROADMAP_FILE_IS_VALID(file)) {
+         res = (roadmap_file_write(file, data, size) != (int)size);
+         roadmap_file_close(file);
+      } else {
+         res = -1;
+         roadmap_log(ROADMAP_ERROR, "Can't save tile data for %d", tile_index);
+      }
    }
 
+   roadmap_tile_worker_unlock ();
+
+#ifdef ROADMAP_TILE_MAPPING
+   free (raw);
+#endif
+
    return res;
 }
 
 void roadmap_tile_remove (int fips, int tile_index) {
 
+   roadmap_tile_worker_lock ();
+#ifdef ROADMAP_TILE_ARCHIVE
+   if (tile_index != -1) roadmap_tile_archive_remove (fips, tile_index);
+#endif
    roadmap_file_remove(NULL, get_tile_filename(fips, tile_index, 0));
+   roadmap_tile_worker_unlock ();
 }
 
-int roadmap_tile_load (int fips, int tile_index, void **base, size_t *size) {
+int roadmap_tile_exists (int fips, int tile_index) {
+
+   int res = 0;
+
+   roadmap_tile_worker_lock ();
+#ifdef ROADMAP_TILE_ARCHIVE
+   if (tile_index != -1) res = roadmap_tile_archive_exists (fips, tile_index);
+#endif
+   if (!res) res = roadmap_file_exists (NULL, get_tile_filename(fips, tile_index, 0));
+   roadmap_tile_worker_unlock ();
+
+   return res;
+}
+
+static int tile_load (int fips, int tile_index, void **base, size_t *size) {
 
    RoadMapFile		file;
    int				res;
 
-   const char		*full_name = get_tile_filename(fips, tile_index, 0);
+   const char		*full_name;
+
+#ifdef ROADMAP_TILE_ARCHIVE
+   if (tile_index != -1 &&
+       roadmap_tile_archive_load (fips, tile_index, base, size) == 0) {
+      return 0;
+   }
+#endif
 
+   full_name = get_tile_filename(fips, tile_index, 0);
    file = roadmap_file_open (full_name, "r");
 
    if (!ROADMAP_FILE_IS_VALID(file)) {
@@ -130,4 +235,49 @@ int roadmap_tile_load (int fips, int tile_index, void **base, size_t *size) {
    return 0;
 }
 
+int roadmap_tile_load (int fips, int tile_index, void **base, size_t *size) {
+
+   int res;
+
+   roadmap_tile_worker_lock ();
+   res = tile_load (fips, tile_index, base, size);
+   if (res == 0) RoadMapTileLoadCount++;
+   roadmap_tile_worker_unlock ();
+
+   return res;
+}
+
+
+#ifdef ROADMAP_TILE_MAPPING
+int roadmap_tile_map (int fips, int tile_index, void **base, size_t *size,
+                      RoadMapFileContext *file) {
+
+   int res = -1;
+
+   roadmap_tile_worker_lock ();
+#ifdef ROADMAP_TILE_ARCHIVE
+   if (tile_index != -1) {
+      res = roadmap_tile_archive_map (fips, tile_index, base, size, file);
+   }
+#endif
+   if (res != 0 &&
+       roadmap_file_map ("maps", get_tile_filename(fips, tile_index, 0), NULL, "c", file) != NULL) {
+
+      *base = roadmap_file_base (*file);
+      *size = roadmap_file_size (*file);
+      res = 0;
+   }
+   if (res == 0) RoadMapTileLoadCount++;
+   roadmap_tile_worker_unlock ();
+
+   return res;
+}
+#endif
+
+
+int roadmap_tile_load_count (void) {
+
+   return RoadMapTileLoadCount;
+}
+
 
@@ -25,6 +25,19 @@
 
 #include <stdlib.h>
 
+#include "roadmap_file.h"
+
+/* Tiles are mapped rather than read where the mapping is copy on write */
+#if !defined(J2ME) && !defined(RIMAPI) && !defined(_WIN32) && \
+    !defined(__SYMBIAN32__) && !defined(NO_MAP_COMPRESSION)
+#define ROADMAP_TILE_MAPPING
+#endif
+
+/* Tiles are kept in a single archive per county rather than a file each */
+#ifndef J2ME
+#define ROADMAP_TILE_ARCHIVE
+#endif
+
 typedef void (*roadmap_tile_enum_cb) (int tile_index);
 
 int roadmap_tile_enumerate (int fips, roadmap_tile_enum_cb cb);
@@ -35,4 +48,16 @@ void roadmap_tile_remove (int fips, int tile_index);
 
 int roadmap_tile_load (int fips, int tile_index, void **data, size_t *size);
 
+/* Whether the tile is stored, without reading it */
+int roadmap_tile_exists (int fips, int tile_index);
+
+#ifdef ROADMAP_TILE_MAPPING
+/* Maps a stored tile in place; the data stays valid until it is unmapped */
+int roadmap_tile_map (int fips, int tile_index, void **data, size_t *size,
+                      RoadMapFileContext *file);
+#endif
+
+/* The number of tiles read from the storage so far */
+int roadmap_tile_load_count (void);
+
 #endif /*ROADMAP_TILE_STORAGE_H_*/
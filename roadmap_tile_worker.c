@@ -0,0 +1,296 @@
+/* roadmap_tile_worker.c - Background reading of tiles.
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009 Ehud Shabtai.
+ *
+ *   This file is part of Waze.
+ *
+ *   Waze is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Waze is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Waze; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * SYNOPSYS:
+ *
+ *   See roadmap_tile_worker.h
+ */
+
+#include <stdio.h>
+
+#include "roadmap.h"
+#include "roadmap_main.h"
+#include "roadmap_tile_worker.h"
+
+#ifdef ROADMAP_TILE_WORKER
+
+#include <pthread.h>
+
+/* must be a power of 2 */
+#define TILE_WORKER_QUEUE        64
+#define TILE_WORKER_POLL_MS      30
+
+typedef struct {
+
+   RoadMapTileJob          jobs[TILE_WORKER_QUEUE];
+
+   volatile unsigned int   head;    /* only written by the consumer */
+   volatile unsigned int   tail;    /* only written by the producer */
+} TileJobQueue;
+
+static TileJobQueue     Requests;
+static TileJobQueue     Results;
+
+static enum {
+   worker_None,
+   worker_Running,
+   worker_Failed
+} WorkerState = worker_None;
+
+static pthread_t        Worker;
+static pthread_key_t    WorkerJob;  /* the job running on this thread */
+static pthread_mutex_t  WakeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   Wake = PTHREAD_COND_INITIALIZER;
+static volatile int     StopWorker = 0;
+
+static pthread_mutex_t  StorageLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Jobs posted and not collected yet, only used by the main thread */
+static RoadMapTileJob   InFlight[TILE_WORKER_QUEUE];
+static int              InFlightCount = 0;
+static int              Polling = 0;
+
+
+static int queue_push (TileJobQueue *queue, const RoadMapTileJob *job) {
+
+   unsigned int tail = queue->tail;
+
+   if (tail - queue->head == TILE_WORKER_QUEUE) return 0;
+
+   queue->jobs[tail & (TILE_WORKER_QUEUE - 1)] = *job;
+
+   /* the job must be visible before the slot is published */
+   __sync_synchronize ();
+   queue->tail = tail + 1;
+
+   return 1;
+}
+
+
+static int queue_pop (TileJobQueue *queue, RoadMapTileJob *job) {
+
+   unsigned int head = queue->head;
+
+   if (head == queue->tail) return 0;
+
+   __sync_synchronize ();
+   *job = queue->jobs[head & (TILE_WORKER_QUEUE - 1)];
+
+   /* the job must be copied before the slot is released */
+   __sync_synchronize ();
+   queue->head = head + 1;
+
+   return 1;
+}
+
+
+/* Keeps the messages of the worker in its job; other threads log them */
+static int worker_log (int level, const char *source, int line, const char *format, va_list ap) {
+
+   RoadMapTileJob *job = (RoadMapTileJob *)pthread_getspecific (WorkerJob);
+
+   if (job == NULL) return 0;
+
+   if (level > job->log_level) {
+      job->log_level = level;
+      job->log_source = source;
+      job->log_line = line;
+      vsnprintf (job->log, sizeof (job->log), format, ap);
+   }
+
+   return 1;
+}
+
+
+static void *worker_main (void *arg) {
+
+   RoadMapTileJob job;
+
+   for (;;) {
+
+      pthread_mutex_lock (&WakeLock);
+      while (!StopWorker && Requests.head == Requests.tail) {
+         pthread_cond_wait (&Wake, &WakeLock);
+      }
+      pthread_mutex_unlock (&WakeLock);
+
+      if (!queue_pop (&Requests, &job)) {
+         if (StopWorker) break;
+         continue;
+      }
+
+      job.log_level = 0;
+      pthread_setspecific (WorkerJob, &job);
+      job.work (&job);
+      pthread_setspecific (WorkerJob, NULL);
+
+      /* never full: there are no more jobs in flight than slots */
+      queue_push (&Results, &job);
+   }
+
+   return NULL;
+}
+
+
+static void worker_collect (void) {
+
+   RoadMapTileJob job;
+   int i;
+
+   while (queue_pop (&Results, &job)) {
+
+      for (i = 0; i < InFlightCount; i++) {
+         if (InFlight[i].fips == job.fips &&
+             InFlight[i].tile_index == job.tile_index) {
+            InFlight[i] = InFlight[--InFlightCount];
+            break;
+         }
+      }
+
+      if (job.log_level) {
+         roadmap_log (job.log_level, job.log_source, job.log_line, "%s", job.log);
+      }
+
+      job.done (&job);
+   }
+}
+
+
+static void worker_poll (void) {
+
+   worker_collect ();
+
+   if (InFlightCount == 0 && Polling) {
+      roadmap_main_remove_periodic (worker_poll);
+      Polling = 0;
+   }
+}
+
+
+int roadmap_tile_worker_post (const RoadMapTileJob *job) {
+
+   if (WorkerState == worker_None) {
+
+      /* set before the worker may log anything */
+      roadmap_log_register_redirect (worker_log);
+
+      if (pthread_key_create (&WorkerJob, NULL) == 0 &&
+          pthread_create (&Worker, NULL, worker_main, NULL) == 0) {
+         WorkerState = worker_Running;
+      } else {
+         roadmap_log_register_redirect (NULL);
+         roadmap_log (ROADMAP_ERROR, "Can't start the tile worker, reading tiles inline");
+         WorkerState = worker_Failed;
+      }
+   }
+
+   if (WorkerState != worker_Running ||
+       InFlightCount == TILE_WORKER_QUEUE ||
+       !queue_push (&Requests, job)) {
+      return -1;
+   }
+
+   InFlight[InFlightCount++] = *job;
+
+   pthread_mutex_lock (&WakeLock);
+   pthread_cond_signal (&Wake);
+   pthread_mutex_unlock (&WakeLock);
+
+   if (!Polling) {
+      roadmap_main_set_periodic (TILE_WORKER_POLL_MS, worker_poll);
+      Polling = 1;
+   }
+
+   return 0;
+}
+
+
+int roadmap_tile_worker_pending (int fips, int tile_index) {
+
+   int i;
+
+   for (i = 0; i < InFlightCount; i++) {
+      if (InFlight[i].fips == fips && InFlight[i].tile_index == tile_index) {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+
+void roadmap_tile_worker_lock (void) {
+
+   pthread_mutex_lock (&StorageLock);
+}
+
+
+void roadmap_tile_worker_unlock (void) {
+
+   pthread_mutex_unlock (&StorageLock);
+}
+
+
+void roadmap_tile_worker_shutdown (void) {
+
+   if (WorkerState != worker_Running) return;
+
+   pthread_mutex_lock (&WakeLock);
+   StopWorker = 1;
+   pthread_cond_signal (&Wake);
+   pthread_mutex_unlock (&WakeLock);
+
+   pthread_join (Worker, NULL);
+   WorkerState = worker_Failed;
+   roadmap_log_register_redirect (NULL);
+
+   /* the worker ran all the posted jobs before it stopped */
+   worker_collect ();
+
+   if (Polling) {
+      roadmap_main_remove_periodic (worker_poll);
+      Polling = 0;
+   }
+   InFlightCount = 0;
+}
+
+#else
+
+int roadmap_tile_worker_post (const RoadMapTileJob *job) {
+
+   return -1;
+}
+
+
+int roadmap_tile_worker_pending (int fips, int tile_index) {
+
+   return 0;
+}
+
+
+void roadmap_tile_worker_lock (void) {}
+
+void roadmap_tile_worker_unlock (void) {}
+
+void roadmap_tile_worker_shutdown (void) {}
+
+#endif /* ROADMAP_TILE_WORKER */
@@ -0,0 +1,86 @@
+/* roadmap_tile_worker.h - Background reading of tiles.
+ *
+ * LICENSE:
+ *
+ *   Copyright 2009 Ehud Shabtai
+ *
+ *   This file is part of Waze.
+ *
+ *   Waze is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Waze is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Waze; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * DESCRIPTION:
+ *
+ *   A single worker thread runs tile jobs posted by the main thread. Jobs
+ *   and their results are passed through two single producer / single
+ *   consumer rings, so neither thread ever waits for the other; the main
+ *   loop collects the results with a periodic timer while jobs are in
+ *   flight. The work function runs on the worker thread and may only use
+ *   the job and the tile storage (between lock and unlock); the done
+ *   function runs on the main thread. What the work logs is kept in the
+ *   job and logged by the main thread before done is called.
+ */
+#ifndef ROADMAP_TILE_WORKER_H_
+#define ROADMAP_TILE_WORKER_H_
+
+#include <stdlib.h>
+
+#if !defined(J2ME) && !defined(RIMAPI) && !defined(_WIN32) && !defined(__SYMBIAN32__)
+#define ROADMAP_TILE_WORKER
+#endif
+
+#define ROADMAP_TILE_WORKER_LOG  160
+
+struct RoadMapTileJob_s;
+
+typedef void (*RoadMapTileWork) (struct RoadMapTileJob_s *job);
+
+typedef struct RoadMapTileJob_s {
+
+   int               fips;
+   int               tile_index;
+
+   void              *data;
+   size_t            size;
+
+   RoadMapTileWork   work;      /* called on the worker thread */
+   RoadMapTileWork   done;      /* called on the main thread */
+   void              *context;
+   void              *result;
+
+   /* the most severe message logged by the work, if log_level is not 0 */
+   int               log_level;
+   const char        *log_source;
+   int               log_line;
+   char              log[ROADMAP_TILE_WORKER_LOG];
+} RoadMapTileJob;
+
+/* Returns -1 if there is no worker or too many jobs are in flight; the
+ * caller then does the job itself.
+ */
+int  roadmap_tile_worker_post (const RoadMapTileJob *job);
+
+/* Whether a job for the tile was posted and is not done yet */
+int  roadmap_tile_worker_pending (int fips, int tile_index);
+
+/* Serializes the access to the tile storage */
+void roadmap_tile_worker_lock (void);
+void roadmap_tile_worker_unlock (void);
+
+/* Lets the worker finish the posted jobs and stops it, then collects the
+ * results which were not collected yet.
+ */
+void roadmap_tile_worker_shutdown (void);
+
+#endif /*ROADMAP_TILE_WORKER_H_*/
@@ -113,6 +113,12 @@ int   roadmap_file_read  (RoadMapFile file, void *data, int size)
   return pFile->Read(data, size);
 }
 
+int   roadmap_file_read_at (RoadMapFile file, int offset, void *data, int size)
+{
+  if ( roadmap_file_seek (file, offset, ROADMAP_SEEK_START) < 0 ) {return -1;}
+  return roadmap_file_read (file, data, size);
+}
+
 int   roadmap_file_write (RoadMapFile file, const void *data, int length)
 {
   if ( file == NULL || length == 0 || data == NULL ) {return 0;}
@@ -47,6 +47,7 @@ struct RoadMapFileContextStructure {
    int   fd;
    void *base;
    int   size;
+   int   shift;  /* from the start of the mapped page to base */
 };
 
 
@@ -211,6 +212,7 @@ const char *roadmap_file_map (const char *set,
    struct stat state_result;
    int open_mode;
    int map_mode;
+   int map_flags = MAP_SHARED;
 
 
    context = malloc (sizeof(*context));
@@ -219,10 +221,16 @@ const char *roadmap_file_map (const char *set,
    context->fd = -1;
    context->base = NULL;
    context->size = 0;
+   context->shift = 0;
 
    if (strcmp(mode, "r") == 0) {
       open_mode = O_RDONLY;
       map_mode = PROT_READ;
+   } else if (strcmp(mode, "c") == 0) {
+      /* private copy on write, the file is not modified */
+      open_mode = O_RDONLY;
+      map_mode = PROT_READ|PROT_WRITE;
+      map_flags = MAP_PRIVATE;
    } else if (strchr (mode, 'w') != NULL) {
       open_mode = O_RDWR;
       map_mode = PROT_READ|PROT_WRITE;
@@ -303,8 +311,11 @@ const char *roadmap_file_map (const char *set,
    context->size = state_result.st_size;
 
    context->base =
-      mmap (NULL, state_result.st_size, map_mode, MAP_SHARED, context->fd, 0);
+      mmap (NULL, state_result.st_size, map_mode, map_flags, context->fd, 0);
 
+   if (context->base == MAP_FAILED) {
+      context->base = NULL;
+   }
    if (context->base == NULL) {
       roadmap_log (ROADMAP_ERROR, "cannot map file %s", name);
       roadmap_file_unmap (&context);
@@ -317,6 +328,44 @@ const char *roadmap_file_map (const char *set,
 }
 
 
+RoadMapFileContext roadmap_file_map_range (RoadMapFile file, int offset, int size,
+                                           const char *mode) {
+
+   RoadMapFileContext context;
+   int shift = offset % (int)sysconf (_SC_PAGESIZE);
+   int map_mode;
+   int map_flags;
+   void *base;
+
+   if (strcmp(mode, "r") == 0) {
+      map_mode = PROT_READ;
+      map_flags = MAP_SHARED;
+   } else if (strcmp(mode, "c") == 0) {
+      map_mode = PROT_READ|PROT_WRITE;
+      map_flags = MAP_PRIVATE;
+   } else {
+      roadmap_log (ROADMAP_ERROR, "invalid file range access mode %s", mode);
+      return NULL;
+   }
+
+   base = mmap (NULL, size + shift, map_mode, map_flags, (int)file, offset - shift);
+   if (base == MAP_FAILED) {
+      roadmap_log (ROADMAP_ERROR, "cannot map %d bytes at %d, errno = %d", size, offset, errno);
+      return NULL;
+   }
+
+   context = malloc (sizeof(*context));
+   roadmap_check_allocated(context);
+
+   context->fd = -1;
+   context->base = (char *)base + shift;
+   context->size = size;
+   context->shift = shift;
+
+   return context;
+}
+
+
 void *roadmap_file_base (RoadMapFileContext file){
 
    if (file == NULL) {
@@ -338,7 +387,7 @@ int roadmap_file_size (RoadMapFileContext file){
 int roadmap_file_sync (RoadMapFileContext file) {
 
    if (file->base != NULL) {
-      return msync (file->base, file->size, MS_SYNC);
+      return msync ((char *)file->base - file->shift, file->size + file->shift, MS_SYNC);
    }
 
    return -1;
@@ -350,7 +399,7 @@ void roadmap_file_unmap (RoadMapFileContext *file) {
    RoadMapFileContext context = *file;
 
    if (context->base != NULL) {
-      munmap (context->base, context->size);
+      munmap ((char *)context->base - context->shift, context->size + context->shift);
    }
 
    if (context->fd >= 0) {
@@ -387,6 +436,10 @@ int roadmap_file_read  (RoadMapFile file, void *data, int size) {
    return read ((int)file, data, size);
 }
 
+int roadmap_file_read_at (RoadMapFile file, int offset, void *data, int size) {
+   return pread ((int)file, data, size, offset);
+}
+
 int roadmap_file_write (RoadMapFile file, const void *data, int length) {
    return write ((int)file, data, length);
 }